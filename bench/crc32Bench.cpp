@@ -0,0 +1,72 @@
+// Per-byte cost of the checksums at typical commit log record sizes.
+//   cmake --build build --target crc32Bench && ./build/crc32Bench
+
+#include "util/crc32.h"
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace xeondb;
+
+// The byte-at-a-time loop crc32 used before slice-by-8, as a baseline.
+static u32 crc32Bytewise(const u8* data, usize size) {
+    static const auto table = []() {
+        std::array<u32, 256> t{};
+        for (u32 i = 0; i < 256; i++) {
+            u32 c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            t[i] = c;
+        }
+        return t;
+    }();
+    u32 c = 0xFFFFFFFFu;
+    for (usize i = 0; i < size; i++)
+        c = table[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+template <typename Fn>
+static double nanosPerByte(Fn fn, const std::vector<u8>& buf, usize size) {
+    const usize iterations = std::max<usize>(1, (usize{256} << 20) / size);
+    volatile u32 sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (usize i = 0; i < iterations; i++)
+        sink = sink ^ fn(buf.data() + (i & 63), size);
+    auto nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return nanos / static_cast<double>(iterations * size);
+}
+
+int main() {
+    const u8 check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    if (crc32(check, sizeof(check)) != 0xCBF43926u || crc32Bytewise(check, sizeof(check)) != 0xCBF43926u ||
+        crc32cPortable(check, sizeof(check)) != 0xE3069283u || crc32c(check, sizeof(check)) != 0xE3069283u) {
+        std::fprintf(stderr, "check value mismatch\n");
+        return 1;
+    }
+
+    std::vector<u8> buf((usize{1} << 20) + 64);
+    std::mt19937 rng(42);
+    for (auto& b : buf)
+        b = static_cast<u8>(rng());
+    for (usize size = 0; size < 300; size++) {
+        for (usize at = 0; at < 8; at++) {
+            if (crc32(buf.data() + at, size) != crc32Bytewise(buf.data() + at, size) || crc32c(buf.data() + at, size) != crc32cPortable(buf.data() + at, size)) {
+                std::fprintf(stderr, "mismatch size=%zu offset=%zu\n", size, at);
+                return 1;
+            }
+        }
+    }
+
+    std::printf("crc32c hardware: %s\n", crc32cAccelerated() ? "yes" : "no");
+    std::printf("%10s %12s %12s %12s %12s   (ns/byte)\n", "bytes", "crc32/byte", "crc32/8", "crc32c/8", "crc32c");
+    for (usize size : {32, 64, 128, 256, 512, 1024, 4096, 65536, 1 << 20}) {
+        std::printf("%10zu %12.3f %12.3f %12.3f %12.3f\n", size, nanosPerByte(crc32Bytewise, buf, size), nanosPerByte(crc32, buf, size),
+            nanosPerByte(crc32cPortable, buf, size), nanosPerByte(crc32c, buf, size));
+    }
+    return 0;
+}
@@ -12,13 +12,31 @@ struct Settings {
     string host;
     u16 port;
     string dataDir;
+    u64 blockCacheBytes;
     usize maxLineBytes;
     usize maxConnections;
+    usize listenBacklog;
+    usize eventLoopThreads;
+    usize workerThreads;
     string walFsync;
     u64 walFsyncIntervalMs;
     usize walFsyncBytes;
+    usize walSegmentBytes;
+    bool walShared;
+    string walIoBackend;
+    usize walRecoveryThreads;
     usize memtableMaxBytes;
+    usize memtableMaxImmutable;
     usize sstableIndexStride;
+    usize sstableBloomBitsPerKey;
+    usize sstableBlockBytes;
+    string sstableCompression;
+    usize compactionConcurrency;
+    u64 compactionThroughputBytesPerSec;
+    usize compactionMinThreshold;
+    usize compactionMaxThreshold;
+    u64 leveledSstableBytes;
+    u64 leveledSizeRatio;
     bool quotaEnforcementEnabled;
     u64 quotaBytesUsedCacheTtlMs;
     string authUsername;
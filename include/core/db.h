@@ -12,6 +12,8 @@
 #include <vector>
 
 #include "config/config.h"
+#include "storage/blockCache.h"
+#include "storage/compaction.h"
 #include "storage/table.h"
 
 using std::filesystem::path;
@@ -28,6 +30,7 @@ struct AuthedUser {
 class Db {
 public:
     explicit Db(Settings settings);
+    ~Db();
 
     const path& dataDir() const;
     const Settings& settings() const;
@@ -56,7 +59,7 @@ public:
     std::optional<u64> keyspaceQuotaBytes(const string& keyspace) const;
 
     void createKeyspace(const string& keyspace);
-    path createTable(const string& keyspace, const string& table, const TableSchema& schema);
+    path createTable(const string& keyspace, const string& table, const TableSchema& schema, const TableOptions& options = TableOptions{});
 
     shared_ptr<Table> openTable(const string& keyspace, const string& table);
 
@@ -80,9 +83,33 @@ public:
     void metricsOnCommand(const string& keyspace);
     void metricsSampleAll();
     KeyspaceMetrics keyspaceMetrics(const string& keyspace) const;
+    // All zero when blockCacheBytes is 0.
+    BlockCacheStats blockCacheStats() const;
+    // Summed over the keyspace's tables opened since startup; node-wide
+    // with walShared.
+    CommitLogStats walStats(const string& keyspace);
 
 private:
+    // A table directory found on disk at startup.
+    struct StoredTable {
+        string keyspace;
+        string table;
+        string uuid;
+        path dir;
+    };
+
     shared_ptr<Table> openTableUnlocked(const string& keyspace, const string& table);
+    // Builds and recovers the table without registering it; reads carried_
+    // but leaves it to the caller to drop the records once registered.
+    shared_ptr<Table> loadTable(const string& keyspace, const string& table, const string& uuid);
+    TableSettings tableSettings() const;
+    std::vector<StoredTable> storedTables() const;
+    // Returns the shared log left over from walShared when it is now off; it
+    // is closed once its records are carried into per-table logs.
+    shared_ptr<CommitLog> recoverSharedLog(const std::vector<StoredTable>& stored);
+    // Opens every table up front, walRecoveryThreads at a time.
+    void recoverTables(const std::vector<StoredTable>& stored);
+    void onLogPressure(const std::vector<string>& uuids);
 
     static bool isSystemKeyspace(const string& keyspace);
     static string grantKey(const string& keyspace, const string& username);
@@ -91,9 +118,16 @@ private:
 
     Settings settings_;
     path effectiveDataDir_;
+    shared_ptr<CompactionExecutor> compaction_;
+    shared_ptr<BlockCache> blockCache_;
 
     std::mutex mutex_;
     std::unordered_map<string, shared_ptr<Table>> tables_;
+    // Null unless walShared.
+    shared_ptr<CommitLog> sharedLog_;
+    // Unflushed records read from the shared log, by table uuid, until the
+    // table is opened.
+    std::unordered_map<string, std::vector<CommitLogRecord>> carried_;
 
     struct MetricsSeries {
         static constexpr i64 bucketMs = 5 * 60 * 1000;
@@ -6,9 +6,11 @@
 #include <string>
 #include <unordered_map>
 #include <optional>
+#include <vector>
 
 #include "core/db.h"
 #include "prelude.h"
+#include "query/sql.h"
 
 namespace xeondb {
 
@@ -29,10 +31,16 @@ struct SqlShowMetrics;
 struct SqlTruncateTable;
 struct SqlDelete;
 struct SqlUpdate;
+struct SqlPrepare;
+struct SqlExecute;
+struct SqlDeallocate;
+struct PreparedStatement;
 
 class ServerTcp {
 public:
-    ServerTcp(std::shared_ptr<Db> db, std::string host, u16 port, usize maxLineBytes, usize maxConnections, std::string authUsername, std::string authPassword);
+    // eventLoops and workers of 0 pick a default from the core count.
+    ServerTcp(std::shared_ptr<Db> db, std::string host, u16 port, usize maxLineBytes, usize maxConnections, usize listenBacklog, usize eventLoops,
+            usize workers, std::string authUsername, std::string authPassword);
     ~ServerTcp();
 
     ServerTcp(const ServerTcp&) = delete;
@@ -41,7 +49,47 @@ public:
     void run();
 
 private:
-    void handleClient(int clientFd);
+    // What a connection carries from one command to the next.
+    struct Session {
+        std::string keyspace;
+        std::optional<AuthedUser> user;
+        // Statements prepared over the binary protocol, by id.
+        std::unordered_map<u32, std::shared_ptr<const PreparedStatement>> prepared;
+        u32 nextStatementId = 1;
+        // Statements from PREPARE, by name.
+        std::unordered_map<std::string, std::shared_ptr<const PreparedStatement>> named;
+    };
+    struct Connection;
+    class EventLoop;
+    class WorkerPool;
+
+    // Runs one request line and returns its response (without the newline).
+    std::string handleLine(Session& session, const std::string& line);
+    std::string runCommand(Session& session, const SqlCommand& cmd);
+    // Runs one binary protocol frame (opcode and payload) and returns the
+    // encoded response frame.
+    std::string handleFrame(Session& session, const std::string& frame);
+    std::string prepareStatement(Session& session, const std::string& sql);
+    std::string executeStatement(Session& session, stringView body);
+    std::string selectRows(const PreparedStatement& stmt, Table& table, const SqlSelect& select, const AuthedUser& u);
+    std::string selectJson(const PreparedStatement& stmt, Table& table, const SqlSelect& select, const AuthedUser& u);
+    // Resolves a statement's table and columns; throws if it cannot be prepared.
+    std::shared_ptr<const PreparedStatement> planStatement(SqlCommand cmd, const std::string& currentKeyspace, const AuthedUser& u);
+    // Opens the statement's table, planning the statement again first if the
+    // table was dropped and recreated since.
+    std::shared_ptr<Table> planTable(std::shared_ptr<const PreparedStatement>& stmt, const AuthedUser& u);
+    void endSession(Session& session);
+
+    struct ListenStats {
+        u64 sockets = 0;
+        // The accept queue limit the kernel applies (listenBacklog capped by somaxconn).
+        u64 backlog = 0;
+        u64 queued = 0;
+        // Host-wide kernel counters since startup.
+        u64 overflows = 0;
+        u64 drops = 0;
+    };
+    ListenStats listenStats() const;
 
     std::string cmdAuth(const SqlAuth& auth, std::optional<AuthedUser>& currentUser);
     std::string cmdPing();
@@ -62,6 +110,9 @@ private:
     std::string cmdFlush(const SqlFlush& flush, const std::string& currentKeyspace, const AuthedUser& u);
     std::string cmdDelete(const SqlDelete& del, const std::string& currentKeyspace, const AuthedUser& u);
     std::string cmdUpdate(const SqlUpdate& upd, const std::string& currentKeyspace, const AuthedUser& u);
+    std::string cmdPrepare(const SqlPrepare& prepare, Session& session, const AuthedUser& u);
+    std::string cmdExecute(const SqlExecute& execute, Session& session, const AuthedUser& u);
+    std::string cmdDeallocate(const SqlDeallocate& deallocate, Session& session);
 
     std::optional<u64> quotaBytesForKeyspace(const std::string& keyspace) const;
     bool quotaWouldAllowAndReserve(const std::string& keyspace, u64 quotaBytes, u64 estimatedWriteBytes);
@@ -73,10 +124,18 @@ private:
     u16 port_;
     usize maxLineBytes_;
     usize maxConnections_;
+    usize listenBacklog_;
     std::string authUsername_;
     std::string authPassword_;
     bool authEnabled_;
+    usize eventLoopCount_;
+    usize workerCount_;
     std::atomic<usize> connectionCount_;
+    std::unique_ptr<WorkerPool> workers_;
+    std::vector<std::unique_ptr<EventLoop>> loops_;
+    std::vector<int> listenFds_;
+    u64 listenOverflowsBase_;
+    u64 listenDropsBase_;
 
     struct BytesUsedCacheEntry {
         u64 bytesUsed = 0;
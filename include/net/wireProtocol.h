@@ -0,0 +1,45 @@
+#pragma once
+
+#include "prelude.h"
+
+#include <string>
+
+namespace xeondb {
+
+// Binary protocol, chosen by a client that opens with the 4 magic bytes and a
+// version byte (the line protocol never starts with a zero byte). The server
+// echoes both and from then on each side sends frames: a big-endian u32
+// length of what follows, an opcode byte, then the payload. Integers are
+// big-endian, and values use their column type's canonical encoding (as
+// partitionKeyBytes produces) behind a u32 length, 0xFFFFFFFF for null.
+inline constexpr const char wireMagic[] = {'\0', 'X', 'D', 'B'};
+inline constexpr usize wireMagicLen = sizeof(wireMagic);
+inline constexpr u8 wireVersion = 1;
+inline constexpr u32 wireNull = 0xFFFFFFFFu;
+
+enum class WireOp : u8 {
+    // Client: SQL text, answered with Json exactly as on the line protocol.
+    Query = 0x01,
+    // Client: SQL text with ? placeholders; answered with Prepared.
+    Prepare = 0x02,
+    // Client: u32 statement id, u16 value count, the values.
+    Execute = 0x03,
+    // Client: u32 statement id.
+    Close = 0x04,
+
+    // Server: the JSON response text.
+    Json = 0x81,
+    // Server: u32 statement id, u16 parameter count and a type byte each, u16
+    // result column count and per column a type byte, u16 name length and
+    // name. Without result columns, Execute answers with Json.
+    Prepared = 0x82,
+    // Server: u16 column count, u32 row count, then the rows' values.
+    Rows = 0x83,
+    // Server: the error message.
+    Error = 0xFF,
+};
+
+// A whole frame: length, op and payload.
+std::string wireFrame(WireOp op, stringView payload);
+
+}
@@ -21,8 +21,20 @@ struct TableSchema {
     usize primaryKeyIndex;
 };
 
+enum class CompactionStrategy : u8 { SizeTiered = 1, Leveled = 2 };
+
+// Per-table settings chosen by CREATE TABLE ... WITH and kept in metadata.bin.
+struct TableOptions {
+    CompactionStrategy compaction = CompactionStrategy::SizeTiered;
+    // Rows kept in the table's row cache; 0 disables it.
+    u64 rowCacheRows = 0;
+};
+
 struct SqlLiteral {
-    enum class Kind : u8 { Null = 1, Number = 2, Bool = 3, Quoted = 4, Hex = 5, Base64 = 6 };
+    // Param is a ? placeholder of a prepared statement. Bytes is a bound
+    // parameter, already in its column type's canonical encoding (the bytes
+    // partitionKeyBytes produces).
+    enum class Kind : u8 { Null = 1, Number = 2, Bool = 3, Quoted = 4, Hex = 5, Base64 = 6, Param = 7, Bytes = 8 };
 
     Kind kind;
     string text;
@@ -31,6 +43,9 @@ struct SqlLiteral {
 std::optional<ColumnType> columnTypeFromName(const string& s);
 std::string columnTypeName(ColumnType t);
 
+std::optional<CompactionStrategy> compactionStrategyFromName(const string& s);
+std::string compactionStrategyName(CompactionStrategy s);
+
 std::optional<usize> findColumnIndex(const TableSchema& schema, const string& name);
 
 byteVec partitionKeyBytes(ColumnType type, const SqlLiteral& lit);
@@ -40,10 +55,20 @@ byteVec rowBytes(const TableSchema& schema, const std::vector<string>& columnNam
 string dateFromDays(i32 days);
 string timestampFromMs(i64 ms);
 
+// A row as a JSON object of the given columns (schema indices), each under
+// the matching name.
+string rowToJsonColumns(const TableSchema& schema, const byteVec& pkBytes, const byteVec& rowBytes, const std::vector<usize>& columns,
+        const std::vector<string>& names);
+
 string rowToJsonMapped(const TableSchema& schema, const byteVec& pkBytes, const byteVec& rowBytes, const std::vector<std::pair<string, string>>& selectColumns);
 
 string rowToJson(const TableSchema& schema, const byteVec& pkBytes, const byteVec& rowBytes, const std::vector<string>& selectColumns);
 
+// Appends the given columns (schema indices) of a row for the binary
+// protocol: per column a big-endian u32 length, or 0xFFFFFFFF for null, then
+// the value in its canonical encoding.
+void appendRowBinary(string& out, const TableSchema& schema, const byteVec& pkBytes, const byteVec& rowBytes, const std::vector<usize>& columns);
+
 byteVec mergeRowBytesForUpdate(const TableSchema& schema, const std::optional<byteVec>& existingRowBytes, const std::vector<string>& setColumns,
         const std::vector<SqlLiteral>& setValues);
 
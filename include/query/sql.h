@@ -33,6 +33,7 @@ struct SqlCreateTable {
     string table;
     bool ifNotExists;
     TableSchema schema;
+    TableOptions options;
 };
 
 struct SqlInsert {
@@ -147,9 +148,35 @@ struct SqlUpdate {
     SqlLiteral whereValue;
 };
 
+// PREPARE name AS <statement>: the statement text is parsed when it is prepared.
+struct SqlPrepare {
+    string name;
+    string statement;
+};
+
+struct SqlExecute {
+    string name;
+    vector<SqlLiteral> values;
+};
+
+struct SqlDeallocate {
+    string name;
+};
+
 using SqlCommand = std::variant<SqlPing, SqlAuth, SqlUse, SqlCreateKeyspace, SqlCreateTable, SqlInsert, SqlSelect, SqlFlush, SqlDelete, SqlUpdate, SqlDropTable,
-        SqlDropKeyspace, SqlShowKeyspaces, SqlShowTables, SqlDescribeTable, SqlShowCreateTable, SqlShowMetrics, SqlTruncateTable>;
+        SqlDropKeyspace, SqlShowKeyspaces, SqlShowTables, SqlDescribeTable, SqlShowCreateTable, SqlShowMetrics, SqlTruncateTable, SqlPrepare, SqlExecute,
+        SqlDeallocate>;
 
 std::optional<SqlCommand> sqlCommand(const string& line, string& error);
 
+// A ? placeholder and the column it is compared with or assigned to.
+struct SqlParamSlot {
+    SqlLiteral* value;
+    const string* column;
+};
+
+// The placeholders of an INSERT, SELECT, UPDATE or DELETE, in the order they
+// appear in the statement.
+vector<SqlParamSlot> sqlParamSlots(SqlCommand& cmd);
+
 }
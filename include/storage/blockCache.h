@@ -0,0 +1,73 @@
+#pragma once
+
+#include "prelude.h"
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace xeondb {
+
+struct BlockCacheStats {
+    u64 capacityBytes = 0;
+    u64 usedBytes = 0;
+    u64 hits = 0;
+    u64 misses = 0;
+    u64 evictions = 0;
+};
+
+// Process-wide LRU of verified, decompressed SSTable block bodies, keyed by
+// (SsTableReader id, block offset). Reader ids are never reused, so blocks of
+// deleted files are never hit again and simply age out. Split into up to
+// shardCount shards, each with its own mutex and an equal share of the capacity.
+class BlockCache {
+public:
+    explicit BlockCache(u64 capacityBytes, usize shardCount = 16);
+
+    BlockCache(const BlockCache&) = delete;
+    BlockCache& operator=(const BlockCache&) = delete;
+
+    std::shared_ptr<const byteVec> lookup(u64 fileId, u64 offset);
+    // Blocks larger than a shard's capacity are not cached.
+    void insert(u64 fileId, u64 offset, std::shared_ptr<const byteVec> block);
+
+    BlockCacheStats stats() const;
+
+private:
+    struct Key {
+        u64 fileId;
+        u64 offset;
+        bool operator==(const Key& o) const {
+            return fileId == o.fileId && offset == o.offset;
+        }
+    };
+    struct KeyHash {
+        usize operator()(const Key& k) const;
+    };
+    struct Entry {
+        Key key;
+        std::shared_ptr<const byteVec> block;
+        u64 charge;
+    };
+    struct Shard {
+        std::mutex mutex;
+        // Front is most recently used.
+        std::list<Entry> lru;
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> map;
+        u64 usedBytes = 0;
+    };
+
+    Shard& shardFor(const Key& key);
+
+    u64 capacityBytes_;
+    u64 shardCapacity_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<u64> hits_;
+    std::atomic<u64> misses_;
+    std::atomic<u64> evictions_;
+};
+
+}
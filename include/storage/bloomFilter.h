@@ -0,0 +1,33 @@
+#pragma once
+
+#include "prelude.h"
+
+#include <fstream>
+#include <optional>
+#include <vector>
+
+namespace xeondb {
+
+// Bloom filter over SSTable keys. Probe positions come from the two halves
+// of murmur3 x64_128 combined as h1 + i * h2.
+class BloomFilter {
+public:
+    BloomFilter() = default;
+
+    static u64 keyHash(const byteVec& key, u64& second);
+    static BloomFilter build(const std::vector<std::pair<u64, u64>>& keyHashes, usize bitsPerKey);
+
+    bool mayContain(const byteVec& key) const;
+    bool empty() const;
+
+    void write(std::ofstream& out) const;
+    // data points just past the block magic; nullopt if it is truncated.
+    static std::optional<BloomFilter> decode(const u8* data, usize len);
+
+private:
+    u32 hashCount_ = 0;
+    u64 bitCount_ = 0;
+    byteVec bits_;
+};
+
+}
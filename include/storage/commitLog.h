@@ -2,41 +2,221 @@
 
 #include <atomic>
 #include "prelude.h"
+#include "util/ioUring.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 namespace xeondb {
 
 inline constexpr const char* commitLogMagic = "BZWAL002";
 inline constexpr usize commitLogMagicLen = 7;
-inline constexpr u32 commitLogVersion = 2;
+// v2: one commitlog*.bin per memtable. v3: fixed-size wal-N.log segments whose
+// header carries the segment id, mixed into every record checksum so records
+// left over in a recycled segment never replay. v4: v3 segments of the
+// node-wide log, each record tagged with the stream (table uuid) it belongs to.
+// v5/v6: v3/v4 with CRC32C record checksums instead of CRC32; the older two
+// are still replayed.
+inline constexpr u32 commitLogVersion = 5;
+inline constexpr u32 commitLogSharedVersion = 6;
+inline constexpr u32 commitLogCrc32Version = 3;
+inline constexpr u32 commitLogSharedCrc32Version = 4;
+inline constexpr u32 commitLogLegacyVersion = 2;
 
+enum class WalSyncMode { Always, Periodic, Group };
+
+// "always", "group"; anything else is periodic.
+WalSyncMode walSyncModeFromName(stringView name);
+
+// How batches and syncs reach the disk: pwrite plus fdatasync calls, or one
+// linked io_uring submission per sync.
+enum class WalIoBackend { Pwrite, IoUring };
+
+// "io_uring"; anything else is pwrite.
+WalIoBackend walIoBackendFromName(stringView name);
+
+struct CommitLogRecord {
+    u64 seq = 0;
+    std::string key;
+    byteVec value;
+};
+
+struct CommitLogStats {
+    u64 fsyncs = 0;
+    u64 fsyncBytes = 0;
+    u64 fsyncMicrosTotal = 0;
+    u64 fsyncMicrosMax = 0;
+};
+
+// Segmented write-ahead log, either owned by one table or shared by every
+// table on the node (records then carry a stream id). Segments are
+// preallocated to segmentBytes, so appends overwrite allocated space instead of
+// growing the file, and are recycled once every stream in them has flushed
+// past them. A background thread syncs according to the WalSyncMode and keeps
+// the next segment ready. All methods are thread-safe.
 class CommitLog {
 public:
-    CommitLog();
+    // stream is empty for a per-table log.
+    using ReplayFn = std::function<void(stringView stream, u64 seq, std::string& key, byteVec& value)>;
+    // Streams still holding back the oldest segment.
+    using PressureFn = std::function<void(const std::vector<std::string>& streams)>;
+
+    struct StreamHash {
+        using is_transparent = void;
+        usize operator()(stringView s) const {
+            return std::hash<stringView>{}(s);
+        }
+    };
+    using StreamSeqs = std::unordered_map<std::string, u64, StreamHash, std::equal_to<>>;
+
+    // Falls back to pwrite when the kernel has no usable io_uring.
+    explicit CommitLog(bool shared = false, WalIoBackend backend = WalIoBackend::Pwrite);
     ~CommitLog();
 
     CommitLog(const CommitLog&) = delete;
     CommitLog& operator=(const CommitLog&) = delete;
 
-    void openOrCreate(const std::filesystem::path& path, bool truncate);
-    void append(u64 seq, stringView key, const byteVec& value);
+    // Replays every segment already in dir (and, per table, logs left by the
+    // v2 layout) through replay, keeps them until releaseThrough passes them,
+    // and starts writing into a fresh segment.
+    void open(const std::filesystem::path& dir, usize segmentBytes, const ReplayFn& replay = nullptr);
+    using BatchEntry = std::pair<std::string, byteVec>;
+
+    void append(stringView stream, u64 seq, stringView key, const byteVec& value);
+    // One record for all entries, numbered firstSeq onwards; replay yields
+    // either every entry or, for a torn record, none.
+    void appendBatch(stringView stream, u64 firstSeq, const std::vector<BatchEntry>& entries);
+    // Writes anything buffered by appendGrouped, then fsyncs.
     void fsyncNow();
+    // Stops the syncer and drains buffered records first.
     void close();
+    bool shared() const;
+
+    // Records that stream has flushed everything up to flushedSeq; segments
+    // every stream has flushed past are retired, a few kept for reuse.
+    void releaseThrough(stringView stream, u64 flushedSeq);
+    // The stream's table is gone; its records no longer hold segments back.
+    void forgetStream(stringView stream);
+    // Streams with records in segments not yet retired.
+    std::vector<std::string> streams() const;
+
+    // Group commit: records are buffered in memory and the syncer writes and
+    // fsyncs each batch. appendGrouped returns a ticket the caller passes to
+    // waitDurable once it has dropped its own locks.
+    u64 appendGrouped(stringView stream, u64 seq, stringView key, const byteVec& value);
+    u64 appendBatchGrouped(stringView stream, u64 firstSeq, const std::vector<BatchEntry>& entries);
+    void waitDurable(u64 ticket);
+
+    // Periodic mode syncs every interval, or earlier once thresholdBytes are
+    // unsynced (0 disables that trigger). Always mode leaves syncing to the
+    // caller; the thread then only prepares segments.
+    void startSyncer(WalSyncMode mode, std::chrono::milliseconds interval, usize thresholdBytes);
+    void stopSyncer();
+    // Shared log only: once more than a handful of segments are live, the
+    // syncer asks the streams pinning the oldest one to flush. Set before
+    // startSyncer.
+    void setPressureHandler(PressureFn fn);
+
+    CommitLogStats stats() const;
 
     usize bytesSinceFsync() const;
-    void resetBytesSinceFsync();
     bool isDirty() const;
-    void clearDirty();
-
-    const std::filesystem::path& path() const;
 
 private:
+    struct Segment {
+        u64 id = 0;
+        std::filesystem::path file;
+        // Highest seq per stream.
+        StreamSeqs maxSeqs;
+    };
+
+    // Rolls to the next segment when a record of recordBytes would not fit.
+    void reserveLocked(usize recordBytes, stringView stream, u64 seq);
+    void rollLocked();
+    // Place an encoded record (lastSeq its highest seq) in the active segment:
+    // written straight away, or buffered for the next sync.
+    void writeLocked(byteVec& buf, stringView stream, u64 lastSeq);
+    u64 bufferGrouped(byteVec& buf, stringView stream, u64 lastSeq);
+    void retireLocked();
+    std::vector<std::string> pinningStreams();
+    int createSegment(u64 id, std::filesystem::path& file);
+    void prepareSpare();
+    void syncerMain();
+    void syncWithPwrite(u64 batchOffset);
+    bool syncWithRing(u64 batchOffset, const u8* pendingData, usize pendingCapacity);
+
+    const bool shared_;
+
+    // Guards the append position, segment bookkeeping and per-stream state.
+    mutable std::mutex appendMutex_;
+    std::filesystem::path dir_;
+    usize segmentBytes_;
+    u64 writeOffset_;
+    Segment active_;
+    // Full segments not yet retired, oldest first.
+    std::deque<Segment> closed_;
+    StreamSeqs flushedSeqs_;
+    std::unordered_set<std::string, StreamHash, std::equal_to<>> forgotten_;
+    // The syncer has been asked for a spare since the last roll.
+    bool spareAsked_;
+
+    // Held by fsync, batch writes and segment switches.
+    std::mutex ioMutex_;
     int fileDesc;
-    std::filesystem::path path_;
+    // Segments rolled away from but not yet fsynced; the next fsyncNow closes them.
+    std::vector<int> unsyncedFds_;
+    // Swapped with pending_ by each sync, so both keep their capacity.
+    byteVec batch_;
+    // Null for the pwrite backend.
+    std::unique_ptr<IoUring> ring_;
+    // The batch buffers as last registered with ring_.
+    std::vector<iovec> registered_;
     std::atomic<usize> bytesSinceFsync_;
     std::atomic<bool> logDirty;
+
+    // Serializes segment creation so ids are handed out in the order segments are used.
+    std::mutex prepareMutex_;
+    u64 nextSegmentId_;
+    std::mutex spareMutex_;
+    bool isOpen_;
+    int spareFd_;
+    Segment spare_;
+    std::vector<std::filesystem::path> recyclable_;
+
+    std::mutex groupMutex_;
+    std::condition_variable syncerCv_;
+    std::condition_variable durableCv_;
+    byteVec pending_;
+    // Offset in the active segment where pending_ will be written.
+    u64 pendingOffset_;
+    u64 appendedTicket_;
+    u64 durableTicket_;
+    // Sticky: once a batch fails to reach disk nothing later is acknowledged.
+    bool syncFailed_;
+    bool syncerStop_;
+    bool spareWanted_;
+    bool pressureWanted_;
+    WalSyncMode mode_;
+    std::chrono::milliseconds interval_;
+    std::atomic<usize> thresholdBytes_;
+    PressureFn pressure_;
+    std::thread syncer_;
+
+    std::atomic<u64> fsyncs_;
+    std::atomic<u64> fsyncBytes_;
+    std::atomic<u64> fsyncMicrosTotal_;
+    std::atomic<u64> fsyncMicrosMax_;
 };
 
 }
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "prelude.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "storage/ssTable.h"
+
+namespace xeondb {
+
+// Caps the combined write rate of all running compactions.
+class CompactionThrottle {
+public:
+    explicit CompactionThrottle(u64 bytesPerSec);
+
+    void acquire(u64 bytes);
+
+private:
+    u64 bytesPerSec_;
+    std::mutex mutex_;
+    std::chrono::steady_clock::time_point nextFree_;
+};
+
+// Fixed pool of background workers shared by every table; the pool size is
+// the compaction concurrency limit.
+class CompactionExecutor {
+public:
+    CompactionExecutor(usize concurrency, u64 throughputBytesPerSec);
+    ~CompactionExecutor();
+
+    CompactionExecutor(const CompactionExecutor&) = delete;
+    CompactionExecutor& operator=(const CompactionExecutor&) = delete;
+
+    void submit(std::function<void()> job);
+    CompactionThrottle& throttle();
+
+private:
+    void workerMain();
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> jobs_;
+    bool stop_;
+    std::vector<std::thread> workers_;
+    CompactionThrottle throttle_;
+};
+
+struct CompactionPlan {
+    // Positions in the table's SSTable list, ascending.
+    std::vector<usize> inputs;
+    u32 outputLevel = 0;
+    bool dropTombstones = false;
+};
+
+// Picks a contiguous run (oldest to newest) of similarly sized SSTables.
+// Keeping runs contiguous preserves the newest-first read order of the list.
+std::optional<CompactionPlan> pickSizeTieredCompaction(const std::vector<SsTableFile>& files, usize minThreshold, usize maxThreshold);
+
+struct LeveledCompactionOptions {
+    usize l0Trigger;
+    usize maxL0Inputs;
+    u64 sstableBytes;
+    u64 sizeRatio;
+};
+
+inline constexpr u32 leveledMaxLevel = 6;
+
+// files must be in table order (see Manifest). L0 is merged into L1 once it
+// holds l0Trigger files; otherwise the level furthest over its byte budget
+// pushes one file (chosen round-robin after cursors[level]) into the next.
+std::optional<CompactionPlan> pickLeveledCompaction(const std::vector<SsTableFile>& files, const LeveledCompactionOptions& options,
+        const std::vector<byteVec>& cursors);
+
+// K-way merges inputs into emit in key order, keeping the highest seq per
+// key. Tombstones are dropped when dropTombstones is set.
+// Returns false if shouldStop() asked to abandon the merge.
+bool mergeSsTables(const std::vector<SsTableFile>& inputs, const std::function<void(const SsEntry&)>& emit, bool dropTombstones,
+        CompactionThrottle* throttle, const std::function<bool()>& shouldStop);
+
+}
@@ -10,10 +10,19 @@ using std::filesystem::path;
 
 namespace xeondb {
 
+struct ManifestSsTable {
+    std::string name;
+    u32 level = 0;
+    byteVec minKey;
+    byteVec maxKey;
+};
+
+// sstableFiles is ordered oldest data first: deepest level to L1, each level
+// sorted by minKey, then L0 in flush order.
 struct Manifest {
     u64 lastFlushedSeq;
     u64 nextSstableGen;
-    std::vector<std::string> sstableFiles;
+    std::vector<ManifestSsTable> sstableFiles;
 };
 
 Manifest readManifest(const path& path);
@@ -2,14 +2,16 @@
 
 #include "prelude.h"
 
+#include <atomic>
 #include <optional>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <utility>
 
+#include "util/arena.h"
+
 using std::optional;
 using std::string;
-using std::unordered_map;
 using std::vector;
 using std::pair;
 
@@ -20,21 +22,58 @@ struct MemValue {
     byteVec value;
 };
 
+// Skip list ordered by key, then by seq descending, so the newest version of a
+// key is the first node for it. put() never modifies a published node: each
+// write links a new version. One writer at a time (the owning table serializes
+// put), while get(), iterators and the counters are safe from any thread.
+// Nodes, keys and values all live in one arena freed with the table.
 class MemTable {
 public:
     MemTable();
 
+    MemTable(const MemTable&) = delete;
+    MemTable& operator=(const MemTable&) = delete;
+
     void put(const string& key, u64 seq, const byteVec& value);
     optional<MemValue> get(const string& key) const;
+    // Arena bytes in use.
     usize bytes() const;
+    // Versions held, not distinct keys.
     usize size() const;
-    void clear();
 
-    vector<pair<string, MemValue>> snapshot() const;
+    static constexpr int maxHeight = 12;
 
 private:
-    unordered_map<string, MemValue> map;
-    usize bytes_;
+    struct Node;
+
+public:
+    // Walks every version in order; skip older versions by comparing keys.
+    class Iterator {
+    public:
+        explicit Iterator(const MemTable& table);
+
+        bool valid() const;
+        void next();
+        std::string_view key() const;
+        u64 seq() const;
+        const u8* valueData() const;
+        usize valueSize() const;
+
+    private:
+        const Node* node_;
+    };
+
+private:
+    Node* newNode(std::string_view key, u64 seq, const byteVec& value, int height);
+    int randomHeight();
+    // First node ordered at or after (key, seq); fills prev when given.
+    Node* findGreaterOrEqual(std::string_view key, u64 seq, Node** prev) const;
+
+    Arena arena_;
+    Node* head_;
+    std::atomic<int> height_;
+    std::atomic<usize> size_;
+    u64 rng_;
 };
 
 }
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "prelude.h"
+
+#include <memory>
+#include <vector>
+
+#include "storage/memTable.h"
+#include "storage/ssTable.h"
+
+namespace xeondb {
+
+// Newest version of each key in a memtable as of maxSeq; later writes to a
+// still active memtable are not seen.
+class MemTableEntrySource : public EntrySource {
+public:
+    MemTableEntrySource(std::shared_ptr<const MemTable> memTable, u64 maxSeq);
+
+    bool next(SsEntry& out) override;
+
+private:
+    std::shared_ptr<const MemTable> memTable_;
+    MemTable::Iterator it_;
+    u64 maxSeq_;
+};
+
+// Lazily merges sources into one ascending stream. When several sources hold
+// a key, only the entry with the highest seq is returned; tombstones (empty
+// values) are returned too so callers can decide what they shadow.
+class MergeIterator {
+public:
+    explicit MergeIterator(std::vector<std::unique_ptr<EntrySource>> sources);
+
+    bool next(SsEntry& out);
+
+private:
+    struct Head {
+        SsEntry entry;
+        usize source;
+    };
+    // Heap order: smallest key on top, highest seq first within a key.
+    struct HeadAfter {
+        bool operator()(const Head& a, const Head& b) const;
+    };
+
+    void refill(usize source);
+
+    std::vector<std::unique_ptr<EntrySource>> sources_;
+    std::vector<Head> heap_;
+};
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "prelude.h"
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace xeondb {
+
+// Per-table LRU of the latest row for a decorated key, split into shards with
+// their own mutex. An empty row records that the key is known to be absent,
+// matching the tombstone convention. The owning table keeps entries current
+// by calling update() on every write, after bumping its write generation.
+class RowCache {
+public:
+    explicit RowCache(usize capacityRows);
+
+    RowCache(const RowCache&) = delete;
+    RowCache& operator=(const RowCache&) = delete;
+
+    // False on a miss.
+    bool lookup(const std::string& dkey, byteVec& row);
+    // Fills the entry only while writeGen still reads seenGen, checked under
+    // the shard lock: writers bump writeGen before calling update(), so a row
+    // read before a write can never land after that write's update.
+    void insertIfCurrent(const std::string& dkey, const byteVec& row, const std::atomic<u64>& writeGen, u64 seenGen);
+    // Replaces the entry when the key is cached; uncached keys stay uncached.
+    void update(const std::string& dkey, const byteVec& row);
+    void clear();
+
+private:
+    struct Entry {
+        std::string dkey;
+        byteVec row;
+    };
+    struct Shard {
+        std::mutex mutex;
+        // Front is most recently used.
+        std::list<Entry> lru;
+        std::unordered_map<std::string, std::list<Entry>::iterator> map;
+    };
+
+    Shard& shardFor(const std::string& dkey);
+
+    usize shardCapacity_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+}
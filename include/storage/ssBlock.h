@@ -0,0 +1,70 @@
+#pragma once
+
+#include "prelude.h"
+
+#include <memory>
+#include <vector>
+
+namespace xeondb {
+
+// Body of one v2 SSTable data block:
+//   entry*  : varint shared, varint unshared, varint valueLen, varint seq, key suffix, value
+//   u32*    : restart offsets (entries that store their full key)
+//   u32     : restart count
+// The u32s are big-endian, like the block framing around the body.
+class SsBlockBuilder {
+public:
+    explicit SsBlockBuilder(usize restartInterval);
+
+    void add(const byteVec& key, u64 seq, const byteVec& value);
+    // Appends the restart array and returns the finished body; reset() starts
+    // the next block.
+    const byteVec& finish();
+    void reset();
+
+    bool empty() const;
+    usize sizeEstimate() const;
+
+private:
+    usize restartInterval_;
+    byteVec buf_;
+    std::vector<u32> restarts_;
+    usize sinceRestart_;
+    byteVec lastKey_;
+};
+
+// Cursor over a decoded block body. The bytes must outlive the iterator.
+class SsBlockIter {
+public:
+    SsBlockIter(const u8* data, usize size);
+
+    // False if the restart trailer is malformed.
+    bool ok() const;
+
+    // Decodes the next entry; false at the end of the block or on corruption.
+    bool next();
+    // Positions before the last restart whose key is <= key, so the following
+    // next() calls walk forward from there.
+    void seekFloor(const byteVec& key);
+
+    const byteVec& key() const;
+    u64 seq() const;
+    const u8* value() const;
+    usize valueSize() const;
+
+private:
+    bool decodeAt(usize offset, byteVec& key, usize& nextOffset, u64& seq, usize& valueOffset, usize& valueSize) const;
+    u32 restartOffset(usize i) const;
+
+    const u8* data_;
+    usize entriesEnd_;
+    usize restartCount_;
+    bool ok_;
+    usize offset_;
+    byteVec key_;
+    u64 seq_;
+    usize valueOffset_;
+    usize valueSize_;
+};
+
+}
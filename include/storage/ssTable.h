@@ -2,10 +2,16 @@
 
 #include "prelude.h"
 
+#include <fstream>
+#include <memory>
 #include <optional>
 #include <vector>
 #include <utility>
 
+#include "storage/blockCache.h"
+#include "storage/bloomFilter.h"
+#include "storage/ssBlock.h"
+
 namespace xeondb {
 
 struct SsEntry {
@@ -14,18 +20,128 @@ struct SsEntry {
     byteVec value;
 };
 
+// A stream of entries in ascending key order, at most one per key.
+class EntrySource {
+public:
+    virtual ~EntrySource() = default;
+    virtual bool next(SsEntry& out) = 0;
+};
+
+// v1: key and offset of every indexStride-th entry.
+// v2: first key, offset and on-disk size of every data block.
 struct SsIndexEntry {
     byteVec key;
     u64 offset;
+    u32 blockBytes = 0;
+};
+
+// Read-only mapping of a whole SSTable. Every copy of an SsTableFile shares
+// one, and the mapping outlives unlinking the file, so snapshots taken before
+// compaction or TRUNCATE retire a file keep reading it until they let go.
+class SsTableReader {
+public:
+    explicit SsTableReader(const path& path);
+    ~SsTableReader();
+
+    SsTableReader(const SsTableReader&) = delete;
+    SsTableReader& operator=(const SsTableReader&) = delete;
+
+    const u8* data() const;
+    u64 size() const;
+    // Unique per process, so it can key cached blocks.
+    u64 id() const;
+
+private:
+    const u8* data_;
+    u64 size_;
+    u64 id_;
 };
 
 struct SsTableFile {
     path filePath;
+    u64 fileBytes = 0;
+    u32 version = 0;
+    // Entries live in [header, dataEnd); the index starts at dataEnd.
+    u64 dataEnd = 0;
+    std::shared_ptr<const SsTableReader> reader;
+    u32 level = 0;
+    // Empty when unknown (files listed by a version 1 manifest).
+    byteVec minKey;
+    byteVec maxKey;
     std::vector<SsIndexEntry> index;
+    // Null for files written without a filter.
+    std::shared_ptr<const BloomFilter> bloom;
+    // Null when block caching is disabled.
+    std::shared_ptr<BlockCache> blockCache;
+};
+
+bool ssTableMayContain(const SsTableFile& file, const byteVec& key);
+
+enum class SsCompression : u8 { None = 0, Lz = 1 };
+
+struct SsTableWriteOptions {
+    usize blockBytes = 16 * 1024;
+    usize restartInterval = 16;
+    usize bloomBitsPerKey = 10;
+    SsCompression compression = SsCompression::Lz;
+};
+
+// Streams entries to disk in ascending key order as v2 data blocks; the
+// index, bloom filter and footer are written by finish().
+class SsTableWriter {
+public:
+    SsTableWriter(const path& path, const SsTableWriteOptions& options);
+
+    SsTableWriter(const SsTableWriter&) = delete;
+    SsTableWriter& operator=(const SsTableWriter&) = delete;
+
+    void add(const SsEntry& entry);
+    void finish();
+    u64 entryCount() const;
+    u64 bytesWritten();
+    const byteVec& minKey() const;
+    const byteVec& maxKey() const;
+
+private:
+    void flushBlock();
+
+    std::ofstream out_;
+    SsTableWriteOptions options_;
+    u64 count_;
+    byteVec minKey_;
+    byteVec maxKey_;
+    SsBlockBuilder block_;
+    byteVec blockFirstKey_;
+    byteVec compressed_;
+    std::vector<std::pair<u64, u64>> keyHashes_;
+    std::streampos countPos_;
+    std::vector<SsIndexEntry> index_;
+};
+
+// Sequential reader over every entry of one SSTable.
+class SsTableScanner : public EntrySource {
+public:
+    // Compaction passes fillCache = false so one pass over cold files does not
+    // push the hot blocks out; cached blocks are still used either way.
+    explicit SsTableScanner(const SsTableFile& file, bool fillCache = true);
+
+    bool next(SsEntry& out) override;
+
+private:
+    bool nextBlock();
+
+    SsTableFile file_;
+    u64 offset_;
+    u64 end_;
+    u64 remaining_;
+    usize blockIndex_;
+    bool fillCache_;
+    std::shared_ptr<const byteVec> block_;
+    std::optional<SsBlockIter> blockIter_;
 };
 
-void writeSsTable(const path& path, const std::vector<SsEntry>& entries, usize indexStride);
-SsTableFile loadSsTableIndex(const path& path);
+void writeSsTable(const path& path, const std::vector<SsEntry>& entries, const SsTableWriteOptions& options);
+SsTableFile loadSsTableIndex(const path& path, std::shared_ptr<BlockCache> blockCache = nullptr);
 std::optional<byteVec> ssTableGet(const SsTableFile& file, const byteVec& key);
 
 std::vector<SsEntry> ssTableScanAll(const SsTableFile& file);
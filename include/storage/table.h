@@ -3,14 +3,21 @@
 #include <atomic>
 #include "prelude.h"
 
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <thread>
 #include <vector>
 
 #include "storage/commitLog.h"
+#include "storage/compaction.h"
 #include "storage/memTable.h"
+#include "storage/mergeIterator.h"
+#include "storage/rowCache.h"
 #include "storage/manifest.h"
 #include "util/murmur3.h"
 #include "query/schema.h"
@@ -22,18 +29,32 @@ using std::vector;
 namespace xeondb {
 
 TableSchema readSchemaFromMetadata(const path& tableDirPath);
+TableOptions readOptionsFromMetadata(const path& tableDirPath);
+u64 readLastFlushedSeq(const path& tableDirPath);
 
 struct TableSettings {
     string walFsync;
     u64 walFsyncIntervalMs;
     usize walFsyncBytes;
+    usize walSegmentBytes;
+    string walIoBackend;
     usize memtableMaxBytes;
+    usize memtableMaxImmutable;
     usize sstableIndexStride;
+    usize sstableBloomBitsPerKey;
+    usize sstableBlockBytes;
+    string sstableCompression;
+    usize compactionMinThreshold;
+    usize compactionMaxThreshold;
+    u64 leveledSstableBytes;
+    u64 leveledSizeRatio;
 };
 
-class Table {
+class Table : public std::enable_shared_from_this<Table> {
 public:
-    Table(path tableDirPath, string keyspace, string table, string uuid, TableSchema schema, TableSettings settings);
+    Table(path tableDirPath, string keyspace, string table, string uuid, TableSchema schema, TableOptions options, TableSettings settings,
+            std::shared_ptr<CompactionExecutor> compaction = nullptr, std::shared_ptr<BlockCache> blockCache = nullptr,
+            std::shared_ptr<CommitLog> sharedLog = nullptr);
     ~Table();
 
     Table(const Table&) = delete;
@@ -44,27 +65,84 @@ public:
     const string& table() const;
     const string& uuid() const;
     const TableSchema& schema() const;
+    const TableOptions& options() const;
 
     void shutdown();
+    CommitLogStats walStats() const;
     void truncate();
 
     void openOrCreateFiles(bool createNew);
-    void recover();
+    // carried: this table's records from a log it does not write to (the
+    // shared log when it has one, else a shared log left by a mode switch).
+    void recover(std::vector<CommitLogRecord> carried = {});
 
     void putRow(const byteVec& pkBytes, const byteVec& rowBytes);
+    // All rows under one lock, logged as a single batch record that recovery
+    // replays whole or not at all.
+    void putBatch(const std::vector<std::pair<byteVec, byteVec>>& rows);
     void deleteRow(const byteVec& pkBytes);
     std::optional<byteVec> getRow(const byteVec& pkBytes);
     struct ScanRow {
         byteVec pkBytes;
         byteVec rowBytes;
     };
+    // Streams live rows in decorated-key (token) order. Only the memtables are
+    // copied up front; SSTables are read a block at a time.
+    class RowIterator {
+    public:
+        explicit RowIterator(std::vector<std::unique_ptr<EntrySource>> sources);
+
+        bool next(ScanRow& out);
+
+    private:
+        MergeIterator merged_;
+        SsEntry entry_;
+    };
+    RowIterator scanRows();
+    // Materialises every row sorted by primary key; for small tables.
     std::vector<ScanRow> scanAllRowsByPk(bool desc);
     void flush();
+    // Seals the active memtable without waiting for the flush.
+    void requestFlush();
 
 private:
+    // Returns a group-commit ticket to wait on after unlocking, or 0.
+    u64 appendLogLocked(u64 seq, const string& dkey, const byteVec& value);
+    // Stream id of this table's records: its uuid in the shared log.
+    stringView logStream() const;
+    // False for a record already flushed.
+    bool replayLocked(u64 seq, string& key, byteVec& value);
     void startWalThread();
     void stopWalThread();
-    void walThreadMain();
+
+    struct SealedMemTable {
+        std::shared_ptr<MemTable> memTable;
+    };
+    // Everything a point read looks at, swapped in whole so getRow never
+    // takes mutex_ and so never waits behind a write or its fsync.
+    struct ReadView {
+        // The active memtable, then the sealed ones newest first.
+        std::vector<std::shared_ptr<const MemTable>> memTables;
+        std::shared_ptr<const std::vector<SsTableFile>> ssTables;
+    };
+
+    void sealActiveLocked();
+    void waitForImmutableRoomLocked(std::unique_lock<std::mutex>& lock);
+    SsTableWriteOptions ssTableWriteOptions() const;
+    // Rebuild the published ReadView after memTable_ or immutables_ change;
+    // the SSTable variant also snapshots ssTables_ first.
+    void publishViewLocked();
+    void publishSsTablesLocked();
+    void flushSealed(const SealedMemTable& sealed);
+    void startFlushThread();
+    void stopFlushThread();
+    void flushThreadMain();
+
+    std::optional<CompactionPlan> pickCompactionLocked() const;
+    void maybeScheduleCompactionLocked();
+    void runCompaction();
+    void pauseCompaction();
+    void resumeCompaction();
 
     void writeMetadata();
     void loadMetadata();
@@ -74,18 +152,49 @@ private:
     string table_;
     string uuid_;
     TableSchema schema_;
+    TableOptions options_;
     TableSettings settings_;
 
     mutable std::mutex mutex_;
     u64 nextSeq_;
-
-    CommitLog commitLog_;
-    MemTable memTable_;
+    // Bumped under mutex_ before and after every write and TRUNCATE, so it is
+    // odd while one is in progress; lets getRow tell whether a row it read
+    // without the lock is still safe to cache.
+    std::atomic<u64> writeGen_;
+
+    std::shared_ptr<CommitLog> commitLog_;
+    // False for the shared log, whose syncer and lifetime belong to Db.
+    bool ownsCommitLog_;
+    std::shared_ptr<MemTable> memTable_;
+    std::deque<SealedMemTable> immutables_;
+    u64 sealedCount_;
+    u64 flushedCount_;
     Manifest manifest_;
     std::vector<SsTableFile> ssTables_;
-
-    std::atomic<bool> walStop_;
-    std::thread walThread_;
+    // ssTables_ as of the last publishSsTablesLocked.
+    std::shared_ptr<const std::vector<SsTableFile>> ssTablesView_;
+    // Held only to copy or swap view_, never across I/O.
+    mutable std::shared_mutex viewMutex_;
+    std::shared_ptr<const ReadView> view_;
+
+    std::condition_variable flushCv_;
+    std::condition_variable flushDoneCv_;
+    bool flushStop_;
+    // flushThread_ is started; read under mutex_ where the thread object is not.
+    bool flushRunning_;
+    string flushError_;
+    std::thread flushThread_;
+
+    std::shared_ptr<CompactionExecutor> compaction_;
+    std::shared_ptr<BlockCache> blockCache_;
+    // Null unless the table was created WITH row_cache.
+    std::unique_ptr<RowCache> rowCache_;
+    std::mutex compactionMutex_;
+    std::atomic<bool> compactionStop_;
+    bool compactionScheduled_;
+    // Per level, maxKey of the last file pushed down; leveled compaction
+    // resumes after it so every key range takes its turn.
+    std::vector<byteVec> leveledCursors_;
 };
 
 }
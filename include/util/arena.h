@@ -0,0 +1,36 @@
+#pragma once
+
+#include "prelude.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace xeondb {
+
+// Bump allocator handing out pointer-aligned memory from large blocks. Nothing
+// is freed individually; every block goes when the arena does. allocate() is
+// single-threaded, usedBytes() may be read from anywhere.
+class Arena {
+public:
+    explicit Arena(usize blockBytes = 64 * 1024);
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    u8* allocate(usize bytes);
+    // Bytes handed out, alignment padding included; the unused tail of the
+    // current block is not counted.
+    usize usedBytes() const;
+
+private:
+    u8* allocateBlock(usize bytes);
+
+    usize blockBytes_;
+    u8* ptr_;
+    usize remaining_;
+    std::vector<std::unique_ptr<u8[]>> blocks_;
+    std::atomic<usize> used_;
+};
+
+}
@@ -26,10 +26,15 @@ u32 readU32(const byteVec& b, usize& o);
 
 void appendBeU32(byteVec& out, u32 v);
 u32 readBeU32(const byteVec& b, usize& o);
+// Reads 4 bytes the caller has already bounds-checked.
+u32 readBeU32(const u8* p);
 
 void appendBe32(byteVec& out, i32 v);
 void appendBe64(byteVec& out, i64 v);
 i32 readBe32(const byteVec& b, usize& o);
 i64 readBe64(const byteVec& b, usize& o);
 
+void appendVarU64(byteVec& out, u64 v);
+bool readVarU64(const u8*& p, const u8* end, u64& out);
+
 }
@@ -4,6 +4,14 @@
 
 namespace xeondb {
 
+// IEEE CRC32 (as zlib), used by SSTable blocks.
 u32 crc32(const u8* data, usize size);
 
+// CRC32C (Castagnoli), used by commit log records. Runs on the SSE4.2 or
+// ARMv8 CRC instructions when the CPU has them, chosen on first use.
+u32 crc32c(const u8* data, usize size);
+// The table-driven CRC32C, whatever the CPU supports.
+u32 crc32cPortable(const u8* data, usize size);
+bool crc32cAccelerated();
+
 }
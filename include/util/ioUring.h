@@ -0,0 +1,66 @@
+#pragma once
+
+#include "prelude.h"
+
+#include <sys/uio.h>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace xeondb {
+
+// Minimal io_uring ring on the raw syscalls (no liburing). Ops are queued into
+// one linked chain and submitAndWait runs it to completion, so the ring holds
+// nothing in flight between calls. Not thread-safe; callers serialize.
+class IoUring {
+public:
+    IoUring() = default;
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    // False when the kernel has no io_uring or it is disabled.
+    bool init(u32 entries);
+    // Ops that fit in one chain.
+    u32 capacity() const;
+
+    // Pins buffers so writes from them skip per-request page mapping. Replaces
+    // any earlier set; false leaves none registered.
+    bool registerBuffers(const std::vector<iovec>& buffers);
+
+    // Each op runs only once the one before it succeeded. bufIndex picks a
+    // registered buffer containing data, or -1.
+    void queueWrite(int fd, const void* data, u32 size, u64 offset, int bufIndex);
+    void queueFdatasync(int fd);
+    // False if any op failed or wrote short; later ops in the chain are then
+    // cancelled.
+    bool submitAndWait();
+
+private:
+    void queue(u8 opcode, int fd, const void* data, u32 size, u64 offset, int bufIndex);
+
+    int ringFd_ = -1;
+    u32 entries_ = 0;
+    void* sqRing_ = nullptr;
+    usize sqRingBytes_ = 0;
+    void* cqRing_ = nullptr;
+    usize cqRingBytes_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    usize sqesBytes_ = 0;
+
+    u32* sqTail_ = nullptr;
+    u32* sqMask_ = nullptr;
+    u32* sqArray_ = nullptr;
+    u32* cqHead_ = nullptr;
+    u32* cqTail_ = nullptr;
+    u32* cqMask_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+
+    bool hasBuffers_ = false;
+    // Bytes each queued op must complete; 0 for syncs.
+    std::vector<u32> expected_;
+};
+
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "prelude.h"
+
+namespace xeondb {
+
+// Small LZ77 codec (LZ4-style sequences, 64 KiB window) used for SSTable
+// blocks. The raw size is not stored; callers keep it next to the output.
+byteVec lzCompress(const u8* data, usize size);
+
+// Returns false unless the input decodes to exactly outSize bytes.
+bool lzDecompress(const u8* data, usize size, u8* out, usize outSize);
+
+}
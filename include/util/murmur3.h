@@ -6,4 +6,7 @@ namespace xeondb {
 
 i64 murmur3Token(const byteVec& bytes);
 
+// Both halves of MurmurHash3 x64_128 (seed 0); murmur3Token is the first.
+void murmur3Hash128(const u8* data, usize len, u64& out1, u64& out2);
+
 }
@@ -65,7 +65,8 @@ int main(int argc, char** argv) {
                     std::to_string(settings.maxConnections) + " quota=" + std::string(settings.quotaEnforcementEnabled ? "enabled" : "disabled") +
                     " auth=" + ((!settings.authUsername.empty() && !settings.authPassword.empty()) ? "enabled" : "disabled"));
 
-    xeondb::ServerTcp server(db, settings.host, settings.port, settings.maxLineBytes, settings.maxConnections, settings.authUsername, settings.authPassword);
+    xeondb::ServerTcp server(db, settings.host, settings.port, settings.maxLineBytes, settings.maxConnections, settings.listenBacklog,
+            settings.eventLoopThreads, settings.workerThreads, settings.authUsername, settings.authPassword);
 
     try {
         server.run();
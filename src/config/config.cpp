@@ -76,13 +76,31 @@ Settings loadSettings(const string& filePath) {
     s.host = "0.0.0.0";
     s.port = 9876;
     s.dataDir = "/var/lib/xeondb/data";
+    s.blockCacheBytes = 64ull * 1024ull * 1024ull;
     s.maxLineBytes = 1024 * 1024;
     s.maxConnections = 1024;
+    s.listenBacklog = 4096;
+    s.eventLoopThreads = 0;
+    s.workerThreads = 0;
     s.walFsync = "periodic";
     s.walFsyncIntervalMs = 50;
     s.walFsyncBytes = 1024 * 1024;
+    s.walSegmentBytes = 8 * 1024 * 1024;
+    s.walShared = false;
+    s.walIoBackend = "pwrite";
+    s.walRecoveryThreads = 0;
     s.memtableMaxBytes = 32ull * 1024ull * 1024ull;
+    s.memtableMaxImmutable = 4;
     s.sstableIndexStride = 16;
+    s.sstableBloomBitsPerKey = 10;
+    s.sstableBlockBytes = 16 * 1024;
+    s.sstableCompression = "lz";
+    s.compactionConcurrency = 2;
+    s.compactionThroughputBytesPerSec = 64ull * 1024ull * 1024ull;
+    s.compactionMinThreshold = 4;
+    s.compactionMaxThreshold = 32;
+    s.leveledSstableBytes = 8ull * 1024ull * 1024ull;
+    s.leveledSizeRatio = 10;
     s.quotaEnforcementEnabled = false;
     s.quotaBytesUsedCacheTtlMs = 2000;
     s.authUsername.clear();
@@ -124,10 +142,20 @@ Settings loadSettings(const string& filePath) {
             s.port = static_cast<u16>(parseU64(value, key));
         } else if (key == "dataDir") {
             s.dataDir = value;
+        } else if (key == "blockCacheBytes") {
+            s.blockCacheBytes = parseU64(value, key);
         } else if (key == "maxLineBytes") {
             s.maxLineBytes = parseSize(value, key);
         } else if (key == "maxConnections") {
             s.maxConnections = parseSize(value, key);
+        } else if (key == "listenBacklog") {
+            s.listenBacklog = parseSize(value, key);
+            if (s.listenBacklog == 0)
+                throw runtimeError("Invalid value for " + key);
+        } else if (key == "eventLoopThreads") {
+            s.eventLoopThreads = parseSize(value, key);
+        } else if (key == "workerThreads") {
+            s.workerThreads = parseSize(value, key);
         } else if (key == "quotaEnforcementEnabled") {
             s.quotaEnforcementEnabled = parseBool(value, key);
         } else if (key == "quotaBytesUsedCacheTtlMs") {
@@ -138,10 +166,42 @@ Settings loadSettings(const string& filePath) {
             s.walFsyncIntervalMs = parseU64(value, key);
         } else if (key == "walFsyncBytes") {
             s.walFsyncBytes = parseSize(value, key);
+        } else if (key == "walSegmentBytes") {
+            s.walSegmentBytes = parseSize(value, key);
+        } else if (key == "walShared") {
+            s.walShared = parseBool(value, key);
+        } else if (key == "walIoBackend") {
+            s.walIoBackend = toLower(value);
+            if (s.walIoBackend != "pwrite" && s.walIoBackend != "io_uring")
+                throw runtimeError("Invalid value for " + key);
+        } else if (key == "walRecoveryThreads") {
+            s.walRecoveryThreads = parseSize(value, key);
         } else if (key == "memtableMaxBytes") {
             s.memtableMaxBytes = parseSize(value, key);
+        } else if (key == "memtableMaxImmutable") {
+            s.memtableMaxImmutable = parseSize(value, key);
         } else if (key == "sstableIndexStride") {
             s.sstableIndexStride = parseSize(value, key);
+        } else if (key == "sstableBloomBitsPerKey") {
+            s.sstableBloomBitsPerKey = parseSize(value, key);
+        } else if (key == "sstableBlockBytes") {
+            s.sstableBlockBytes = parseSize(value, key);
+        } else if (key == "sstableCompression") {
+            s.sstableCompression = toLower(value);
+            if (s.sstableCompression != "lz" && s.sstableCompression != "none")
+                throw runtimeError("Invalid value for " + key);
+        } else if (key == "compactionConcurrency") {
+            s.compactionConcurrency = parseSize(value, key);
+        } else if (key == "compactionThroughputBytesPerSec") {
+            s.compactionThroughputBytesPerSec = parseU64(value, key);
+        } else if (key == "compactionMinThreshold") {
+            s.compactionMinThreshold = parseSize(value, key);
+        } else if (key == "compactionMaxThreshold") {
+            s.compactionMaxThreshold = parseSize(value, key);
+        } else if (key == "leveledSstableBytes") {
+            s.leveledSstableBytes = parseU64(value, key);
+        } else if (key == "leveledSizeRatio") {
+            s.leveledSizeRatio = parseU64(value, key);
         } else if (section == "auth" && key == "username") {
             s.authUsername = value;
         } else if (section == "auth" && key == "password") {
@@ -7,12 +7,15 @@
 
 #include "query/schema.h"
 #include "util/binIo.h"
+#include "util/log.h"
 
 #include <filesystem>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <shared_mutex>
 #include <set>
+#include <thread>
 #include <cctype>
 
 using std::string;
@@ -43,6 +46,144 @@ Db::Db(Settings settings)
     settings_.dataDir = resolveDataDir(settings_.dataDir);
     effectiveDataDir_ = settings_.dataDir;
     std::filesystem::create_directories(effectiveDataDir_);
+    compaction_ = std::make_shared<CompactionExecutor>(settings_.compactionConcurrency, settings_.compactionThroughputBytesPerSec);
+    if (settings_.blockCacheBytes > 0)
+        blockCache_ = std::make_shared<BlockCache>(settings_.blockCacheBytes);
+    auto stored = storedTables();
+    auto leftover = recoverSharedLog(stored);
+    recoverTables(stored);
+    if (leftover != nullptr) {
+        leftover->close();
+        std::error_code ec;
+        if (carried_.empty())
+            std::filesystem::remove_all(effectiveDataDir_ / ".wal", ec);
+    }
+}
+
+Db::~Db() {
+    // Its pressure handler calls back into this Db.
+    if (sharedLog_ != nullptr)
+        sharedLog_->stopSyncer();
+}
+
+std::vector<Db::StoredTable> Db::storedTables() const {
+    std::vector<StoredTable> out;
+    std::error_code ec;
+    for (const auto& keyspace : listKeyspaces()) {
+        for (const auto& entry : std::filesystem::directory_iterator(keyspaceDir(effectiveDataDir_, keyspace), ec)) {
+            if (!entry.is_directory())
+                continue;
+            auto name = entry.path().filename().string();
+            auto pos = name.rfind('-');
+            if (pos == string::npos || pos == 0)
+                continue;
+            out.push_back(StoredTable{keyspace, name.substr(0, pos), name.substr(pos + 1), entry.path()});
+        }
+    }
+    return out;
+}
+
+shared_ptr<CommitLog> Db::recoverSharedLog(const std::vector<StoredTable>& stored) {
+    auto walDir = effectiveDataDir_ / ".wal";
+    std::error_code ec;
+    bool leftover = std::filesystem::exists(walDir, ec);
+    if (!settings_.walShared && !leftover)
+        return nullptr;
+    std::filesystem::create_directories(walDir);
+
+    std::unordered_map<string, u64> lastFlushed;
+    for (const auto& t : stored)
+        lastFlushed[t.uuid] = readLastFlushedSeq(t.dir);
+
+    auto log = std::make_shared<CommitLog>(true, walIoBackendFromName(settings_.walIoBackend));
+    log->open(walDir, settings_.walSegmentBytes, [&](stringView stream, u64 seq, string& key, byteVec& value) {
+        auto it = lastFlushed.find(string(stream));
+        if (it == lastFlushed.end() || seq <= it->second)
+            return;
+        carried_[it->first].push_back(CommitLogRecord{seq, std::move(key), std::move(value)});
+    });
+    // Records of dropped tables hold nothing back.
+    for (const auto& stream : log->streams()) {
+        auto it = lastFlushed.find(stream);
+        if (it == lastFlushed.end())
+            log->forgetStream(stream);
+        else
+            log->releaseThrough(stream, it->second);
+    }
+
+    if (!settings_.walShared)
+        return log;
+    sharedLog_ = log;
+    sharedLog_->setPressureHandler([this](const std::vector<string>& uuids) {
+        onLogPressure(uuids);
+    });
+    auto interval = std::chrono::milliseconds(settings_.walFsyncIntervalMs == 0 ? 50 : settings_.walFsyncIntervalMs);
+    sharedLog_->startSyncer(walSyncModeFromName(settings_.walFsync), interval, settings_.walFsyncBytes);
+    return nullptr;
+}
+
+void Db::recoverTables(const std::vector<StoredTable>& stored) {
+    // Directories the schema no longer points at are left for openTable's
+    // own lookup to sort out.
+    std::vector<const StoredTable*> todo;
+    for (const auto& t : stored) {
+        auto uuid = findTableUuidFromSchema(schemaPath(effectiveDataDir_, t.keyspace), t.table);
+        if (!uuid.has_value() || *uuid == t.uuid)
+            todo.push_back(&t);
+    }
+    if (todo.empty())
+        return;
+
+    usize threads = settings_.walRecoveryThreads;
+    if (threads == 0)
+        threads = std::max<usize>(1, std::thread::hardware_concurrency());
+    threads = std::min(threads, todo.size());
+
+    const auto started = std::chrono::steady_clock::now();
+    std::vector<shared_ptr<Table>> loaded(todo.size());
+    std::atomic<usize> next{0};
+    auto worker = [&]() {
+        for (usize i = next.fetch_add(1); i < todo.size(); i = next.fetch_add(1)) {
+            const auto& t = *todo[i];
+            try {
+                loaded[i] = loadTable(t.keyspace, t.table, t.uuid);
+            } catch (const std::exception& e) {
+                xeondb::log(LogLevel::ERROR, "Recovery failed table=" + t.keyspace + "." + t.table + " err=" + e.what());
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (usize i = 1; i < threads; i++)
+        pool.emplace_back(worker);
+    worker();
+    for (auto& th : pool)
+        th.join();
+
+    usize opened = 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (usize i = 0; i < todo.size(); i++) {
+        if (loaded[i] == nullptr)
+            continue;
+        opened++;
+        tables_[tableKey(todo[i]->keyspace, todo[i]->table)] = loaded[i];
+        carried_.erase(todo[i]->uuid);
+    }
+    auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+    xeondb::log(LogLevel::INFO, "Recovered tables=" + std::to_string(opened) + "/" + std::to_string(todo.size()) + " threads=" + std::to_string(threads) +
+            " millis=" + std::to_string(millis));
+}
+
+void Db::onLogPressure(const std::vector<string>& uuids) {
+    std::vector<shared_ptr<Table>> pinning;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& kv : tables_) {
+            if (std::find(uuids.begin(), uuids.end(), kv.second->uuid()) != uuids.end())
+                pinning.push_back(kv.second);
+        }
+    }
+    for (const auto& t : pinning)
+        t->requestFlush();
 }
 
 void Db::metricsTouchBucketLocked(MetricsSeries& m, u64 absBucket) {
@@ -166,6 +307,30 @@ Db::KeyspaceMetrics Db::keyspaceMetrics(const string& keyspace) const {
     return keyspaceMetricsLocked(keyspace, b);
 }
 
+BlockCacheStats Db::blockCacheStats() const {
+    if (blockCache_ == nullptr)
+        return BlockCacheStats{};
+    return blockCache_->stats();
+}
+
+CommitLogStats Db::walStats(const string& keyspace) {
+    if (sharedLog_ != nullptr)
+        return sharedLog_->stats();
+    CommitLogStats total;
+    auto prefix = keyspace + ".";
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& kv : tables_) {
+        if (kv.first.rfind(prefix, 0) != 0)
+            continue;
+        auto s = kv.second->walStats();
+        total.fsyncs += s.fsyncs;
+        total.fsyncBytes += s.fsyncBytes;
+        total.fsyncMicrosTotal += s.fsyncMicrosTotal;
+        total.fsyncMicrosMax = std::max(total.fsyncMicrosMax, s.fsyncMicrosMax);
+    }
+    return total;
+}
+
 bool Db::authEnabled() const {
     return !settings_.authUsername.empty() && !settings_.authPassword.empty();
 }
@@ -644,7 +809,7 @@ void Db::createKeyspace(const string& keyspace) {
     std::filesystem::create_directories(keyspaceDir(effectiveDataDir_, keyspace));
 }
 
-path Db::createTable(const string& keyspace, const string& table, const TableSchema& schema) {
+path Db::createTable(const string& keyspace, const string& table, const TableSchema& schema, const TableOptions& options) {
     std::lock_guard<std::mutex> lock(mutex_);
     auto ksDir = keyspaceDir(effectiveDataDir_, keyspace);
     if (authEnabled()) {
@@ -665,17 +830,31 @@ path Db::createTable(const string& keyspace, const string& table, const TableSch
     auto dirPath = tableDir(effectiveDataDir_, keyspace, table, uuid);
     std::filesystem::create_directories(dirPath / "tmp");
 
+    auto t = std::make_shared<Table>(dirPath, keyspace, table, uuid, schema, options, tableSettings(), compaction_, blockCache_, sharedLog_);
+    t->openOrCreateFiles(true);
+    t->recover();
+    tables_[tableKey(keyspace, table)] = t;
+    return dirPath;
+}
+
+TableSettings Db::tableSettings() const {
     TableSettings ts;
     ts.walFsync = settings_.walFsync;
     ts.walFsyncIntervalMs = settings_.walFsyncIntervalMs;
     ts.walFsyncBytes = settings_.walFsyncBytes;
+    ts.walSegmentBytes = settings_.walSegmentBytes;
+    ts.walIoBackend = settings_.walIoBackend;
     ts.memtableMaxBytes = settings_.memtableMaxBytes;
+    ts.memtableMaxImmutable = settings_.memtableMaxImmutable;
     ts.sstableIndexStride = settings_.sstableIndexStride;
-    auto t = std::make_shared<Table>(dirPath, keyspace, table, uuid, schema, ts);
-    t->openOrCreateFiles(true);
-    t->recover();
-    tables_[tableKey(keyspace, table)] = t;
-    return dirPath;
+    ts.sstableBloomBitsPerKey = settings_.sstableBloomBitsPerKey;
+    ts.sstableBlockBytes = settings_.sstableBlockBytes;
+    ts.sstableCompression = settings_.sstableCompression;
+    ts.compactionMinThreshold = settings_.compactionMinThreshold;
+    ts.compactionMaxThreshold = settings_.compactionMaxThreshold;
+    ts.leveledSstableBytes = settings_.leveledSstableBytes;
+    ts.leveledSizeRatio = settings_.leveledSizeRatio;
+    return ts;
 }
 
 shared_ptr<Table> Db::openTable(const string& keyspace, const string& table) {
@@ -712,18 +891,21 @@ shared_ptr<Table> Db::openTableUnlocked(const string& keyspace, const string& ta
         throw runtimeError("Table not found");
     }
 
-    auto dirPath = tableDir(effectiveDataDir_, keyspace, table, *uuidOpt);
+    auto tablePtr = loadTable(keyspace, table, *uuidOpt);
+    carried_.erase(*uuidOpt);
+    tables_[key] = tablePtr;
+    return tablePtr;
+}
+
+shared_ptr<Table> Db::loadTable(const string& keyspace, const string& table, const string& uuid) {
+    auto dirPath = tableDir(effectiveDataDir_, keyspace, table, uuid);
     auto schema = readSchemaFromMetadata(dirPath);
-    TableSettings ts;
-    ts.walFsync = settings_.walFsync;
-    ts.walFsyncIntervalMs = settings_.walFsyncIntervalMs;
-    ts.walFsyncBytes = settings_.walFsyncBytes;
-    ts.memtableMaxBytes = settings_.memtableMaxBytes;
-    ts.sstableIndexStride = settings_.sstableIndexStride;
-    auto tablePtr = std::make_shared<Table>(dirPath, keyspace, table, *uuidOpt, schema, ts);
+    auto options = readOptionsFromMetadata(dirPath);
+    auto tablePtr = std::make_shared<Table>(dirPath, keyspace, table, uuid, schema, options, tableSettings(), compaction_, blockCache_, sharedLog_);
     tablePtr->openOrCreateFiles(false);
-    tablePtr->recover();
-    tables_[key] = tablePtr;
+    // Copied, so a failed open can be retried with the same records.
+    auto pending = carried_.find(uuid);
+    tablePtr->recover(pending != carried_.end() ? pending->second : std::vector<CommitLogRecord>{});
     return tablePtr;
 }
 
@@ -811,6 +993,8 @@ void Db::dropTable(const string& keyspace, const string& table, bool ifExists) {
         it->second->shutdown();
         tables_.erase(it);
     }
+    if (sharedLog_ != nullptr)
+        sharedLog_->forgetStream(*uuidOpt);
 
     (void)removeTableFromSchema(schemaFile, table);
 
@@ -838,6 +1022,8 @@ void Db::dropKeyspace(const string& keyspace, bool ifExists) {
     for (auto& kv : tables_) {
         if (kv.first.rfind(prefix, 0) == 0) {
             kv.second->shutdown();
+            if (sharedLog_ != nullptr)
+                sharedLog_->forgetStream(kv.second->uuid());
             toErase.push_back(kv.first);
         }
     }
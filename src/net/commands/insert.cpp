@@ -56,9 +56,7 @@ std::string ServerTcp::cmdInsert(const SqlInsert& insert, const std::string& cur
         }
     }
 
-    for (const auto& r : prepared) {
-        retTable->putRow(r.first, r.second);
-    }
+    retTable->putBatch(prepared);
 
     if (authEnabled_ && isSystemKeyspaceName(keyspace)) {
         if (insert.table == "USERS") {
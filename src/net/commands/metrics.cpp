@@ -52,6 +52,29 @@ std::string ServerTcp::cmdShowMetrics(const SqlShowMetrics& showMetrics, const A
         out += std::string("\"") + jsonEscape(m.labelsLast24h4h[i]) + "\"";
     }
     out += "]";
+
+    const auto wal = db_->walStats(ks);
+    out += std::string(",\"wal_fsyncs\":") + std::to_string(wal.fsyncs);
+    out += std::string(",\"wal_fsync_bytes\":") + std::to_string(wal.fsyncBytes);
+    out += std::string(",\"wal_fsync_avg_bytes\":") + std::to_string(wal.fsyncs == 0 ? 0 : wal.fsyncBytes / wal.fsyncs);
+    out += std::string(",\"wal_fsync_avg_micros\":") + std::to_string(wal.fsyncs == 0 ? 0 : wal.fsyncMicrosTotal / wal.fsyncs);
+    out += std::string(",\"wal_fsync_max_micros\":") + std::to_string(wal.fsyncMicrosMax);
+
+    // The block cache is shared by every keyspace; these are node-wide.
+    const auto cache = db_->blockCacheStats();
+    out += std::string(",\"block_cache_capacity_bytes\":") + std::to_string(cache.capacityBytes);
+    out += std::string(",\"block_cache_used_bytes\":") + std::to_string(cache.usedBytes);
+    out += std::string(",\"block_cache_hits\":") + std::to_string(cache.hits);
+    out += std::string(",\"block_cache_misses\":") + std::to_string(cache.misses);
+    out += std::string(",\"block_cache_evictions\":") + std::to_string(cache.evictions);
+
+    // Accept queues; overflows and drops are the kernel's host-wide counters.
+    const auto listen = listenStats();
+    out += std::string(",\"listen_sockets\":") + std::to_string(listen.sockets);
+    out += std::string(",\"listen_backlog\":") + std::to_string(listen.backlog);
+    out += std::string(",\"listen_queued\":") + std::to_string(listen.queued);
+    out += std::string(",\"listen_overflows\":") + std::to_string(listen.overflows);
+    out += std::string(",\"listen_drops\":") + std::to_string(listen.drops);
     out += "}";
     return out;
 }
@@ -0,0 +1,177 @@
+#include "net/serverTcp.h"
+
+#include "net/detail/prepared.h"
+#include "net/detail/serverTcpInternal.h"
+
+#include "query/sql.h"
+
+#include "util/json.h"
+
+#include <type_traits>
+#include <variant>
+
+namespace xeondb {
+
+std::shared_ptr<const PreparedStatement> ServerTcp::planStatement(SqlCommand cmd, const std::string& currentKeyspace, const AuthedUser& u) {
+    using server_tcp_detail::isSystemKeyspaceName;
+
+    auto stmt = std::make_shared<PreparedStatement>();
+    stmt->cmd = std::move(cmd);
+    std::string* keyspace = nullptr;
+    const std::string* tableName = nullptr;
+    if (auto* insert = std::get_if<SqlInsert>(&stmt->cmd)) {
+        keyspace = &insert->keyspace;
+        tableName = &insert->table;
+    } else if (auto* select = std::get_if<SqlSelect>(&stmt->cmd)) {
+        keyspace = &select->keyspace;
+        tableName = &select->table;
+    } else if (auto* upd = std::get_if<SqlUpdate>(&stmt->cmd)) {
+        keyspace = &upd->keyspace;
+        tableName = &upd->table;
+    } else if (auto* del = std::get_if<SqlDelete>(&stmt->cmd)) {
+        keyspace = &del->keyspace;
+        tableName = &del->table;
+    } else {
+        throw runtimeError("only SELECT, INSERT, UPDATE and DELETE can be prepared");
+    }
+
+    // An unqualified table is bound to the keyspace in use now, not at execution.
+    if (keyspace->empty())
+        *keyspace = currentKeyspace;
+    if (keyspace->empty())
+        throw runtimeError("No keyspace selected");
+    // System tables keep side state (users, grants) that only literal values update.
+    if (isSystemKeyspaceName(*keyspace))
+        throw runtimeError("system tables cannot be prepared");
+    if (authEnabled_ && !db_->canAccessKeyspace(u, *keyspace))
+        throw runtimeError("forbidden");
+
+    auto table = db_->openTable(*keyspace, *tableName);
+    const TableSchema& schema = table->schema();
+    stmt->tableUuid = table->uuid();
+    for (const auto& slot : sqlParamSlots(stmt->cmd)) {
+        auto index = findColumnIndex(schema, *slot.column);
+        if (!index.has_value())
+            throw runtimeError("unknown column");
+        stmt->paramTypes.push_back(schema.columns[*index].type);
+    }
+
+    auto* select = std::get_if<SqlSelect>(&stmt->cmd);
+    if (select == nullptr || !select->groupBy.empty() || !select->orderBy.empty())
+        return stmt;
+    if (select->whereColumn.has_value() && *select->whereColumn != schema.columns[schema.primaryKeyIndex].name)
+        throw runtimeError("Where must use primary key");
+    auto addColumn = [&](usize index, const std::string& name) {
+        stmt->columns.push_back(index);
+        stmt->columnTypes.push_back(schema.columns[index].type);
+        stmt->columnNames.push_back(name);
+    };
+    if (select->selectStar) {
+        for (usize i = 0; i < schema.columns.size(); i++)
+            addColumn(i, schema.columns[i].name);
+    }
+    for (const auto& item : select->selectItems) {
+        auto* col = std::get_if<SqlSelect::SelectColumn>(&item);
+        if (col == nullptr) {
+            // Aggregates run as a command.
+            stmt->columns.clear();
+            stmt->columnTypes.clear();
+            stmt->columnNames.clear();
+            break;
+        }
+        auto index = findColumnIndex(schema, col->name);
+        if (!index.has_value())
+            throw runtimeError("unknown column");
+        addColumn(*index, col->alias.value_or(col->name));
+    }
+    return stmt;
+}
+
+std::shared_ptr<Table> ServerTcp::planTable(std::shared_ptr<const PreparedStatement>& stmt, const AuthedUser& u) {
+    const std::string* keyspace = nullptr;
+    const std::string* tableName = nullptr;
+    std::visit(
+            [&](const auto& c) {
+                using T = std::decay_t<decltype(c)>;
+                if constexpr (std::is_same_v<T, SqlInsert> || std::is_same_v<T, SqlSelect> || std::is_same_v<T, SqlUpdate> || std::is_same_v<T, SqlDelete>) {
+                    keyspace = &c.keyspace;
+                    tableName = &c.table;
+                }
+            },
+            stmt->cmd);
+    if (keyspace == nullptr)
+        throw runtimeError("bad prepared statement");
+
+    auto table = db_->openTable(*keyspace, *tableName);
+    if (table->uuid() == stmt->tableUuid)
+        return table;
+    stmt = planStatement(stmt->cmd, *keyspace, u);
+    return db_->openTable(*keyspace, *tableName);
+}
+
+std::string ServerTcp::selectJson(const PreparedStatement& stmt, Table& table, const SqlSelect& select, const AuthedUser& u) {
+    if (authEnabled_ && !db_->canAccessKeyspace(u, select.keyspace))
+        throw runtimeError("forbidden");
+    db_->metricsOnCommand(select.keyspace);
+
+    const TableSchema& schema = table.schema();
+    if (select.whereColumn.has_value()) {
+        std::string response = "{\"ok\":true,\"found\":false}";
+        forEachSelectedRow(table, select, [&](const byteVec& pkBytes, const byteVec& rowBytes) {
+            response = "{\"ok\":true,\"found\":true,\"row\":" + rowToJsonColumns(schema, pkBytes, rowBytes, stmt.columns, stmt.columnNames) + "}";
+        });
+        return response;
+    }
+    std::string out = "{\"ok\":true,\"rows\":[";
+    bool first = true;
+    forEachSelectedRow(table, select, [&](const byteVec& pkBytes, const byteVec& rowBytes) {
+        if (!first)
+            out += ",";
+        first = false;
+        out += rowToJsonColumns(schema, pkBytes, rowBytes, stmt.columns, stmt.columnNames);
+    });
+    out += "]}";
+    return out;
+}
+
+std::string ServerTcp::cmdPrepare(const SqlPrepare& prepare, Session& session, const AuthedUser& u) {
+    if (session.named.count(prepare.name) != 0)
+        throw runtimeError("prepared statement already exists");
+    if (session.prepared.size() + session.named.size() >= maxPreparedPerSession)
+        throw runtimeError("too many prepared statements");
+
+    std::string parseError;
+    auto cmd = sqlCommand(prepare.statement, parseError);
+    if (!cmd.has_value())
+        throw runtimeError(parseError);
+    session.named[prepare.name] = planStatement(std::move(*cmd), session.keyspace, u);
+    return jsonOk();
+}
+
+std::string ServerTcp::cmdExecute(const SqlExecute& execute, Session& session, const AuthedUser& u) {
+    auto it = session.named.find(execute.name);
+    if (it == session.named.end())
+        throw runtimeError("unknown prepared statement");
+    auto stmt = it->second;
+    auto table = planTable(stmt, u);
+    it->second = stmt;
+
+    if (execute.values.size() != stmt->paramTypes.size())
+        throw runtimeError("expected " + std::to_string(stmt->paramTypes.size()) + " parameters");
+    SqlCommand bound = stmt->cmd;
+    auto slots = sqlParamSlots(bound);
+    for (usize k = 0; k < slots.size(); k++)
+        *slots[k].value = execute.values[k];
+
+    if (stmt->columns.empty())
+        return runCommand(session, bound);
+    return selectJson(*stmt, *table, std::get<SqlSelect>(bound), u);
+}
+
+std::string ServerTcp::cmdDeallocate(const SqlDeallocate& deallocate, Session& session) {
+    if (session.named.erase(deallocate.name) == 0)
+        throw runtimeError("unknown prepared statement");
+    return jsonOk();
+}
+
+}
@@ -31,10 +31,10 @@ std::string ServerTcp::cmdCreateTable(const SqlCreateTable& createTable, const s
     }
 
     if (!createTable.ifNotExists) {
-        (void)db_->createTable(keyspace, createTable.table, createTable.schema);
+        (void)db_->createTable(keyspace, createTable.table, createTable.schema, createTable.options);
     } else {
         try {
-            (void)db_->createTable(keyspace, createTable.table, createTable.schema);
+            (void)db_->createTable(keyspace, createTable.table, createTable.schema, createTable.options);
         } catch (const std::exception& e) {
             if (std::string(e.what()) == "Table exists") {
                 auto t = db_->openTable(keyspace, createTable.table);
@@ -115,7 +115,9 @@ std::string ServerTcp::cmdDescribeTable(const SqlDescribeTable& describe, const
     const auto& schema = t->schema();
     std::string out = "{\"ok\":true,\"keyspace\":\"" + jsonEscape(keyspace) + "\",\"table\":\"" + jsonEscape(describe.table) + "\",";
     auto pkName = schema.columns[schema.primaryKeyIndex].name;
-    out += "\"primaryKey\":\"" + jsonEscape(pkName) + "\",\"columns\":[";
+    out += "\"primaryKey\":\"" + jsonEscape(pkName) + "\",";
+    out += "\"compaction\":\"" + jsonEscape(compactionStrategyName(t->options().compaction)) + "\",";
+    out += "\"row_cache\":" + std::to_string(t->options().rowCacheRows) + ",\"columns\":[";
     for (usize c = 0; c < schema.columns.size(); c++) {
         if (c) {
             out += ",";
@@ -149,7 +151,15 @@ std::string ServerTcp::cmdShowCreateTable(const SqlShowCreateTable& showCreate,
         }
         stmt += schema.columns[c].name + " " + columnTypeName(schema.columns[c].type);
     }
-    stmt += ", PRIMARY KEY (" + pkName + "));";
+    stmt += ", PRIMARY KEY (" + pkName + "))";
+    std::vector<std::string> options;
+    if (t->options().compaction != CompactionStrategy::SizeTiered)
+        options.push_back("compaction = \"" + compactionStrategyName(t->options().compaction) + "\"");
+    if (t->options().rowCacheRows > 0)
+        options.push_back("row_cache = " + std::to_string(t->options().rowCacheRows));
+    for (usize o = 0; o < options.size(); o++)
+        stmt += (o == 0 ? " WITH " : " AND ") + options[o];
+    stmt += ";";
     return std::string("{\"ok\":true,\"create\":\"") + jsonEscape(stmt) + "\"}";
 }
 
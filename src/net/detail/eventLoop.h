@@ -0,0 +1,106 @@
+#pragma once
+
+#include "net/serverTcp.h"
+
+#include "prelude.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace xeondb {
+
+struct ServerTcp::Connection {
+    // Set by the first byte: binary clients open with wireMagic.
+    enum class Protocol : u8 { Unknown, Line, Binary };
+
+    int fd = -1;
+    Protocol protocol = Protocol::Unknown;
+    Session session;
+    // Bytes received but not yet dispatched: complete lines or frames are
+    // taken all at once, leaving at most a partial one.
+    std::string in;
+    // Where the search for the next newline resumes, so a long partial line
+    // is not rescanned on every read.
+    usize inScanned = 0;
+    // Responses, newline included, the socket has not taken yet; outSent
+    // bytes of the first are already sent.
+    std::deque<std::string> out;
+    usize outSent = 0;
+    // A batch of commands is with the workers; the session belongs to them
+    // until it returns.
+    bool busy = false;
+    // Nothing more will be read: the peer shut down or sent an oversized line.
+    bool readClosed = false;
+    // The socket failed; close once the in-flight command returns.
+    bool broken = false;
+    u32 events = 0;
+};
+
+// Fixed pool running commands for every event loop. A connection has at most
+// one batch queued or running, so the queue is bounded by maxConnections.
+class ServerTcp::WorkerPool {
+public:
+    explicit WorkerPool(usize threads);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void submit(std::function<void()> job);
+
+private:
+    void workerMain();
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> jobs_;
+    bool stop_;
+    std::vector<std::thread> threads_;
+};
+
+// One epoll reactor: accepts from its listening socket, reads request
+// lines from its connections, hands each to the workers and writes the
+// responses back. Every connection stays on the loop that accepted it.
+class ServerTcp::EventLoop {
+public:
+    EventLoop(ServerTcp& server, int listenFd);
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    void run();
+
+private:
+    void acceptReady();
+    void readReady(const std::shared_ptr<Connection>& conn);
+    void drainCompleted();
+    // Dispatches every complete request as one batch, flushes output, and
+    // closes or re-arms the connection as its state requires.
+    void advance(const std::shared_ptr<Connection>& conn);
+    bool flush(Connection& conn);
+    void closeConnection(const std::shared_ptr<Connection>& conn);
+    void complete(const std::shared_ptr<Connection>& conn, std::vector<std::string> responses);
+
+    ServerTcp& server_;
+    int listenFd_;
+    int epollFd_;
+    // Workers signal finished commands through it.
+    int wakeFd_;
+    // Kept open so a full descriptor table can still shed a pending connection.
+    int spareFd_;
+    std::unordered_map<int, std::shared_ptr<Connection>> conns_;
+
+    std::mutex completedMutex_;
+    std::vector<std::pair<std::shared_ptr<Connection>, std::vector<std::string>>> completed_;
+};
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "prelude.h"
+
+#include "query/sql.h"
+#include "storage/table.h"
+
+#include <string>
+#include <vector>
+
+namespace xeondb {
+
+// Statements one connection may hold prepared at once, named and binary.
+inline constexpr usize maxPreparedPerSession = 4096;
+
+// A statement parsed once, with its table's keyspace filled in and its
+// columns resolved against the table, and run many times with different
+// parameter values.
+struct PreparedStatement {
+    SqlCommand cmd;
+    // The table the columns were resolved against; a dropped and recreated
+    // table has a new uuid and the statement is planned again.
+    std::string tableUuid;
+    // The column type each ? binds to, in order of appearance.
+    std::vector<ColumnType> paramTypes;
+
+    // A SELECT without aggregates, GROUP BY or ORDER BY reads these columns
+    // (schema indices) straight from the table under these names; anything
+    // else runs as a command.
+    std::vector<usize> columns;
+    std::vector<ColumnType> columnTypes;
+    std::vector<std::string> columnNames;
+};
+
+// Calls fn(pkBytes, rowBytes) for each row a planned SELECT returns, up to
+// its LIMIT. Planning checked that a WHERE uses the primary key.
+template <typename Fn>
+void forEachSelectedRow(Table& table, const SqlSelect& select, Fn&& fn) {
+    const TableSchema& schema = table.schema();
+    const usize limit = select.limit.value_or(static_cast<usize>(-1));
+    if (limit == 0)
+        return;
+    if (select.whereColumn.has_value()) {
+        if (!select.whereValue.has_value())
+            throw runtimeError("Expected where value");
+        byteVec pkBytes = partitionKeyBytes(schema.columns[schema.primaryKeyIndex].type, *select.whereValue);
+        auto row = table.getRow(pkBytes);
+        if (row.has_value())
+            fn(pkBytes, *row);
+        return;
+    }
+    auto scan = table.scanRows();
+    Table::ScanRow row;
+    usize rows = 0;
+    while (rows < limit && scan.next(row)) {
+        fn(row.pkBytes, row.rowBytes);
+        rows++;
+    }
+}
+
+}
@@ -11,8 +11,6 @@
 #include <cstring>
 #include <string>
 
-#include <sys/socket.h>
-
 namespace xeondb::server_tcp_detail {
 
 inline bool isSystemKeyspaceName(const std::string& keyspace) {
@@ -38,22 +36,6 @@ inline SqlLiteral litNumber(i64 v) {
     return l;
 }
 
-inline bool sendAll(int fd, const std::string& s) {
-    const char* p = s.data();
-    const usize n = s.size();
-    usize sent = 0;
-    while (sent < n) {
-        ssize_t sentBytes = ::send(fd, p + sent, n - sent, 0);
-        if (sentBytes < 0) {
-            if (errno == EINTR)
-                continue;
-            return false;
-        }
-        sent += static_cast<usize>(sentBytes);
-    }
-    return true;
-}
-
 inline runtimeError errnoError(const std::string& prefix) {
     return runtimeError(prefix + " errno=" + std::to_string(errno) + " err=" + std::string(::strerror(errno)));
 }
@@ -0,0 +1,200 @@
+#include "net/serverTcp.h"
+
+#include "net/detail/prepared.h"
+#include "net/detail/serverTcpInternal.h"
+#include "net/wireProtocol.h"
+
+#include "util/json.h"
+
+#include <string>
+
+using std::string;
+
+namespace xeondb {
+
+static void putU16(string& out, u16 v) {
+    out.push_back(static_cast<char>((v >> 8) & 0xFF));
+    out.push_back(static_cast<char>(v & 0xFF));
+}
+
+static void putU32(string& out, u32 v) {
+    out.push_back(static_cast<char>((v >> 24) & 0xFF));
+    out.push_back(static_cast<char>((v >> 16) & 0xFF));
+    out.push_back(static_cast<char>((v >> 8) & 0xFF));
+    out.push_back(static_cast<char>(v & 0xFF));
+}
+
+static void patchU32(string& out, usize at, u32 v) {
+    out[at] = static_cast<char>((v >> 24) & 0xFF);
+    out[at + 1] = static_cast<char>((v >> 16) & 0xFF);
+    out[at + 2] = static_cast<char>((v >> 8) & 0xFF);
+    out[at + 3] = static_cast<char>(v & 0xFF);
+}
+
+// Frames are built in place: the length is patched in once the payload is written.
+static string beginFrame(WireOp op) {
+    string out(4, '\0');
+    out.push_back(static_cast<char>(op));
+    return out;
+}
+
+static string endFrame(string out) {
+    patchU32(out, 0, static_cast<u32>(out.size() - 4));
+    return out;
+}
+
+string wireFrame(WireOp op, stringView payload) {
+    string out = beginFrame(op);
+    out.append(payload);
+    return endFrame(std::move(out));
+}
+
+// Reads a request payload; running past its end throws.
+class WireReader {
+public:
+    explicit WireReader(stringView data)
+        : data_(data)
+        , pos_(0) {
+    }
+
+    u16 u16Value() {
+        auto b = bytes(2);
+        return static_cast<u16>((static_cast<u8>(b[0]) << 8) | static_cast<u8>(b[1]));
+    }
+
+    u32 u32Value() {
+        auto b = bytes(4);
+        return (static_cast<u32>(static_cast<u8>(b[0])) << 24) | (static_cast<u32>(static_cast<u8>(b[1])) << 16) |
+               (static_cast<u32>(static_cast<u8>(b[2])) << 8) | static_cast<u32>(static_cast<u8>(b[3]));
+    }
+
+    stringView bytes(usize n) {
+        if (data_.size() - pos_ < n)
+            throw runtimeError("truncated frame");
+        auto out = data_.substr(pos_, n);
+        pos_ += n;
+        return out;
+    }
+
+    bool done() const {
+        return pos_ == data_.size();
+    }
+
+private:
+    stringView data_;
+    usize pos_;
+};
+
+string ServerTcp::handleFrame(Session& session, const string& frame) {
+    if (frame.empty())
+        return wireFrame(WireOp::Error, "empty frame");
+    auto op = static_cast<WireOp>(static_cast<u8>(frame[0]));
+    stringView body = stringView(frame).substr(1);
+    try {
+        if (op == WireOp::Query)
+            return wireFrame(WireOp::Json, handleLine(session, string(body)));
+        if (op != WireOp::Prepare && op != WireOp::Execute && op != WireOp::Close)
+            return wireFrame(WireOp::Error, "unknown op");
+        if (authEnabled_ && !session.user.has_value())
+            return wireFrame(WireOp::Error, "unauthorized");
+        if (op == WireOp::Prepare)
+            return prepareStatement(session, string(body));
+        if (op == WireOp::Execute)
+            return executeStatement(session, body);
+
+        WireReader reader(body);
+        u32 id = reader.u32Value();
+        if (session.prepared.erase(id) == 0)
+            return wireFrame(WireOp::Error, "unknown statement");
+        return wireFrame(WireOp::Json, jsonOk());
+    } catch (const std::exception& e) {
+        return wireFrame(WireOp::Error, e.what());
+    }
+}
+
+string ServerTcp::prepareStatement(Session& session, const string& sql) {
+    string parseError;
+    auto cmd = sqlCommand(sql, parseError);
+    if (!cmd.has_value())
+        return wireFrame(WireOp::Error, parseError);
+    if (session.prepared.size() + session.named.size() >= maxPreparedPerSession)
+        return wireFrame(WireOp::Error, "too many prepared statements");
+    AuthedUser noAuthRoot{"", 0};
+    auto stmt = planStatement(std::move(*cmd), session.keyspace, authEnabled_ ? *session.user : noAuthRoot);
+    u32 id = session.nextStatementId++;
+    session.prepared[id] = stmt;
+
+    string out = beginFrame(WireOp::Prepared);
+    putU32(out, id);
+    putU16(out, static_cast<u16>(stmt->paramTypes.size()));
+    for (auto type : stmt->paramTypes)
+        out.push_back(static_cast<char>(type));
+    putU16(out, static_cast<u16>(stmt->columns.size()));
+    for (usize c = 0; c < stmt->columns.size(); c++) {
+        out.push_back(static_cast<char>(stmt->columnTypes[c]));
+        putU16(out, static_cast<u16>(stmt->columnNames[c].size()));
+        out += stmt->columnNames[c];
+    }
+    return endFrame(std::move(out));
+}
+
+string ServerTcp::executeStatement(Session& session, stringView body) {
+    WireReader reader(body);
+    auto it = session.prepared.find(reader.u32Value());
+    if (it == session.prepared.end())
+        return wireFrame(WireOp::Error, "unknown statement");
+    AuthedUser noAuthRoot{"", 0};
+    const AuthedUser& u = authEnabled_ ? *session.user : noAuthRoot;
+    auto stmt = it->second;
+    auto table = planTable(stmt, u);
+    if (stmt != it->second) {
+        // The client decodes with the types it was given at prepare.
+        const auto& old = *it->second;
+        if (stmt->paramTypes != old.paramTypes || stmt->columnTypes != old.columnTypes || stmt->columnNames != old.columnNames) {
+            session.prepared.erase(it);
+            return wireFrame(WireOp::Error, "table changed since prepare");
+        }
+        it->second = stmt;
+    }
+
+    u16 count = reader.u16Value();
+    if (count != stmt->paramTypes.size())
+        return wireFrame(WireOp::Error, "expected " + std::to_string(stmt->paramTypes.size()) + " parameters");
+    SqlCommand bound = stmt->cmd;
+    for (const auto& slot : sqlParamSlots(bound)) {
+        u32 len = reader.u32Value();
+        if (len == wireNull) {
+            slot.value->kind = SqlLiteral::Kind::Null;
+            continue;
+        }
+        slot.value->kind = SqlLiteral::Kind::Bytes;
+        slot.value->text.assign(reader.bytes(len));
+    }
+    if (!reader.done())
+        return wireFrame(WireOp::Error, "trailing bytes");
+
+    if (stmt->columns.empty())
+        return wireFrame(WireOp::Json, runCommand(session, bound));
+    return selectRows(*stmt, *table, std::get<SqlSelect>(bound), u);
+}
+
+string ServerTcp::selectRows(const PreparedStatement& stmt, Table& table, const SqlSelect& select, const AuthedUser& u) {
+    if (authEnabled_ && !db_->canAccessKeyspace(u, select.keyspace))
+        throw runtimeError("forbidden");
+    db_->metricsOnCommand(select.keyspace);
+
+    const TableSchema& schema = table.schema();
+    string out = beginFrame(WireOp::Rows);
+    putU16(out, static_cast<u16>(stmt.columns.size()));
+    const usize countAt = out.size();
+    putU32(out, 0);
+    u32 rows = 0;
+    forEachSelectedRow(table, select, [&](const byteVec& pkBytes, const byteVec& rowBytes) {
+        appendRowBinary(out, schema, pkBytes, rowBytes, stmt.columns);
+        rows++;
+    });
+    patchU32(out, countAt, rows);
+    return endFrame(std::move(out));
+}
+
+}
@@ -0,0 +1,446 @@
+#include "net/detail/eventLoop.h"
+
+#include "net/detail/serverTcpInternal.h"
+#include "net/wireProtocol.h"
+
+#include "util/json.h"
+#include "util/log.h"
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+using std::string;
+
+namespace xeondb {
+
+ServerTcp::WorkerPool::WorkerPool(usize threads)
+    : stop_(false) {
+    if (threads == 0)
+        threads = 1;
+    threads_.reserve(threads);
+    for (usize i = 0; i < threads; i++) {
+        threads_.emplace_back([this]() {
+            workerMain();
+        });
+    }
+}
+
+ServerTcp::WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : threads_) {
+        if (t.joinable())
+            t.join();
+    }
+}
+
+void ServerTcp::WorkerPool::submit(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stop_)
+            return;
+        jobs_.push_back(std::move(job));
+    }
+    cv_.notify_one();
+}
+
+void ServerTcp::WorkerPool::workerMain() {
+    for (;;) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [&]() {
+                return stop_ || !jobs_.empty();
+            });
+            if (stop_)
+                return;
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+        try {
+            job();
+        } catch (const std::exception& e) {
+            xeondb::log(xeondb::LogLevel::ERROR, string("Request job failed err=") + e.what());
+        } catch (...) {
+            xeondb::log(xeondb::LogLevel::ERROR, "Request job failed");
+        }
+    }
+}
+
+ServerTcp::EventLoop::EventLoop(ServerTcp& server, int listenFd)
+    : server_(server)
+    , listenFd_(listenFd)
+    , epollFd_(-1)
+    , wakeFd_(-1)
+    , spareFd_(-1) {
+    using server_tcp_detail::errnoError;
+
+    epollFd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ < 0)
+        throw errnoError("epoll_create1 failed");
+    wakeFd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd_ < 0) {
+        ::close(epollFd_);
+        throw errnoError("eventfd failed");
+    }
+
+    epoll_event wake{};
+    wake.events = EPOLLIN;
+    wake.data.fd = wakeFd_;
+    // Loops may share one listening socket when SO_REUSEPORT is unavailable;
+    // EPOLLEXCLUSIVE then wakes only one of them per incoming connection.
+    epoll_event listen{};
+    listen.events = EPOLLIN | EPOLLEXCLUSIVE;
+    listen.data.fd = listenFd_;
+    if (::epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &wake) != 0 || ::epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenFd_, &listen) != 0) {
+        auto err = errnoError("epoll_ctl failed");
+        ::close(wakeFd_);
+        ::close(epollFd_);
+        throw err;
+    }
+    spareFd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+ServerTcp::EventLoop::~EventLoop() {
+    for (auto& [fd, conn] : conns_)
+        ::close(fd);
+    if (spareFd_ >= 0)
+        ::close(spareFd_);
+    ::close(wakeFd_);
+    ::close(epollFd_);
+}
+
+void ServerTcp::EventLoop::run() {
+    epoll_event events[256];
+    for (;;) {
+        int n = ::epoll_wait(epollFd_, events, 256, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            throw server_tcp_detail::errnoError("epoll_wait failed");
+        }
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listenFd_) {
+                acceptReady();
+                continue;
+            }
+            if (fd == wakeFd_) {
+                drainCompleted();
+                continue;
+            }
+            auto it = conns_.find(fd);
+            if (it == conns_.end())
+                continue;
+            auto conn = it->second;
+            u32 ev = events[i].events;
+            if ((ev & (EPOLLHUP | EPOLLERR)) != 0) {
+                conn->broken = true;
+                advance(conn);
+            } else if ((ev & EPOLLIN) != 0) {
+                readReady(conn);
+            } else {
+                advance(conn);
+            }
+        }
+    }
+}
+
+void ServerTcp::EventLoop::acceptReady() {
+    // Bounded so a connection storm cannot starve the connections already here.
+    for (int i = 0; i < 64; i++) {
+        int fd = ::accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if ((errno == EMFILE || errno == ENFILE) && spareFd_ >= 0) {
+                // Out of descriptors: shed the pending connection, or the
+                // listening socket stays readable and the loop spins.
+                ::close(spareFd_);
+                int shed = ::accept(listenFd_, nullptr, nullptr);
+                if (shed >= 0)
+                    ::close(shed);
+                spareFd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+                xeondb::log(xeondb::LogLevel::WARN, "Connection dropped: out of file descriptors");
+            }
+            return;
+        }
+        if (server_.connectionCount_.fetch_add(1) >= server_.maxConnections_) {
+            server_.connectionCount_.fetch_sub(1);
+            string msg = jsonError("too_many_connections") + "\n";
+            ::send(fd, msg.data(), msg.size(), MSG_NOSIGNAL);
+            ::close(fd);
+            continue;
+        }
+
+        auto conn = std::make_shared<Connection>();
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+        epoll_event ev{};
+        ev.events = conn->events;
+        ev.data.fd = fd;
+        if (::epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            ::close(fd);
+            server_.connectionCount_.fetch_sub(1);
+            continue;
+        }
+        conns_.emplace(fd, std::move(conn));
+    }
+}
+
+void ServerTcp::EventLoop::readReady(const std::shared_ptr<Connection>& conn) {
+    char tmp[16384];
+    ssize_t received = ::recv(conn->fd, tmp, sizeof(tmp), 0);
+    if (received > 0) {
+        conn->in.append(tmp, static_cast<usize>(received));
+    } else if (received == 0) {
+        conn->readClosed = true;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        conn->broken = true;
+    }
+    advance(conn);
+}
+
+void ServerTcp::EventLoop::drainCompleted() {
+    u64 count = 0;
+    while (::read(wakeFd_, &count, sizeof(count)) < 0 && errno == EINTR) {
+    }
+
+    std::vector<std::pair<std::shared_ptr<Connection>, std::vector<string>>> done;
+    {
+        std::lock_guard<std::mutex> lock(completedMutex_);
+        done.swap(completed_);
+    }
+    for (auto& [conn, responses] : done) {
+        conn->busy = false;
+        if (!conn->broken) {
+            for (auto& response : responses)
+                conn->out.push_back(std::move(response));
+        }
+        advance(conn);
+    }
+}
+
+// Every complete line in the buffer, in order; only a partial line is left
+// behind, moved to the front with one erase.
+static std::vector<string> takeLines(string& in, usize& scanned) {
+    std::vector<string> lines;
+    usize pos = 0;
+    for (;;) {
+        auto newl = in.find('\n', std::max(pos, scanned));
+        if (newl == string::npos)
+            break;
+        usize end = newl;
+        if (end > pos && in[end - 1] == '\r')
+            end--;
+        if (end > pos)
+            lines.emplace_back(in, pos, end - pos);
+        pos = newl + 1;
+    }
+    in.erase(0, pos);
+    scanned = in.size();
+    return lines;
+}
+
+// Every complete binary frame (op and payload). A frame claiming more than
+// maxBytes, or nothing at all, stops the walk and sets bad.
+static std::vector<string> takeFrames(string& in, usize maxBytes, bool& bad) {
+    std::vector<string> frames;
+    usize pos = 0;
+    while (in.size() - pos >= 4) {
+        const auto* p = reinterpret_cast<const u8*>(in.data() + pos);
+        u32 len = (static_cast<u32>(p[0]) << 24) | (static_cast<u32>(p[1]) << 16) | (static_cast<u32>(p[2]) << 8) | static_cast<u32>(p[3]);
+        if (len == 0 || len > maxBytes) {
+            bad = true;
+            break;
+        }
+        if (in.size() - pos - 4 < len)
+            break;
+        frames.emplace_back(in, pos + 4, len);
+        pos += 4 + len;
+    }
+    in.erase(0, pos);
+    return frames;
+}
+
+void ServerTcp::EventLoop::advance(const std::shared_ptr<Connection>& conn) {
+    Connection& c = *conn;
+
+    // A connection has one batch in flight, run in order by a single worker,
+    // and the next is only taken once the previous responses are on the socket.
+    for (;;) {
+        if (!c.broken && !flush(c))
+            c.broken = true;
+        if (c.busy || c.broken || !c.out.empty())
+            break;
+
+        if (c.protocol == Connection::Protocol::Unknown) {
+            if (c.in.empty())
+                break;
+            if (c.in[0] != wireMagic[0]) {
+                c.protocol = Connection::Protocol::Line;
+            } else if (c.in.size() < wireMagicLen + 1) {
+                break;
+            } else if (std::memcmp(c.in.data(), wireMagic, wireMagicLen) != 0 || static_cast<u8>(c.in[wireMagicLen]) != wireVersion) {
+                c.out.push_back(wireFrame(WireOp::Error, "unsupported protocol"));
+                c.in.clear();
+                c.readClosed = true;
+                continue;
+            } else {
+                c.protocol = Connection::Protocol::Binary;
+                c.out.push_back(c.in.substr(0, wireMagicLen + 1));
+                c.in.erase(0, wireMagicLen + 1);
+                continue;
+            }
+        }
+
+        const bool binary = c.protocol == Connection::Protocol::Binary;
+        bool badFrame = false;
+        auto requests = binary ? takeFrames(c.in, server_.maxLineBytes_, badFrame) : takeLines(c.in, c.inScanned);
+        if (requests.empty()) {
+            if (badFrame || (!binary && c.in.size() > server_.maxLineBytes_)) {
+                c.out.push_back(binary ? wireFrame(WireOp::Error, "frame_too_large") : jsonError("line_too_large") + "\n");
+                c.in.clear();
+                c.inScanned = 0;
+                c.readClosed = true;
+                continue;
+            }
+            break;
+        }
+
+        c.busy = true;
+        server_.workers_->submit([this, conn, binary, requests = std::move(requests)]() {
+            auto errorReply = [binary](const string& message) {
+                return binary ? wireFrame(WireOp::Error, message) : jsonError(message) + "\n";
+            };
+            // Every request gets a reply and the batch always completes, or
+            // the connection would stay busy for good.
+            std::vector<string> responses;
+            try {
+                responses.reserve(requests.size());
+                for (const auto& request : requests) {
+                    string response;
+                    try {
+                        response = binary ? server_.handleFrame(conn->session, request) : server_.handleLine(conn->session, request) + "\n";
+                    } catch (const std::exception& e) {
+                        response = errorReply(e.what());
+                    } catch (...) {
+                        response = errorReply("internal error");
+                    }
+                    responses.push_back(std::move(response));
+                }
+            } catch (...) {
+                xeondb::log(xeondb::LogLevel::ERROR, "Request batch failed while gathering replies");
+                while (responses.size() < requests.size())
+                    responses.push_back(errorReply("internal error"));
+            }
+            complete(conn, std::move(responses));
+        });
+    }
+
+    if (c.broken) {
+        c.in.clear();
+        c.out.clear();
+        c.outSent = 0;
+        // A hung up socket reports EPOLLHUP whatever the mask, so it leaves
+        // epoll now even when a command still holds the connection open.
+        ::epoll_ctl(epollFd_, EPOLL_CTL_DEL, c.fd, nullptr);
+        if (!c.busy)
+            closeConnection(conn);
+        return;
+    }
+    if (!c.busy && c.readClosed && c.out.empty()) {
+        closeConnection(conn);
+        return;
+    }
+
+    // Stop reading while a batch runs and a full request's worth (a frame
+    // adds its u32 length) is already buffered.
+    u32 want = 0;
+    if (!c.readClosed && c.in.size() <= server_.maxLineBytes_ + sizeof(u32))
+        want |= EPOLLIN;
+    if (!c.out.empty())
+        want |= EPOLLOUT;
+    if (want != c.events) {
+        epoll_event ev{};
+        ev.events = want;
+        ev.data.fd = c.fd;
+        ::epoll_ctl(epollFd_, EPOLL_CTL_MOD, c.fd, &ev);
+        c.events = want;
+    }
+}
+
+// Gathers queued responses into as few sendmsg calls as the socket allows.
+bool ServerTcp::EventLoop::flush(Connection& conn) {
+    constexpr usize maxIov = 256;
+    iovec iov[maxIov];
+    while (!conn.out.empty()) {
+        usize count = 0;
+        for (auto it = conn.out.begin(); it != conn.out.end() && count < maxIov; ++it, ++count) {
+            usize skip = count == 0 ? conn.outSent : 0;
+            iov[count].iov_base = it->data() + skip;
+            iov[count].iov_len = it->size() - skip;
+        }
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t n = ::sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            return false;
+        }
+        usize sent = static_cast<usize>(n);
+        while (sent > 0) {
+            usize left = conn.out.front().size() - conn.outSent;
+            if (sent < left) {
+                conn.outSent += sent;
+                break;
+            }
+            sent -= left;
+            conn.out.pop_front();
+            conn.outSent = 0;
+        }
+    }
+    return true;
+}
+
+void ServerTcp::EventLoop::closeConnection(const std::shared_ptr<Connection>& conn) {
+    int fd = conn->fd;
+    conn->fd = -1;
+    ::epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    conns_.erase(fd);
+    server_.endSession(conn->session);
+    server_.connectionCount_.fetch_sub(1);
+}
+
+void ServerTcp::EventLoop::complete(const std::shared_ptr<Connection>& conn, std::vector<string> responses) {
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(completedMutex_);
+        wake = completed_.empty();
+        completed_.emplace_back(conn, std::move(responses));
+    }
+    // A non-empty list already has a wakeup pending that will pick this up.
+    if (wake) {
+        u64 one = 1;
+        while (::write(wakeFd_, &one, sizeof(one)) < 0 && errno == EINTR) {
+        }
+    }
+}
+
+}
@@ -1,5 +1,6 @@
 #include "net/serverTcp.h"
 
+#include "net/detail/eventLoop.h"
 #include "net/detail/serverTcpInternal.h"
 
 #include "util/json.h"
@@ -7,62 +8,156 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
+#include <fstream>
+#include <sstream>
 #include <thread>
 
 namespace xeondb {
 
-ServerTcp::ServerTcp(
-        std::shared_ptr<Db> db, std::string host, u16 port, usize maxLineBytes, usize maxConnections, std::string authUsername, std::string authPassword)
+ServerTcp::ServerTcp(std::shared_ptr<Db> db, std::string host, u16 port, usize maxLineBytes, usize maxConnections, usize listenBacklog, usize eventLoops,
+        usize workers, std::string authUsername, std::string authPassword)
     : db_(std::move(db))
     , host_(std::move(host))
     , port_(port)
     , maxLineBytes_(maxLineBytes)
     , maxConnections_(maxConnections)
+    , listenBacklog_(listenBacklog)
     , authUsername_(std::move(authUsername))
     , authPassword_(std::move(authPassword))
     , authEnabled_(db_ != nullptr ? db_->authEnabled() : (!authUsername_.empty() && !authPassword_.empty()))
-    , connectionCount_(0) {
+    , eventLoopCount_(eventLoops)
+    , workerCount_(workers)
+    , connectionCount_(0)
+    , listenOverflowsBase_(0)
+    , listenDropsBase_(0) {
+    usize cores = std::max<usize>(1, std::thread::hardware_concurrency());
+    if (eventLoopCount_ == 0)
+        eventLoopCount_ = cores;
+    if (workerCount_ == 0)
+        workerCount_ = std::max<usize>(8, cores * 4);
 }
 
 ServerTcp::~ServerTcp() = default;
 
-void ServerTcp::run() {
+// Every connection holds a descriptor, and tables keep SSTables and log
+// segments open besides.
+static void raiseOpenFileLimit(usize connections) {
+    const rlim_t wanted = static_cast<rlim_t>(connections) + 1024;
+    rlimit lim{};
+    if (::getrlimit(RLIMIT_NOFILE, &lim) != 0 || lim.rlim_cur >= wanted)
+        return;
+    lim.rlim_cur = std::min(lim.rlim_max, wanted);
+    ::setrlimit(RLIMIT_NOFILE, &lim);
+    if (lim.rlim_cur < wanted) {
+        xeondb::log(xeondb::LogLevel::WARN,
+                "Open file limit=" + std::to_string(lim.rlim_cur) + " is below maxConnections=" + std::to_string(connections) + " plus headroom");
+    }
+}
+
+// ListenOverflows and ListenDrops from /proc/net/netstat: SYNs and
+// handshakes the kernel dropped because an accept queue was full, host-wide.
+static bool readListenCounters(u64& overflows, u64& drops) {
+    std::ifstream in("/proc/net/netstat");
+    std::string names;
+    std::string values;
+    while (std::getline(in, names) && std::getline(in, values)) {
+        if (names.rfind("TcpExt:", 0) != 0)
+            continue;
+        std::istringstream n(names);
+        std::istringstream v(values);
+        std::string name;
+        std::string value;
+        bool found = false;
+        while (n >> name && v >> value) {
+            if (name == "ListenOverflows") {
+                overflows = std::stoull(value);
+                found = true;
+            } else if (name == "ListenDrops") {
+                drops = std::stoull(value);
+            }
+        }
+        return found;
+    }
+    return false;
+}
+
+// One listening socket per event loop when reusePort is set; the kernel then
+// spreads incoming connections over them.
+static int openListener(const sockaddr_in& addr, int backlog, bool& reusePort) {
     using server_tcp_detail::errnoError;
-    using server_tcp_detail::sendAll;
 
-    int socketFileDesc = ::socket(AF_INET, SOCK_STREAM, 0);
-    if (socketFileDesc < 0)
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
         throw errnoError("socket failed");
-    int addrFlag = 1;
-    ::setsockopt(socketFileDesc, SOL_SOCKET, SO_REUSEADDR, &addrFlag, sizeof(addrFlag));
+    int flag = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    if (reusePort && ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag)) != 0)
+        reusePort = false;
+
+    if (::bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+        auto err = errnoError("bind failed");
+        ::close(fd);
+        throw err;
+    }
+    if (::listen(fd, backlog) != 0) {
+        auto err = errnoError("listen failed");
+        ::close(fd);
+        throw err;
+    }
+    return fd;
+}
 
+ServerTcp::ListenStats ServerTcp::listenStats() const {
+    ListenStats stats;
+    stats.sockets = listenFds_.size();
+    for (int fd : listenFds_) {
+        // On a listening socket, unacked is the accept queue length and
+        // sacked its limit.
+        tcp_info info{};
+        socklen_t len = sizeof(info);
+        if (::getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0)
+            continue;
+        stats.backlog = info.tcpi_sacked;
+        stats.queued += info.tcpi_unacked;
+    }
+    u64 overflows = 0;
+    u64 drops = 0;
+    if (readListenCounters(overflows, drops)) {
+        stats.overflows = overflows >= listenOverflowsBase_ ? overflows - listenOverflowsBase_ : 0;
+        stats.drops = drops >= listenDropsBase_ ? drops - listenDropsBase_ : 0;
+    }
+    return stats;
+}
+
+void ServerTcp::run() {
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
     addr.sin_port = htons(port_);
-    if (::inet_pton(AF_INET, host_.c_str(), &addr.sin_addr) != 1) {
-        ::close(socketFileDesc);
+    if (::inet_pton(AF_INET, host_.c_str(), &addr.sin_addr) != 1)
         throw runtimeError("bad host");
-    }
 
-    if (::bind(socketFileDesc, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
-        ::close(socketFileDesc);
-        throw errnoError("bind failed");
-    }
-    if (::listen(socketFileDesc, 128) != 0) {
-        ::close(socketFileDesc);
-        throw errnoError("listen failed");
-    }
+    const int backlog = static_cast<int>(std::min<usize>(listenBacklog_, 1u << 20));
+    bool reusePort = eventLoopCount_ > 1;
+    listenFds_.push_back(openListener(addr, backlog, reusePort));
+    // Without SO_REUSEPORT every loop waits on the one socket instead.
+    while (reusePort && listenFds_.size() < eventLoopCount_)
+        listenFds_.push_back(openListener(addr, backlog, reusePort));
+    readListenCounters(listenOverflowsBase_, listenDropsBase_);
 
     xeondb::log(xeondb::LogLevel::INFO, std::string("Listening host=") + host_ + " port=" + std::to_string(port_) +
                                                 " maxLineBytes=" + std::to_string(maxLineBytes_) + " maxConnections=" + std::to_string(maxConnections_) +
+                                                " listenBacklog=" + std::to_string(backlog) + " listeners=" + std::to_string(listenFds_.size()) +
+                                                " eventLoops=" + std::to_string(eventLoopCount_) + " workers=" + std::to_string(workerCount_) +
                                                 " auth=" + (authEnabled_ ? "enabled" : "disabled"));
-
     if (db_ != nullptr) {
         auto db = db_;
         std::thread sampler([db]() {
@@ -79,26 +174,18 @@ void ServerTcp::run() {
         sampler.detach();
     }
 
-    for (;;) {
-        int clientSocketDesc = ::accept(socketFileDesc, nullptr, nullptr);
-        if (clientSocketDesc < 0) {
-            if (errno == EINTR)
-                continue;
-            continue;
-        }
-        if (connectionCount_.load() >= maxConnections_) {
-            sendAll(clientSocketDesc, jsonError("too_many_connections") + "\n");
-            ::close(clientSocketDesc);
-            continue;
-        }
-        connectionCount_++;
-        std::thread t([this, clientSocketDesc]() {
-            handleClient(clientSocketDesc);
-            ::close(clientSocketDesc);
-            connectionCount_--;
+    raiseOpenFileLimit(maxConnections_);
+    workers_ = std::make_unique<WorkerPool>(workerCount_);
+    for (usize i = 0; i < eventLoopCount_; i++)
+        loops_.push_back(std::make_unique<EventLoop>(*this, listenFds_[i % listenFds_.size()]));
+    for (usize i = 1; i < loops_.size(); i++) {
+        EventLoop* loop = loops_[i].get();
+        std::thread t([loop]() {
+            loop->run();
         });
         t.detach();
     }
+    loops_[0]->run();
 }
 
 }
@@ -0,0 +1,57 @@
+#include "query/schema.h"
+
+#include "query/schema/detail/internal.h"
+
+#include "util/binIo.h"
+
+namespace xeondb {
+
+static void appendWireU32(string& out, u32 v) {
+    out.push_back(static_cast<char>((v >> 24) & 0xFF));
+    out.push_back(static_cast<char>((v >> 16) & 0xFF));
+    out.push_back(static_cast<char>((v >> 8) & 0xFF));
+    out.push_back(static_cast<char>(v & 0xFF));
+}
+
+void appendRowBinary(string& out, const TableSchema& schema, const byteVec& pkBytes, const byteVec& rowBytes, const std::vector<usize>& columns) {
+    usize offset = 0;
+    auto version = readBeU32(rowBytes, offset);
+    if (version != 1)
+        throw runtimeError("bad row version");
+
+    // Where each non-null value starts.
+    constexpr usize nullValue = static_cast<usize>(-1);
+    std::vector<usize> valueOffsets(schema.columns.size(), nullValue);
+    for (usize i = 0; i < schema.columns.size(); i++) {
+        if (i == schema.primaryKeyIndex)
+            continue;
+        if (offset >= rowBytes.size())
+            throw runtimeError("bad row");
+        if (rowBytes[offset++] != 0)
+            continue;
+        valueOffsets[i] = offset;
+        schema_detail::skipValueBytes(schema.columns[i].type, rowBytes, offset);
+    }
+
+    for (usize i : columns) {
+        if (i == schema.primaryKeyIndex) {
+            appendWireU32(out, static_cast<u32>(pkBytes.size()));
+            out.append(pkBytes.begin(), pkBytes.end());
+            continue;
+        }
+        usize start = valueOffsets[i];
+        if (start == nullValue) {
+            appendWireU32(out, 0xFFFFFFFFu);
+            continue;
+        }
+        usize end = start;
+        schema_detail::skipValueBytes(schema.columns[i].type, rowBytes, end);
+        ColumnType type = schema.columns[i].type;
+        // Variable-size values are stored with the same u32 length prefix.
+        if (type != ColumnType::Text && type != ColumnType::Char && type != ColumnType::Blob)
+            appendWireU32(out, static_cast<u32>(end - start));
+        out.append(rowBytes.begin() + static_cast<std::ptrdiff_t>(start), rowBytes.begin() + static_cast<std::ptrdiff_t>(end));
+    }
+}
+
+}
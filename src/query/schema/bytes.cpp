@@ -7,9 +7,48 @@
 
 namespace xeondb::schema_detail {
 
+void checkCanonicalBytes(ColumnType type, const std::string& bytes) {
+    usize want = 0;
+    switch (type) {
+    case ColumnType::Text:
+    case ColumnType::Blob:
+        return;
+    case ColumnType::Char:
+        want = 1;
+        break;
+    case ColumnType::Boolean:
+        if (bytes.size() == 1 && (bytes[0] == 0 || bytes[0] == 1))
+            return;
+        throw runtimeError("bad boolean value");
+    case ColumnType::Int32:
+    case ColumnType::Float32:
+    case ColumnType::Date:
+        want = 4;
+        break;
+    case ColumnType::Int64:
+    case ColumnType::Timestamp:
+        want = 8;
+        break;
+    default:
+        throw runtimeError("bad type");
+    }
+    if (bytes.size() != want)
+        throw runtimeError("bad " + columnTypeName(type) + " value");
+}
+
 void appendValueBytes(byteVec& out, ColumnType type, const SqlLiteral& lit) {
     if (lit.kind == SqlLiteral::Kind::Null)
         throw runtimeError("null");
+    if (lit.kind == SqlLiteral::Kind::Param)
+        throw runtimeError("unbound parameter");
+    if (lit.kind == SqlLiteral::Kind::Bytes) {
+        // Stored like the canonical form, with a length prefix for the variable-size types.
+        checkCanonicalBytes(type, lit.text);
+        if (type == ColumnType::Text || type == ColumnType::Char || type == ColumnType::Blob)
+            appendBeU32(out, static_cast<u32>(lit.text.size()));
+        out.insert(out.end(), lit.text.begin(), lit.text.end());
+        return;
+    }
     switch (type) {
     case ColumnType::Char: {
         if (lit.kind != SqlLiteral::Kind::Quoted || lit.text.size() != 1)
@@ -15,6 +15,8 @@ i32 parseDateDays(const std::string& s);
 i64 parseTimestampMs(const std::string& s);
 
 void appendValueBytes(byteVec& out, ColumnType type, const SqlLiteral& lit);
+// Throws unless bytes is a valid canonical encoding of type.
+void checkCanonicalBytes(ColumnType type, const std::string& bytes);
 void skipValueBytes(ColumnType type, const byteVec& b, usize& o);
 
 std::string jsonValueFromBytes(ColumnType type, const byteVec& b, usize& o);
@@ -12,6 +12,12 @@ namespace xeondb {
 byteVec partitionKeyBytes(ColumnType type, const SqlLiteral& lit) {
     if (lit.kind == SqlLiteral::Kind::Null)
         throw runtimeError("pk cannot be null");
+    if (lit.kind == SqlLiteral::Kind::Param)
+        throw runtimeError("unbound parameter");
+    if (lit.kind == SqlLiteral::Kind::Bytes) {
+        schema_detail::checkCanonicalBytes(type, lit.text);
+        return byteVec(lit.text.begin(), lit.text.end());
+    }
     byteVec out;
     switch (type) {
     case ColumnType::Char: {
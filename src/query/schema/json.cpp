@@ -7,74 +7,67 @@
 
 namespace xeondb {
 
-string rowToJsonMapped(
-        const TableSchema& schema, const byteVec& pkBytes, const byteVec& rowBytes, const std::vector<std::pair<string, string>>& selectColumns) {
-    std::vector<string> cols;
-    std::vector<std::pair<string, string>> mapped;
-    if (selectColumns.empty()) {
-        for (const auto& column : schema.columns)
-            mapped.push_back({column.name, column.name});
-    } else {
-        mapped = selectColumns;
-    }
-
+string rowToJsonColumns(
+        const TableSchema& schema, const byteVec& pkBytes, const byteVec& rowBytes, const std::vector<usize>& columns, const std::vector<string>& names) {
     usize offset = 0;
     auto version = readBeU32(rowBytes, offset);
     if (version != 1)
         throw runtimeError("bad row version");
 
-    std::vector<bool> isNull;
-    isNull.resize(schema.columns.size(), true);
-    std::vector<usize> valueOffsets;
-    valueOffsets.resize(schema.columns.size(), 0);
-    std::vector<usize> valueSizes;
-    valueSizes.resize(schema.columns.size(), 0);
-
+    // Where each non-null value starts.
+    constexpr usize nullValue = static_cast<usize>(-1);
+    std::vector<usize> valueOffsets(schema.columns.size(), nullValue);
     for (usize i = 0; i < schema.columns.size(); i++) {
         if (i == schema.primaryKeyIndex)
             continue;
         if (offset >= rowBytes.size())
             throw runtimeError("bad row");
-        u8 row = rowBytes[offset++];
-        if (row != 0) {
-            isNull[i] = true;
+        if (rowBytes[offset++] != 0)
             continue;
-        }
-        isNull[i] = false;
-        usize before = offset;
-        (void)schema_detail::jsonValueFromBytes(schema.columns[i].type, rowBytes, offset);
-        valueOffsets[i] = before;
-        valueSizes[i] = offset - before;
+        valueOffsets[i] = offset;
+        schema_detail::skipValueBytes(schema.columns[i].type, rowBytes, offset);
     }
 
     string out = "{";
-    bool first = true;
-    for (const auto& it : mapped) {
-        const auto& outName = it.first;
-        const auto& sourceName = it.second;
-        auto columnIndex = findColumnIndex(schema, sourceName);
-        if (!columnIndex.has_value())
-            throw runtimeError("unknown column");
-        usize i = *columnIndex;
-        if (!first)
+    for (usize c = 0; c < columns.size(); c++) {
+        usize i = columns[c];
+        if (c > 0)
             out += ",";
-        first = false;
-        out += "\"" + jsonEscape(outName) + "\":";
+        out += "\"" + jsonEscape(names[c]) + "\":";
         if (i == schema.primaryKeyIndex) {
             out += schema_detail::jsonPkValue(schema.columns[i].type, pkBytes);
+        } else if (valueOffsets[i] == nullValue) {
+            out += "null";
         } else {
-            if (isNull[i]) {
-                out += "null";
-            } else {
-                usize valueOffset = valueOffsets[i];
-                out += schema_detail::jsonValueFromBytes(schema.columns[i].type, rowBytes, valueOffset);
-            }
+            usize valueOffset = valueOffsets[i];
+            out += schema_detail::jsonValueFromBytes(schema.columns[i].type, rowBytes, valueOffset);
         }
     }
     out += "}";
     return out;
 }
 
+string rowToJsonMapped(
+        const TableSchema& schema, const byteVec& pkBytes, const byteVec& rowBytes, const std::vector<std::pair<string, string>>& selectColumns) {
+    std::vector<usize> columns;
+    std::vector<string> names;
+    if (selectColumns.empty()) {
+        for (usize i = 0; i < schema.columns.size(); i++) {
+            columns.push_back(i);
+            names.push_back(schema.columns[i].name);
+        }
+    } else {
+        for (const auto& it : selectColumns) {
+            auto columnIndex = findColumnIndex(schema, it.second);
+            if (!columnIndex.has_value())
+                throw runtimeError("unknown column");
+            columns.push_back(*columnIndex);
+            names.push_back(it.first);
+        }
+    }
+    return rowToJsonColumns(schema, pkBytes, rowBytes, columns, names);
+}
+
 string rowToJson(const TableSchema& schema, const byteVec& pkBytes, const byteVec& rowBytes, const std::vector<string>& selectColumns) {
     std::vector<std::pair<string, string>> mapped;
     mapped.reserve(selectColumns.size());
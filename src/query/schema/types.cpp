@@ -52,6 +52,26 @@ string columnTypeName(ColumnType t) {
     }
 }
 
+std::optional<CompactionStrategy> compactionStrategyFromName(const string& s) {
+    auto name = schema_detail::toLower(s);
+    if (name == "size_tiered" || name == "sizetiered" || name == "tiered")
+        return CompactionStrategy::SizeTiered;
+    if (name == "leveled")
+        return CompactionStrategy::Leveled;
+    return std::nullopt;
+}
+
+string compactionStrategyName(CompactionStrategy s) {
+    switch (s) {
+    case CompactionStrategy::SizeTiered:
+        return "size_tiered";
+    case CompactionStrategy::Leveled:
+        return "leveled";
+    default:
+        return "unknown";
+    }
+}
+
 std::optional<usize> findColumnIndex(const TableSchema& schema, const string& name) {
     for (usize i = 0; i < schema.columns.size(); i++) {
         if (schema.columns[i].name == name) {
@@ -80,6 +80,14 @@ bool literal(stringView s, usize& i, SqlLiteral& out) {
     std::string tmp;
     usize j = i;
 
+    if (consumeChar(s, j, '?')) {
+        i = j;
+        out.kind = SqlLiteral::Kind::Param;
+        out.text.clear();
+        return true;
+    }
+
+    j = i;
     if (matchKeyword(s, j, "null")) {
         i = j;
         out.kind = SqlLiteral::Kind::Null;
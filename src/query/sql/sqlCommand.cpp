@@ -82,6 +82,56 @@ static bool parseQualifiedName(stringView s, usize& i, string& outKeyspace, stri
     return true;
 }
 
+// WITH name = value [AND name = value ...]
+static bool parseTableOptions(stringView s, usize& i, TableOptions& out, string& error) {
+    usize j = i;
+    if (!matchKeyword(s, j, "with"))
+        return true;
+    i = j;
+    while (true) {
+        string name;
+        if (!requireIdentifier(s, i, name, error, "Expected option"))
+            return false;
+        if (!requireChar(s, i, '=', error, "Expected ="))
+            return false;
+        // Values may be quoted or bare: compaction = "leveled" or compaction = leveled.
+        SqlLiteral value;
+        if (!literal(s, i, value)) {
+            value.kind = SqlLiteral::Kind::Quoted;
+            if (!requireIdentifier(s, i, value.text, error, "Expected option value"))
+                return false;
+        }
+
+        string lowered;
+        for (char c : name)
+            lowered.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+        if (lowered == "compaction") {
+            auto strategy = compactionStrategyFromName(value.text);
+            if (!strategy.has_value()) {
+                error = "unknown compaction strategy";
+                return false;
+            }
+            out.compaction = *strategy;
+        } else if (lowered == "row_cache") {
+            // row_cache = <rows>, 0 to disable.
+            bool digits = value.kind == SqlLiteral::Kind::Number && !value.text.empty() && value.text.size() <= 18;
+            for (char c : value.text)
+                digits = digits && c >= '0' && c <= '9';
+            if (!digits) {
+                error = "row_cache expects a row count";
+                return false;
+            }
+            out.rowCacheRows = std::stoull(value.text);
+        } else {
+            error = "unknown table option";
+            return false;
+        }
+
+        if (!matchKeyword(s, i, "and"))
+            return true;
+    }
+}
+
 static bool tryParsePing(stringView s, usize& i, std::optional<SqlCommand>& out, string& error) {
     (void)error;
     usize j = i;
@@ -235,6 +285,10 @@ static bool tryParseCreate(stringView s, usize& i, std::optional<SqlCommand>& ou
         }
         schema.primaryKeyIndex = *col;
         cmd.schema = std::move(schema);
+        if (!parseTableOptions(s, i, cmd.options, error)) {
+            out.reset();
+            return true;
+        }
         out = cmd;
         return true;
     }
@@ -993,6 +1047,91 @@ static bool tryParseFlush(stringView s, usize& i, std::optional<SqlCommand>& out
     return true;
 }
 
+static bool tryParsePrepare(stringView s, usize& i, std::optional<SqlCommand>& out, string& error) {
+    usize j = i;
+    if (!matchKeyword(s, j, "prepare"))
+        return false;
+    i = j;
+
+    SqlPrepare cmd;
+    if (!requireIdentifier(s, i, cmd.name, error, "Expected statement name")) {
+        out.reset();
+        return true;
+    }
+    if (!requireKeyword(s, i, "as", error, "Expected AS")) {
+        out.reset();
+        return true;
+    }
+    skipWhitespace(s, i);
+    if (i >= s.size()) {
+        error = "Expected statement";
+        out.reset();
+        return true;
+    }
+    cmd.statement = string(s.substr(i));
+    i = s.size();
+    out = cmd;
+    return true;
+}
+
+static bool tryParseExecute(stringView s, usize& i, std::optional<SqlCommand>& out, string& error) {
+    usize j = i;
+    if (!matchKeyword(s, j, "execute"))
+        return false;
+    i = j;
+
+    SqlExecute cmd;
+    if (!requireIdentifier(s, i, cmd.name, error, "Expected statement name")) {
+        out.reset();
+        return true;
+    }
+    if (consumeChar(s, i, '(')) {
+        if (!consumeChar(s, i, ')')) {
+            while (true) {
+                SqlLiteral value;
+                if (!literal(s, i, value) || value.kind == SqlLiteral::Kind::Param) {
+                    error = "Expected value";
+                    out.reset();
+                    return true;
+                }
+                cmd.values.push_back(std::move(value));
+                if (consumeChar(s, i, ','))
+                    continue;
+                if (!requireChar(s, i, ')', error, "Expected )")) {
+                    out.reset();
+                    return true;
+                }
+                break;
+            }
+        }
+    }
+    if (!requireEof(s, i, error)) {
+        out.reset();
+        return true;
+    }
+    out = cmd;
+    return true;
+}
+
+static bool tryParseDeallocate(stringView s, usize& i, std::optional<SqlCommand>& out, string& error) {
+    usize j = i;
+    if (!matchKeyword(s, j, "deallocate"))
+        return false;
+    i = j;
+
+    SqlDeallocate cmd;
+    if (!requireIdentifier(s, i, cmd.name, error, "Expected statement name")) {
+        out.reset();
+        return true;
+    }
+    if (!requireEof(s, i, error)) {
+        out.reset();
+        return true;
+    }
+    out = cmd;
+    return true;
+}
+
 }
 
 std::optional<SqlCommand> sqlCommand(const string& rawLine, string& error) {
@@ -1034,9 +1173,39 @@ std::optional<SqlCommand> sqlCommand(const string& rawLine, string& error) {
         return out;
     if (tryParseFlush(s, i, out, error))
         return out;
+    if (tryParsePrepare(s, i, out, error))
+        return out;
+    if (tryParseExecute(s, i, out, error))
+        return out;
+    if (tryParseDeallocate(s, i, out, error))
+        return out;
 
     error = "unknown";
     return std::nullopt;
 }
 
+vector<SqlParamSlot> sqlParamSlots(SqlCommand& cmd) {
+    vector<SqlParamSlot> slots;
+    auto add = [&](SqlLiteral& value, const string& column) {
+        if (value.kind == SqlLiteral::Kind::Param)
+            slots.push_back({&value, &column});
+    };
+    if (auto* insert = std::get_if<SqlInsert>(&cmd)) {
+        for (auto& row : insert->rows) {
+            for (usize c = 0; c < row.size() && c < insert->columns.size(); c++)
+                add(row[c], insert->columns[c]);
+        }
+    } else if (auto* select = std::get_if<SqlSelect>(&cmd)) {
+        if (select->whereColumn.has_value() && select->whereValue.has_value())
+            add(*select->whereValue, *select->whereColumn);
+    } else if (auto* upd = std::get_if<SqlUpdate>(&cmd)) {
+        for (usize c = 0; c < upd->setValues.size() && c < upd->setColumns.size(); c++)
+            add(upd->setValues[c], upd->setColumns[c]);
+        add(upd->whereValue, upd->whereColumn);
+    } else if (auto* del = std::get_if<SqlDelete>(&cmd)) {
+        add(del->whereValue, del->whereColumn);
+    }
+    return slots;
+}
+
 }
@@ -0,0 +1,106 @@
+#include "storage/blockCache.h"
+
+namespace xeondb {
+
+// Rough bookkeeping cost of one entry (list node, map node, shared_ptr block).
+static constexpr u64 blockCacheEntryOverhead = 128;
+static constexpr u64 blockCacheMinShardBytes = 1024 * 1024;
+
+usize BlockCache::KeyHash::operator()(const Key& k) const {
+    u64 h = k.fileId * 0x9E3779B97F4A7C15ull ^ k.offset;
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 32;
+    return static_cast<usize>(h);
+}
+
+BlockCache::BlockCache(u64 capacityBytes, usize shardCount)
+    : capacityBytes_(capacityBytes)
+    , shardCapacity_(0)
+    , hits_(0)
+    , misses_(0)
+    , evictions_(0) {
+    // Small caches use fewer shards so each one still holds a useful number
+    // of blocks.
+    while (shardCount > 1 && capacityBytes / shardCount < blockCacheMinShardBytes)
+        shardCount /= 2;
+    if (shardCount == 0)
+        shardCount = 1;
+    shardCapacity_ = capacityBytes / shardCount;
+    shards_.reserve(shardCount);
+    for (usize i = 0; i < shardCount; i++)
+        shards_.push_back(std::make_unique<Shard>());
+}
+
+BlockCache::Shard& BlockCache::shardFor(const Key& key) {
+    // The low bits feed the shard's own hash table, so pick by the high ones.
+    usize h = KeyHash{}(key);
+    return *shards_[(h >> 40) % shards_.size()];
+}
+
+std::shared_ptr<const byteVec> BlockCache::lookup(u64 fileId, u64 offset) {
+    Key key{fileId, offset};
+    Shard& shard = shardFor(key);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.map.find(key);
+        if (it != shard.map.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return it->second->block;
+        }
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+}
+
+void BlockCache::insert(u64 fileId, u64 offset, std::shared_ptr<const byteVec> block) {
+    if (block == nullptr)
+        return;
+    u64 charge = static_cast<u64>(block->size()) + blockCacheEntryOverhead;
+    if (charge > shardCapacity_)
+        return;
+
+    Key key{fileId, offset};
+    Shard& shard = shardFor(key);
+    // Evicted blocks are released outside the lock.
+    std::vector<std::shared_ptr<const byteVec>> released;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto existing = shard.map.find(key);
+        if (existing != shard.map.end()) {
+            // Another reader loaded the same block first; keep theirs.
+            shard.lru.splice(shard.lru.begin(), shard.lru, existing->second);
+            return;
+        }
+        shard.lru.push_front(Entry{key, std::move(block), charge});
+        shard.map.emplace(key, shard.lru.begin());
+        shard.usedBytes += charge;
+        u64 evicted = 0;
+        while (shard.usedBytes > shardCapacity_) {
+            Entry& victim = shard.lru.back();
+            shard.usedBytes -= victim.charge;
+            shard.map.erase(victim.key);
+            released.push_back(std::move(victim.block));
+            shard.lru.pop_back();
+            evicted++;
+        }
+        if (evicted > 0)
+            evictions_.fetch_add(evicted, std::memory_order_relaxed);
+    }
+}
+
+BlockCacheStats BlockCache::stats() const {
+    BlockCacheStats s;
+    s.capacityBytes = capacityBytes_;
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        s.usedBytes += shard->usedBytes;
+    }
+    s.hits = hits_.load(std::memory_order_relaxed);
+    s.misses = misses_.load(std::memory_order_relaxed);
+    s.evictions = evictions_.load(std::memory_order_relaxed);
+    return s;
+}
+
+}
@@ -0,0 +1,78 @@
+#include "storage/bloomFilter.h"
+
+#include "util/binIo.h"
+#include "util/murmur3.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace xeondb {
+
+u64 BloomFilter::keyHash(const byteVec& key, u64& second) {
+    u64 first = 0;
+    murmur3Hash128(key.data(), key.size(), first, second);
+    return first;
+}
+
+BloomFilter BloomFilter::build(const std::vector<std::pair<u64, u64>>& keyHashes, usize bitsPerKey) {
+    BloomFilter filter;
+    if (bitsPerKey == 0 || keyHashes.empty())
+        return filter;
+
+    // k = bitsPerKey * ln(2) minimises the false positive rate.
+    auto k = static_cast<u32>(std::lround(static_cast<double>(bitsPerKey) * 0.69));
+    filter.hashCount_ = std::clamp<u32>(k, 1, 30);
+    filter.bitCount_ = std::max<u64>(64, static_cast<u64>(keyHashes.size()) * bitsPerKey);
+    filter.bits_.assign(static_cast<usize>((filter.bitCount_ + 7) / 8), 0);
+    for (const auto& h : keyHashes) {
+        u64 pos = h.first;
+        for (u32 i = 0; i < filter.hashCount_; i++) {
+            u64 bit = pos % filter.bitCount_;
+            filter.bits_[static_cast<usize>(bit / 8)] |= static_cast<u8>(1u << (bit % 8));
+            pos += h.second;
+        }
+    }
+    return filter;
+}
+
+bool BloomFilter::mayContain(const byteVec& key) const {
+    if (bitCount_ == 0)
+        return true;
+    u64 second = 0;
+    u64 pos = keyHash(key, second);
+    for (u32 i = 0; i < hashCount_; i++) {
+        u64 bit = pos % bitCount_;
+        if ((bits_[static_cast<usize>(bit / 8)] & static_cast<u8>(1u << (bit % 8))) == 0)
+            return false;
+        pos += second;
+    }
+    return true;
+}
+
+bool BloomFilter::empty() const {
+    return bitCount_ == 0;
+}
+
+void BloomFilter::write(std::ofstream& out) const {
+    writeU32(out, hashCount_);
+    writeU64(out, bitCount_);
+    writeBytes(out, bits_);
+}
+
+std::optional<BloomFilter> BloomFilter::decode(const u8* data, usize len) {
+    BloomFilter filter;
+    u32 byteLen = 0;
+    constexpr usize fixedLen = sizeof(filter.hashCount_) + sizeof(filter.bitCount_) + sizeof(byteLen);
+    if (len < fixedLen)
+        return std::nullopt;
+    std::memcpy(&filter.hashCount_, data, sizeof(filter.hashCount_));
+    std::memcpy(&filter.bitCount_, data + 4, sizeof(filter.bitCount_));
+    std::memcpy(&byteLen, data + 12, sizeof(byteLen));
+    if (len - fixedLen < byteLen || byteLen < (filter.bitCount_ + 7) / 8)
+        return std::nullopt;
+    filter.bits_.assign(data + fixedLen, data + fixedLen + byteLen);
+    return filter;
+}
+
+}
@@ -1,188 +1,1022 @@
 #include "storage/commitLog.h"
 
 #include "util/crc32.h"
+#include "util/log.h"
 
+#include <algorithm>
 #include <cerrno>
+#include <cstdio>
 #include <cstring>
 #include <fcntl.h>
+#include <limits>
+#include <mutex>
+#include <utility>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 namespace xeondb {
-static void writeAll(int fd, const void* p, usize n) {
+
+// magic, pad byte, version; v3 appends the u64 segment id.
+static constexpr usize legacyHeaderBytes = commitLogMagicLen + 1 + sizeof(u32);
+static constexpr usize segmentHeaderBytes = legacyHeaderBytes + sizeof(u64);
+// seq, key length, value length ... checksum; v4 adds a u16 stream length.
+static constexpr usize recordOverheadBytes = sizeof(u64) + sizeof(u32) * 3;
+static constexpr usize minSegmentBytes = 64 * 1024;
+// Retired segments kept for reuse; any beyond this are deleted.
+static constexpr usize maxRecycledSegments = 2;
+// Shared log: more live segments than this and the syncer asks the tables
+// pinning the oldest one to flush.
+static constexpr usize maxLiveSegments = 8;
+static constexpr u32 ringEntries = 64;
+// Batch buffers larger than this are written without registering them.
+static constexpr usize maxRegisteredBytes = 4 * 1024 * 1024;
+
+static void pwriteAll(int fd, const void* p, usize n, u64 offset) {
     const u8* buffer = static_cast<const u8*>(p);
-    usize offset = 0;
-    while (offset < n) {
-        ssize_t wrote = ::write(fd, buffer + offset, n - offset);
+    usize done = 0;
+    while (done < n) {
+        ssize_t wrote = ::pwrite(fd, buffer + done, n - done, static_cast<off_t>(offset + done));
         if (wrote < 0) {
             if (errno == EINTR) {
                 continue;
             }
             throw runtimeError("write failed");
         }
-        offset += static_cast<usize>(wrote);
+        done += static_cast<usize>(wrote);
     }
 }
 
-static bool readAllExact(int fd, void* p, usize n) {
-    u8* buffer = static_cast<u8*>(p);
-    usize offset = 0;
-    while (offset < n) {
-        ssize_t got = ::read(fd, buffer + offset, n - offset);
-        if (got == 0) {
-            return false;
-        }
-        if (got < 0) {
-            if (errno == EINTR) {
-                continue;
-            }
-            return false;
-        }
-        offset += static_cast<usize>(got);
+static void syncDir(const std::filesystem::path& dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return;
+    ::fsync(fd);
+    ::close(fd);
+}
+
+static std::filesystem::path segmentPath(const std::filesystem::path& dir, u64 id) {
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "wal-%06llu.log", static_cast<unsigned long long>(id));
+    return dir / buf;
+}
+
+// Mixed into every segment checksum; distinct for the first 2^32 segment ids.
+static u32 segmentTag(u64 id) {
+    return crc32(reinterpret_cast<const u8*>(&id), sizeof(id));
+}
+
+// In the key length slot, marks a batch record: the value length is then the
+// size of a body holding a u32 count and that many (u32 keyLen, u32 valLen,
+// key, value) entries, with seqs counting up from the record's seq. One
+// checksum covers the whole batch, so a torn one replays nothing.
+static constexpr u32 batchMarker = std::numeric_limits<u32>::max();
+static constexpr usize batchEntryOverheadBytes = sizeof(u32) * 2;
+
+static usize recordBytes(bool tagged, stringView stream, stringView key, const byteVec& value) {
+    return recordOverheadBytes + (tagged ? sizeof(u16) + stream.size() : 0) + key.size() + value.size();
+}
+
+static usize batchBodyBytes(const std::vector<CommitLog::BatchEntry>& entries) {
+    usize n = sizeof(u32);
+    for (const auto& e : entries)
+        n += batchEntryOverheadBytes + e.first.size() + e.second.size();
+    return n;
+}
+
+// Checksummed with tag 0; the caller mixes in the segment tag once the record
+// has a place in a segment.
+static void encodeRecord(bool tagged, stringView stream, u64 seq, stringView key, const byteVec& value, byteVec& buf) {
+    u32 keyLen = static_cast<u32>(key.size());
+    u32 valLen = static_cast<u32>(value.size());
+    usize start = buf.size();
+
+    auto appendBytes = [&](const void* p, usize n) {
+        const u8* bPtr = static_cast<const u8*>(p);
+        buf.insert(buf.end(), bPtr, bPtr + n);
+    };
+
+    appendBytes(&seq, sizeof(seq));
+    appendBytes(&keyLen, sizeof(keyLen));
+    appendBytes(&valLen, sizeof(valLen));
+    if (tagged) {
+        u16 streamLen = static_cast<u16>(stream.size());
+        appendBytes(&streamLen, sizeof(streamLen));
+        appendBytes(stream.data(), stream.size());
     }
-    return true;
+    appendBytes(key.data(), key.size());
+    if (!value.empty()) {
+        appendBytes(value.data(), value.size());
+    }
+
+    u32 checksum = crc32c(buf.data() + start, buf.size() - start);
+    appendBytes(&checksum, sizeof(checksum));
+}
+
+static void encodeBatch(bool tagged, stringView stream, u64 firstSeq, const std::vector<CommitLog::BatchEntry>& entries, byteVec& buf) {
+    u32 marker = batchMarker;
+    u32 bodyLen = static_cast<u32>(batchBodyBytes(entries));
+    u32 count = static_cast<u32>(entries.size());
+    usize start = buf.size();
+
+    auto appendBytes = [&](const void* p, usize n) {
+        const u8* bPtr = static_cast<const u8*>(p);
+        buf.insert(buf.end(), bPtr, bPtr + n);
+    };
+
+    appendBytes(&firstSeq, sizeof(firstSeq));
+    appendBytes(&marker, sizeof(marker));
+    appendBytes(&bodyLen, sizeof(bodyLen));
+    if (tagged) {
+        u16 streamLen = static_cast<u16>(stream.size());
+        appendBytes(&streamLen, sizeof(streamLen));
+        appendBytes(stream.data(), stream.size());
+    }
+    appendBytes(&count, sizeof(count));
+    for (const auto& [key, value] : entries) {
+        u32 keyLen = static_cast<u32>(key.size());
+        u32 valLen = static_cast<u32>(value.size());
+        appendBytes(&keyLen, sizeof(keyLen));
+        appendBytes(&valLen, sizeof(valLen));
+        appendBytes(key.data(), key.size());
+        if (!value.empty())
+            appendBytes(value.data(), value.size());
+    }
+
+    u32 checksum = crc32c(buf.data() + start, buf.size() - start);
+    appendBytes(&checksum, sizeof(checksum));
 }
 
-static void writeHeader(int fd) {
-    writeAll(fd, commitLogMagic, commitLogMagicLen);
-    u8 pad = 0;
-    writeAll(fd, &pad, 1);
-    u32 ver = commitLogVersion;
-    writeAll(fd, &ver, sizeof(ver));
+static void tagRecords(byteVec& buf, u32 tag) {
+    u32 checksum = 0;
+    std::memcpy(&checksum, buf.data() + buf.size() - sizeof(checksum), sizeof(checksum));
+    checksum ^= tag;
+    std::memcpy(buf.data() + buf.size() - sizeof(checksum), &checksum, sizeof(checksum));
 }
 
-static bool validateHeader(int fd) {
-    if (::lseek(fd, 0, SEEK_SET) < 0) {
-        return false;
+static bool isSegmentVersion(u32 version) {
+    return version == commitLogVersion || version == commitLogSharedVersion || version == commitLogCrc32Version ||
+        version == commitLogSharedCrc32Version;
+}
+
+static bool isSharedVersion(u32 version) {
+    return version == commitLogSharedVersion || version == commitLogSharedCrc32Version;
+}
+
+static bool isCrc32cVersion(u32 version) {
+    return version == commitLogVersion || version == commitLogSharedVersion;
+}
+
+// A log mapped read-only, so replay validates records in place and only
+// touches the pages records were written to.
+struct LogFile {
+    std::filesystem::path file;
+    u32 version = 0;
+    u64 id = 0;
+    const u8* data = nullptr;
+    usize size = 0;
+
+    LogFile() = default;
+    LogFile(const LogFile&) = delete;
+    LogFile& operator=(const LogFile&) = delete;
+    LogFile(LogFile&& other) noexcept {
+        *this = std::move(other);
     }
-    char magic[commitLogMagicLen]{};
-    u8 pad = 0;
-    u32 ver = 0;
-    if (!readAllExact(fd, magic, commitLogMagicLen))
-        return false;
-    if (!readAllExact(fd, &pad, 1))
+    LogFile& operator=(LogFile&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            file = std::move(other.file);
+            version = other.version;
+            id = other.id;
+            data = std::exchange(other.data, nullptr);
+            size = std::exchange(other.size, 0);
+        }
+        return *this;
+    }
+    ~LogFile() {
+        unmap();
+    }
+
+    void unmap() {
+        if (data != nullptr)
+            ::munmap(const_cast<u8*>(data), size);
+        data = nullptr;
+        size = 0;
+    }
+};
+
+static bool readLogFile(const std::filesystem::path& file, LogFile& out) {
+    out.unmap();
+    out.file = file;
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
         return false;
-    if (!readAllExact(fd, &ver, sizeof(ver)))
+    struct stat st {};
+    if (::fstat(fd, &st) != 0 || static_cast<usize>(st.st_size) < legacyHeaderBytes) {
+        ::close(fd);
         return false;
-    if (std::memcmp(magic, commitLogMagic, commitLogMagicLen) != 0)
+    }
+    void* mapped = ::mmap(nullptr, static_cast<usize>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
         return false;
-    if (pad != 0)
+    out.data = static_cast<const u8*>(mapped);
+    out.size = static_cast<usize>(st.st_size);
+    // Records are read front to back, once.
+    (void)::madvise(mapped, out.size, MADV_SEQUENTIAL);
+
+    if (std::memcmp(out.data, commitLogMagic, commitLogMagicLen) != 0 || out.data[commitLogMagicLen] != 0)
         return false;
-    return ver == commitLogVersion;
+    std::memcpy(&out.version, out.data + commitLogMagicLen + 1, sizeof(u32));
+    if (isSegmentVersion(out.version)) {
+        if (out.size < segmentHeaderBytes)
+            return false;
+        std::memcpy(&out.id, out.data + legacyHeaderBytes, sizeof(u64));
+        return true;
+    }
+    return out.version == commitLogLegacyVersion;
+}
+
+// Replays the valid prefix of a log, noting the highest seq of each stream.
+static void replayLogFile(const LogFile& log, const CommitLog::ReplayFn& replay, CommitLog::StreamSeqs& maxSeqs) {
+    const bool segmented = isSegmentVersion(log.version);
+    const bool tagged = isSharedVersion(log.version);
+    const auto checksum = isCrc32cVersion(log.version) ? &crc32c : &crc32;
+    const u32 tag = segmented ? segmentTag(log.id) : 0;
+    const usize headBytes = sizeof(u64) + sizeof(u32) * 2 + (tagged ? sizeof(u16) : 0);
+    const usize overheadBytes = headBytes + sizeof(u32);
+    const u8* d = log.data;
+    const usize size = log.size;
+    usize off = segmented ? segmentHeaderBytes : legacyHeaderBytes;
+    while (size - off >= overheadBytes) {
+        u64 seq = 0;
+        u32 keyLen = 0;
+        u32 valLen = 0;
+        u16 streamLen = 0;
+        std::memcpy(&seq, d + off, sizeof(seq));
+        std::memcpy(&keyLen, d + off + 8, sizeof(keyLen));
+        std::memcpy(&valLen, d + off + 12, sizeof(valLen));
+        if (tagged)
+            std::memcpy(&streamLen, d + off + 16, sizeof(streamLen));
+        const bool batch = keyLen == batchMarker;
+        usize bodyBytes = static_cast<usize>(streamLen) + (batch ? 0 : keyLen) + valLen;
+        if (bodyBytes > size - off - overheadBytes)
+            break;
+        usize checked = headBytes + bodyBytes;
+        u32 stored = 0;
+        std::memcpy(&stored, d + off + checked, sizeof(stored));
+        // Preallocated space reads as zeros, recycled space as another segment's records.
+        if (seq == 0 || (checksum(d + off, checked) ^ tag) != stored)
+            break;
+
+        const u8* p = d + off + headBytes;
+        const u8* end = d + off + checked;
+        stringView stream(reinterpret_cast<const char*>(p), streamLen);
+        p += streamLen;
+        u64 lastSeq = seq;
+        if (batch) {
+            // Checked in full before any entry replays.
+            u32 count = 0;
+            if (static_cast<usize>(end - p) < sizeof(count))
+                break;
+            std::memcpy(&count, p, sizeof(count));
+            const u8* q = p + sizeof(count);
+            u32 parsed = 0;
+            for (; parsed < count; parsed++) {
+                u32 entryKeyLen = 0;
+                u32 entryValLen = 0;
+                if (static_cast<usize>(end - q) < batchEntryOverheadBytes)
+                    break;
+                std::memcpy(&entryKeyLen, q, sizeof(entryKeyLen));
+                std::memcpy(&entryValLen, q + 4, sizeof(entryValLen));
+                if (static_cast<usize>(entryKeyLen) + entryValLen > static_cast<usize>(end - q) - batchEntryOverheadBytes)
+                    break;
+                q += batchEntryOverheadBytes + entryKeyLen + entryValLen;
+            }
+            if (count == 0 || parsed != count || q != end)
+                break;
+            lastSeq = seq + count - 1;
+        }
+        auto it = maxSeqs.find(stream);
+        if (it == maxSeqs.end())
+            maxSeqs.emplace(std::string(stream), lastSeq);
+        else if (lastSeq > it->second)
+            it->second = lastSeq;
+        if (replay && batch) {
+            p += sizeof(u32);
+            for (u64 s = seq; s <= lastSeq; s++) {
+                u32 entryKeyLen = 0;
+                u32 entryValLen = 0;
+                std::memcpy(&entryKeyLen, p, sizeof(entryKeyLen));
+                std::memcpy(&entryValLen, p + 4, sizeof(entryValLen));
+                p += batchEntryOverheadBytes;
+                std::string key(reinterpret_cast<const char*>(p), entryKeyLen);
+                byteVec value(p + entryKeyLen, p + entryKeyLen + entryValLen);
+                p += entryKeyLen + entryValLen;
+                replay(stream, s, key, value);
+            }
+        } else if (replay) {
+            std::string key(reinterpret_cast<const char*>(p), keyLen);
+            byteVec value(p + keyLen, end);
+            replay(stream, seq, key, value);
+        }
+        off += checked + sizeof(stored);
+    }
+}
+
+WalSyncMode walSyncModeFromName(stringView name) {
+    if (name == "always")
+        return WalSyncMode::Always;
+    if (name == "group")
+        return WalSyncMode::Group;
+    return WalSyncMode::Periodic;
 }
 
-CommitLog::CommitLog()
-    : fileDesc(-1)
+WalIoBackend walIoBackendFromName(stringView name) {
+    return name == "io_uring" ? WalIoBackend::IoUring : WalIoBackend::Pwrite;
+}
+
+CommitLog::CommitLog(bool shared, WalIoBackend backend)
+    : shared_(shared)
+    , segmentBytes_(0)
+    , writeOffset_(0)
+    , spareAsked_(false)
+    , fileDesc(-1)
     , bytesSinceFsync_(0)
-    , logDirty(false) {
+    , logDirty(false)
+    , nextSegmentId_(1)
+    , isOpen_(false)
+    , spareFd_(-1)
+    , pendingOffset_(0)
+    , appendedTicket_(0)
+    , durableTicket_(0)
+    , syncFailed_(false)
+    , syncerStop_(false)
+    , spareWanted_(false)
+    , pressureWanted_(false)
+    , mode_(WalSyncMode::Periodic)
+    , interval_(50)
+    , thresholdBytes_(0)
+    , fsyncs_(0)
+    , fsyncBytes_(0)
+    , fsyncMicrosTotal_(0)
+    , fsyncMicrosMax_(0) {
+    if (backend == WalIoBackend::IoUring) {
+        ring_ = std::make_unique<IoUring>();
+        if (!ring_->init(ringEntries)) {
+            ring_.reset();
+            static std::once_flag warned;
+            std::call_once(warned, []() {
+                xeondb::log(LogLevel::WARN, "io_uring unavailable; WAL uses pwrite");
+            });
+        }
+    }
 }
 
 CommitLog::~CommitLog() {
     close();
 }
 
-void CommitLog::openOrCreate(const std::filesystem::path& path, bool truncate) {
+bool CommitLog::shared() const {
+    return shared_;
+}
+
+void CommitLog::open(const std::filesystem::path& dir, usize segmentBytes, const ReplayFn& replay) {
     close();
-    path_ = path;
-    int flags = O_CREAT | O_RDWR | O_APPEND;
-    if (truncate)
-        flags = O_CREAT | O_RDWR | O_TRUNC | O_APPEND;
-    fileDesc = ::open(path_.c_str(), flags, 0644);
-    if (fileDesc < 0) {
-        throw runtimeError("cannot open commitlog");
-    }
-    if (truncate) {
-        writeHeader(fileDesc);
-    } else {
-        struct stat st{};
-        if (::fstat(fileDesc, &st) == 0) {
-            if (st.st_size == 0) {
-                writeHeader(fileDesc);
-            } else {
-                if (!validateHeader(fileDesc)) {
-                    ::close(fileDesc);
-                    fileDesc = ::open(path_.c_str(), O_CREAT | O_RDWR | O_TRUNC | O_APPEND, 0644);
-                    if (fileDesc < 0) {
-                        throw runtimeError("cannot open commitlog");
-                    }
-                    writeHeader(fileDesc);
-                }
+    std::lock_guard<std::mutex> lock(appendMutex_);
+    dir_ = dir;
+    segmentBytes_ = std::max(segmentBytes, minSegmentBytes);
+    closed_.clear();
+    flushedSeqs_.clear();
+    forgotten_.clear();
+    spareAsked_ = false;
+    // Segments written before the CRC32C switch replay too.
+    auto ours = [this](u32 version) {
+        return isSegmentVersion(version) && isSharedVersion(version) == shared_;
+    };
+
+    // v2 logs first (sealed generations, then the active one), then segments
+    // by the id in their header, which is also seq order.
+    std::vector<std::pair<u64, std::filesystem::path>> legacy;
+    std::vector<LogFile> logs;
+    u64 nextId = 1;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir_, ec)) {
+        if (ec)
+            break;
+        if (!entry.is_regular_file())
+            continue;
+        auto name = entry.path().filename().string();
+        unsigned long long n = 0;
+        // The shared log never had a v2 layout.
+        if (!shared_ && name == "commitlog.bin") {
+            legacy.push_back({~0ull, entry.path()});
+        } else if (!shared_ && std::sscanf(name.c_str(), "commitlog-%llu.bin", &n) == 1) {
+            legacy.push_back({n, entry.path()});
+        } else if (std::sscanf(name.c_str(), "wal-%llu.log", &n) == 1) {
+            nextId = std::max<u64>(nextId, n + 1);
+            LogFile log;
+            if (!readLogFile(entry.path(), log) || !ours(log.version)) {
+                log.version = 0;
+                log.unmap();
             }
+            logs.push_back(std::move(log));
         }
     }
+    std::sort(legacy.begin(), legacy.end());
+    std::sort(logs.begin(), logs.end(), [](const LogFile& a, const LogFile& b) {
+        return a.id < b.id;
+    });
+    for (const auto& l : legacy) {
+        LogFile log;
+        Segment seg{0, l.second, {}};
+        if (readLogFile(l.second, log))
+            replayLogFile(log, replay, seg.maxSeqs);
+        closed_.push_back(std::move(seg));
+    }
+    for (auto& log : logs) {
+        Segment seg{log.id, log.file, {}};
+        if (ours(log.version))
+            replayLogFile(log, replay, seg.maxSeqs);
+        log.unmap();
+        nextId = std::max(nextId, log.id + 1);
+        closed_.push_back(std::move(seg));
+    }
+
+    active_ = Segment{};
+    {
+        std::lock_guard<std::mutex> prep(prepareMutex_);
+        nextSegmentId_ = nextId;
+        active_.id = nextSegmentId_++;
+    }
+    int fd = createSegment(active_.id, active_.file);
+    {
+        std::lock_guard<std::mutex> io(ioMutex_);
+        fileDesc = fd;
+    }
+    writeOffset_ = segmentHeaderBytes;
+    {
+        std::lock_guard<std::mutex> spare(spareMutex_);
+        isOpen_ = true;
+    }
+    {
+        std::lock_guard<std::mutex> group(groupMutex_);
+        syncFailed_ = false;
+        spareWanted_ = false;
+        pressureWanted_ = false;
+    }
     bytesSinceFsync_ = 0;
     logDirty = false;
+    // Unreadable segments pin nothing.
+    retireLocked();
+}
+
+int CommitLog::createSegment(u64 id, std::filesystem::path& file) {
+    file = segmentPath(dir_, id);
+    std::filesystem::path reuse;
+    {
+        std::lock_guard<std::mutex> lock(spareMutex_);
+        if (!recyclable_.empty()) {
+            reuse = recyclable_.back();
+            recyclable_.pop_back();
+        }
+    }
+    int fd = -1;
+    if (!reuse.empty()) {
+        std::error_code ec;
+        std::filesystem::rename(reuse, file, ec);
+        if (!ec)
+            fd = ::open(file.c_str(), O_RDWR, 0644);
+    }
+    if (fd < 0)
+        fd = ::open(file.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw runtimeError("cannot open commitlog");
+    }
+    // Filesystems without fallocate simply grow the file as records land.
+    (void)::fallocate(fd, 0, 0, static_cast<off_t>(segmentBytes_));
+
+    u8 header[segmentHeaderBytes]{};
+    std::memcpy(header, commitLogMagic, commitLogMagicLen);
+    u32 ver = shared_ ? commitLogSharedVersion : commitLogVersion;
+    std::memcpy(header + commitLogMagicLen + 1, &ver, sizeof(ver));
+    std::memcpy(header + legacyHeaderBytes, &id, sizeof(id));
+    try {
+        pwriteAll(fd, header, sizeof(header), 0);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    if (::fdatasync(fd) != 0) {
+        ::close(fd);
+        throw runtimeError("fsync failed");
+    }
+    syncDir(dir_);
+    return fd;
 }
 
-void CommitLog::append(u64 seq, stringView key, const byteVec& value) {
+void CommitLog::prepareSpare() {
+    std::lock_guard<std::mutex> prep(prepareMutex_);
+    {
+        std::lock_guard<std::mutex> lock(spareMutex_);
+        if (!isOpen_ || spareFd_ >= 0)
+            return;
+    }
+    Segment next;
+    next.id = nextSegmentId_++;
+    int fd = createSegment(next.id, next.file);
+    std::lock_guard<std::mutex> lock(spareMutex_);
+    spareFd_ = fd;
+    spare_ = std::move(next);
+}
+
+void CommitLog::rollLocked() {
+    Segment next;
+    int fd = -1;
+    {
+        std::lock_guard<std::mutex> prep(prepareMutex_);
+        {
+            std::lock_guard<std::mutex> lock(spareMutex_);
+            if (spareFd_ >= 0) {
+                fd = spareFd_;
+                next = std::move(spare_);
+                spareFd_ = -1;
+            }
+        }
+        // Only when the syncer has not caught up yet.
+        if (fd < 0) {
+            next.id = nextSegmentId_++;
+            fd = createSegment(next.id, next.file);
+        }
+    }
+
+    std::lock_guard<std::mutex> io(ioMutex_);
+    {
+        // Buffered group-commit records belong to the old segment; its fd is
+        // synced by the next fsyncNow, which also resolves their tickets.
+        std::lock_guard<std::mutex> lock(groupMutex_);
+        if (!pending_.empty()) {
+            pwriteAll(fileDesc, pending_.data(), pending_.size(), pendingOffset_);
+            pending_.clear();
+        }
+        if (shared_ && closed_.size() + 1 > maxLiveSegments) {
+            pressureWanted_ = true;
+            syncerCv_.notify_one();
+        }
+    }
+    unsyncedFds_.push_back(fileDesc);
+    closed_.push_back(std::move(active_));
+    active_ = std::move(next);
+    fileDesc = fd;
+    writeOffset_ = segmentHeaderBytes;
+    spareAsked_ = false;
+}
+
+void CommitLog::reserveLocked(usize recordBytes, stringView stream, u64 seq) {
+    if (writeOffset_ > segmentHeaderBytes && writeOffset_ + recordBytes > segmentBytes_)
+        rollLocked();
+    auto it = active_.maxSeqs.find(stream);
+    if (it == active_.maxSeqs.end())
+        active_.maxSeqs.emplace(std::string(stream), seq);
+    else if (seq > it->second)
+        it->second = seq;
+    // Only once the active segment is half full, so idle logs hold one segment.
+    if (!spareAsked_ && writeOffset_ + recordBytes >= segmentBytes_ / 2) {
+        spareAsked_ = true;
+        std::lock_guard<std::mutex> lock(groupMutex_);
+        spareWanted_ = true;
+        syncerCv_.notify_one();
+    }
+}
+
+void CommitLog::retireLocked() {
+    for (auto it = closed_.begin(); it != closed_.end();) {
+        bool pinned = false;
+        for (const auto& [stream, maxSeq] : it->maxSeqs) {
+            if (forgotten_.find(stream) != forgotten_.end())
+                continue;
+            auto flushed = flushedSeqs_.find(stream);
+            if (flushed == flushedSeqs_.end() || flushed->second < maxSeq) {
+                pinned = true;
+                break;
+            }
+        }
+        if (pinned) {
+            ++it;
+            continue;
+        }
+        // v2 logs (id 0) are not reused; only segments keep their wal- name.
+        std::lock_guard<std::mutex> lock(spareMutex_);
+        if (it->id != 0 && recyclable_.size() < maxRecycledSegments) {
+            recyclable_.push_back(it->file);
+        } else {
+            std::error_code ec;
+            std::filesystem::remove(it->file, ec);
+        }
+        it = closed_.erase(it);
+    }
+}
+
+void CommitLog::releaseThrough(stringView stream, u64 flushedSeq) {
+    std::lock_guard<std::mutex> lock(appendMutex_);
+    auto it = flushedSeqs_.find(stream);
+    if (it == flushedSeqs_.end())
+        flushedSeqs_.emplace(std::string(stream), flushedSeq);
+    else if (flushedSeq > it->second)
+        it->second = flushedSeq;
+    retireLocked();
+}
+
+void CommitLog::forgetStream(stringView stream) {
+    std::lock_guard<std::mutex> lock(appendMutex_);
+    forgotten_.emplace(stream);
+    auto it = flushedSeqs_.find(stream);
+    if (it != flushedSeqs_.end())
+        flushedSeqs_.erase(it);
+    retireLocked();
+}
+
+std::vector<std::string> CommitLog::streams() const {
+    std::lock_guard<std::mutex> lock(appendMutex_);
+    std::unordered_set<std::string, StreamHash, std::equal_to<>> seen;
+    auto collect = [&](const Segment& seg) {
+        for (const auto& kv : seg.maxSeqs) {
+            if (forgotten_.find(kv.first) == forgotten_.end())
+                seen.insert(kv.first);
+        }
+    };
+    for (const auto& seg : closed_)
+        collect(seg);
+    collect(active_);
+    return std::vector<std::string>(seen.begin(), seen.end());
+}
+
+std::vector<std::string> CommitLog::pinningStreams() {
+    std::lock_guard<std::mutex> lock(appendMutex_);
+    retireLocked();
+    std::vector<std::string> out;
+    if (closed_.size() <= maxLiveSegments)
+        return out;
+    for (const auto& [stream, maxSeq] : closed_.front().maxSeqs) {
+        if (forgotten_.find(stream) != forgotten_.end())
+            continue;
+        auto flushed = flushedSeqs_.find(stream);
+        if (flushed == flushedSeqs_.end() || flushed->second < maxSeq)
+            out.push_back(stream);
+    }
+    return out;
+}
+
+void CommitLog::append(stringView stream, u64 seq, stringView key, const byteVec& value) {
+    byteVec buf;
+    buf.reserve(recordBytes(shared_, stream, key, value));
+    encodeRecord(shared_, stream, seq, key, value, buf);
+    std::lock_guard<std::mutex> lock(appendMutex_);
+    writeLocked(buf, stream, seq);
+}
+
+void CommitLog::appendBatch(stringView stream, u64 firstSeq, const std::vector<BatchEntry>& entries) {
+    if (entries.empty())
+        return;
+    byteVec buf;
+    buf.reserve(recordOverheadBytes + sizeof(u16) + stream.size() + batchBodyBytes(entries));
+    encodeBatch(shared_, stream, firstSeq, entries, buf);
+    std::lock_guard<std::mutex> lock(appendMutex_);
+    writeLocked(buf, stream, firstSeq + entries.size() - 1);
+}
+
+void CommitLog::writeLocked(byteVec& buf, stringView stream, u64 lastSeq) {
     if (fileDesc < 0) {
         throw runtimeError("commitlog not open");
     }
+    usize size = buf.size();
+    reserveLocked(size, stream, lastSeq);
+    tagRecords(buf, segmentTag(active_.id));
+    pwriteAll(fileDesc, buf.data(), buf.size(), writeOffset_);
+    writeOffset_ += size;
+    usize unsynced = bytesSinceFsync_.fetch_add(size) + size;
+    logDirty = true;
+    usize threshold = thresholdBytes_.load(std::memory_order_relaxed);
+    if (threshold > 0 && unsynced >= threshold && unsynced - size < threshold) {
+        std::lock_guard<std::mutex> group(groupMutex_);
+        syncerCv_.notify_one();
+    }
+}
 
-    u32 keyLen = static_cast<u32>(key.size());
-    u32 valLen = static_cast<u32>(value.size());
+u64 CommitLog::appendGrouped(stringView stream, u64 seq, stringView key, const byteVec& value) {
+    byteVec buf;
+    buf.reserve(recordBytes(shared_, stream, key, value));
+    encodeRecord(shared_, stream, seq, key, value, buf);
+    return bufferGrouped(buf, stream, seq);
+}
 
+u64 CommitLog::appendBatchGrouped(stringView stream, u64 firstSeq, const std::vector<BatchEntry>& entries) {
+    if (entries.empty())
+        return 0;
     byteVec buf;
-    buf.reserve(sizeof(seq) + sizeof(keyLen) + sizeof(valLen) + key.size() + value.size());
+    buf.reserve(recordOverheadBytes + sizeof(u16) + stream.size() + batchBodyBytes(entries));
+    encodeBatch(shared_, stream, firstSeq, entries, buf);
+    return bufferGrouped(buf, stream, firstSeq + entries.size() - 1);
+}
 
-    auto appendBytes = [&](const void* p, usize n) {
-        const u8* bPtr = static_cast<const u8*>(p);
-        buf.insert(buf.end(), bPtr, bPtr + n);
-    };
+u64 CommitLog::bufferGrouped(byteVec& buf, stringView stream, u64 lastSeq) {
+    {
+        std::lock_guard<std::mutex> lock(groupMutex_);
+        if (syncFailed_)
+            throw runtimeError("fsync failed");
+    }
+    std::lock_guard<std::mutex> lock(appendMutex_);
+    if (fileDesc < 0) {
+        throw runtimeError("commitlog not open");
+    }
+    usize size = buf.size();
+    reserveLocked(size, stream, lastSeq);
+    tagRecords(buf, segmentTag(active_.id));
 
-    appendBytes(&seq, sizeof(seq));
-    appendBytes(&keyLen, sizeof(keyLen));
-    appendBytes(&valLen, sizeof(valLen));
-    appendBytes(key.data(), key.size());
-    if (!value.empty()) {
-        appendBytes(value.data(), value.size());
+    std::lock_guard<std::mutex> group(groupMutex_);
+    if (pending_.empty())
+        pendingOffset_ = writeOffset_;
+    pending_.insert(pending_.end(), buf.begin(), buf.end());
+    writeOffset_ += size;
+    bytesSinceFsync_ += size;
+    logDirty = true;
+    u64 ticket = ++appendedTicket_;
+    syncerCv_.notify_one();
+    return ticket;
+}
+
+void CommitLog::waitDurable(u64 ticket) {
+    std::unique_lock<std::mutex> lock(groupMutex_);
+    durableCv_.wait(lock, [&]() {
+        return durableTicket_ >= ticket || syncFailed_;
+    });
+    if (durableTicket_ < ticket)
+        throw runtimeError("fsync failed");
+}
+
+void CommitLog::startSyncer(WalSyncMode mode, std::chrono::milliseconds interval, usize thresholdBytes) {
+    stopSyncer();
+    {
+        std::lock_guard<std::mutex> lock(groupMutex_);
+        mode_ = mode;
+        interval_ = interval;
+        syncerStop_ = false;
+    }
+    thresholdBytes_.store(mode == WalSyncMode::Periodic ? thresholdBytes : 0, std::memory_order_relaxed);
+    syncer_ = std::thread([this]() {
+        syncerMain();
+    });
+}
+
+void CommitLog::stopSyncer() {
+    {
+        std::lock_guard<std::mutex> lock(groupMutex_);
+        syncerStop_ = true;
+        syncerCv_.notify_all();
     }
+    if (syncer_.joinable())
+        syncer_.join();
+}
 
-    u32 checksum = crc32(buf.data(), buf.size());
-    appendBytes(&checksum, sizeof(checksum));
+void CommitLog::setPressureHandler(PressureFn fn) {
+    std::lock_guard<std::mutex> lock(groupMutex_);
+    pressure_ = std::move(fn);
+}
 
-    writeAll(fileDesc, buf.data(), buf.size());
-    bytesSinceFsync_ += buf.size();
-    logDirty = true;
+void CommitLog::syncerMain() {
+    using clock = std::chrono::steady_clock;
+    std::unique_lock<std::mutex> lock(groupMutex_);
+    auto deadline = clock::now() + interval_;
+    auto overThreshold = [&]() {
+        usize threshold = thresholdBytes_.load(std::memory_order_relaxed);
+        return threshold > 0 && bytesSinceFsync_.load() >= threshold;
+    };
+    auto batchWaiting = [&]() {
+        // Tickets, not pending_: a segment roll may already have written the batch.
+        return appendedTicket_ > durableTicket_ && !syncFailed_;
+    };
+    auto due = [&]() {
+        if (syncerStop_ || spareWanted_ || pressureWanted_)
+            return true;
+        if (mode_ == WalSyncMode::Group)
+            return batchWaiting();
+        return mode_ == WalSyncMode::Periodic && overThreshold();
+    };
+    for (;;) {
+        if (mode_ == WalSyncMode::Periodic)
+            syncerCv_.wait_until(lock, deadline, due);
+        else
+            syncerCv_.wait(lock, due);
+        if (syncerStop_)
+            return;
+
+        bool sync = false;
+        if (mode_ == WalSyncMode::Group) {
+            sync = batchWaiting();
+        } else if (mode_ == WalSyncMode::Periodic && (clock::now() >= deadline || overThreshold())) {
+            sync = logDirty.load();
+            deadline = clock::now() + interval_;
+        }
+        bool spare = spareWanted_;
+        bool pressure = pressureWanted_;
+        spareWanted_ = false;
+        pressureWanted_ = false;
+        PressureFn onPressure = pressure ? pressure_ : nullptr;
+        lock.unlock();
+
+        // Failures reach writers through syncFailed_ (group) or the next sync.
+        if (sync) {
+            try {
+                fsyncNow();
+            } catch (...) {
+            }
+        }
+        // Keeps the next segment ready so writers never create one inline.
+        if (spare) {
+            try {
+                prepareSpare();
+            } catch (const std::exception& e) {
+                xeondb::log(LogLevel::ERROR, std::string("WAL segment prepare failed dir=") + dir_.string() + " err=" + e.what());
+            }
+        }
+        if (onPressure) {
+            auto pinning = pinningStreams();
+            if (!pinning.empty()) {
+                try {
+                    onPressure(pinning);
+                } catch (const std::exception& e) {
+                    xeondb::log(LogLevel::ERROR, std::string("WAL flush request failed err=") + e.what());
+                }
+            }
+        }
+        lock.lock();
+    }
 }
 
 void CommitLog::fsyncNow() {
-    if (fileDesc < 0) {
-        return;
+    std::lock_guard<std::mutex> io(ioMutex_);
+    // Records buffered while the previous batch was syncing all go out together.
+    u64 batchOffset = 0;
+    u64 through = 0;
+    usize covered = 0;
+    const u8* pendingData = nullptr;
+    usize pendingCapacity = 0;
+    {
+        std::lock_guard<std::mutex> lock(groupMutex_);
+        batch_.clear();
+        batch_.swap(pending_);
+        batchOffset = pendingOffset_;
+        through = appendedTicket_;
+        covered = bytesSinceFsync_.load();
+        pendingData = pending_.data();
+        pendingCapacity = pending_.capacity();
+    }
+    if (fileDesc >= 0) {
+        try {
+            auto start = std::chrono::steady_clock::now();
+            if (ring_ == nullptr || !syncWithRing(batchOffset, pendingData, pendingCapacity))
+                syncWithPwrite(batchOffset);
+            u64 micros = static_cast<u64>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+            fsyncs_.fetch_add(1, std::memory_order_relaxed);
+            fsyncBytes_.fetch_add(covered, std::memory_order_relaxed);
+            fsyncMicrosTotal_.fetch_add(micros, std::memory_order_relaxed);
+            u64 prevMax = fsyncMicrosMax_.load(std::memory_order_relaxed);
+            while (micros > prevMax && !fsyncMicrosMax_.compare_exchange_weak(prevMax, micros, std::memory_order_relaxed)) {
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(groupMutex_);
+            syncFailed_ = true;
+            durableCv_.notify_all();
+            throw;
+        }
+        // Bytes appended while fsync ran may not be covered; leave them counted.
+        if (bytesSinceFsync_.fetch_sub(covered) == covered)
+            logDirty = false;
+    }
+    std::lock_guard<std::mutex> lock(groupMutex_);
+    durableTicket_ = through;
+    durableCv_.notify_all();
+}
+
+void CommitLog::syncWithPwrite(u64 batchOffset) {
+    if (!batch_.empty())
+        pwriteAll(fileDesc, batch_.data(), batch_.size(), batchOffset);
+    while (!unsyncedFds_.empty()) {
+        if (::fdatasync(unsyncedFds_.back()) != 0) {
+            throw runtimeError("fsync failed");
+        }
+        ::close(unsyncedFds_.back());
+        unsyncedFds_.pop_back();
     }
-    if (::fsync(fileDesc) != 0) {
+    // Segments are preallocated, so only data needs to reach the disk.
+    if (::fdatasync(fileDesc) != 0) {
         throw runtimeError("fsync failed");
     }
-    bytesSinceFsync_ = 0;
-    logDirty = false;
+}
+
+// The batch write and every pending fdatasync go out as one linked chain: one
+// syscall, and no sync runs unless the write before it landed.
+bool CommitLog::syncWithRing(u64 batchOffset, const u8* pendingData, usize pendingCapacity) {
+    if (unsyncedFds_.size() + 2 > ring_->capacity() || batch_.size() > std::numeric_limits<u32>::max())
+        return false;
+
+    // Both buffers only ever grow, so a registered entry that no longer
+    // matches one of them has been freed and the set must be replaced.
+    std::vector<iovec> current;
+    for (auto buf : {std::pair<const u8*, usize>{batch_.data(), batch_.capacity()}, {pendingData, pendingCapacity}}) {
+        if (buf.first != nullptr && buf.second > 0 && buf.second <= maxRegisteredBytes)
+            current.push_back(iovec{const_cast<u8*>(buf.first), buf.second});
+    }
+    auto sameBuffers = [](const std::vector<iovec>& a, const std::vector<iovec>& b) {
+        if (a.size() != b.size())
+            return false;
+        for (const auto& x : a) {
+            bool found = false;
+            for (const auto& y : b)
+                found = found || (x.iov_base == y.iov_base && x.iov_len == y.iov_len);
+            if (!found)
+                return false;
+        }
+        return true;
+    };
+    if (!sameBuffers(registered_, current))
+        registered_ = ring_->registerBuffers(current) ? current : std::vector<iovec>{};
+
+    if (!batch_.empty()) {
+        int bufIndex = -1;
+        for (usize i = 0; i < registered_.size(); i++) {
+            if (registered_[i].iov_base == batch_.data() && registered_[i].iov_len == batch_.capacity())
+                bufIndex = static_cast<int>(i);
+        }
+        ring_->queueWrite(fileDesc, batch_.data(), static_cast<u32>(batch_.size()), batchOffset, bufIndex);
+    }
+    for (int fd : unsyncedFds_)
+        ring_->queueFdatasync(fd);
+    ring_->queueFdatasync(fileDesc);
+    if (!ring_->submitAndWait()) {
+        // Redone with plain calls: a real I/O error throws there, anything
+        // else means the ring itself is of no use.
+        ring_.reset();
+        registered_.clear();
+        xeondb::log(LogLevel::WARN, "io_uring WAL sync failed; falling back to pwrite");
+        return false;
+    }
+    for (int fd : unsyncedFds_)
+        ::close(fd);
+    unsyncedFds_.clear();
+    return true;
 }
 
 void CommitLog::close() {
+    stopSyncer();
+    bool unsynced = false;
+    {
+        std::lock_guard<std::mutex> lock(groupMutex_);
+        unsynced = appendedTicket_ > durableTicket_;
+    }
+    if (unsynced || logDirty.load()) {
+        try {
+            fsyncNow();
+        } catch (...) {
+        }
+    }
+    std::lock_guard<std::mutex> append(appendMutex_);
+    std::lock_guard<std::mutex> prep(prepareMutex_);
+    std::lock_guard<std::mutex> io(ioMutex_);
+    for (int fd : unsyncedFds_)
+        ::close(fd);
+    unsyncedFds_.clear();
     if (fileDesc >= 0) {
         ::close(fileDesc);
         fileDesc = -1;
     }
+    // Segments stay on disk; the next open replays what is still needed and
+    // retires the rest.
+    std::lock_guard<std::mutex> lock(spareMutex_);
+    if (spareFd_ >= 0) {
+        ::close(spareFd_);
+        spareFd_ = -1;
+    }
+    recyclable_.clear();
+    isOpen_ = false;
 }
 
-usize CommitLog::bytesSinceFsync() const {
-    return bytesSinceFsync_.load();
+CommitLogStats CommitLog::stats() const {
+    CommitLogStats s;
+    s.fsyncs = fsyncs_.load(std::memory_order_relaxed);
+    s.fsyncBytes = fsyncBytes_.load(std::memory_order_relaxed);
+    s.fsyncMicrosTotal = fsyncMicrosTotal_.load(std::memory_order_relaxed);
+    s.fsyncMicrosMax = fsyncMicrosMax_.load(std::memory_order_relaxed);
+    return s;
 }
 
-void CommitLog::resetBytesSinceFsync() {
-    bytesSinceFsync_ = 0;
+usize CommitLog::bytesSinceFsync() const {
+    return bytesSinceFsync_.load();
 }
 
 bool CommitLog::isDirty() const {
     return logDirty.load();
 }
 
-void CommitLog::clearDirty() {
-    logDirty = false;
-}
-
-const std::filesystem::path& CommitLog::path() const {
-    return path_;
-}
-
 }
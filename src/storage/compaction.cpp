@@ -0,0 +1,259 @@
+#include "storage/compaction.h"
+
+#include "storage/mergeIterator.h"
+#include "util/log.h"
+
+#include <algorithm>
+#include <memory>
+
+namespace xeondb {
+
+CompactionThrottle::CompactionThrottle(u64 bytesPerSec)
+    : bytesPerSec_(bytesPerSec)
+    , nextFree_(std::chrono::steady_clock::now()) {
+}
+
+void CompactionThrottle::acquire(u64 bytes) {
+    using namespace std::chrono;
+    if (bytesPerSec_ == 0 || bytes == 0)
+        return;
+
+    steady_clock::time_point wakeAt;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto now = steady_clock::now();
+        if (nextFree_ < now)
+            nextFree_ = now;
+        wakeAt = nextFree_;
+        auto cost = duration_cast<steady_clock::duration>(duration<double>(static_cast<double>(bytes) / static_cast<double>(bytesPerSec_)));
+        nextFree_ += cost;
+    }
+    std::this_thread::sleep_until(wakeAt);
+}
+
+CompactionExecutor::CompactionExecutor(usize concurrency, u64 throughputBytesPerSec)
+    : stop_(false)
+    , throttle_(throughputBytesPerSec) {
+    if (concurrency == 0)
+        concurrency = 1;
+    workers_.reserve(concurrency);
+    for (usize i = 0; i < concurrency; i++) {
+        workers_.emplace_back([this]() {
+            workerMain();
+        });
+    }
+}
+
+CompactionExecutor::~CompactionExecutor() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& w : workers_) {
+        if (w.joinable())
+            w.join();
+    }
+}
+
+void CompactionExecutor::submit(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stop_)
+            return;
+        jobs_.push_back(std::move(job));
+    }
+    cv_.notify_one();
+}
+
+CompactionThrottle& CompactionExecutor::throttle() {
+    return throttle_;
+}
+
+void CompactionExecutor::workerMain() {
+    for (;;) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [&]() {
+                return stop_ || !jobs_.empty();
+            });
+            if (stop_)
+                return;
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+        try {
+            job();
+        } catch (const std::exception& e) {
+            xeondb::log(LogLevel::ERROR, std::string("Compaction job failed err=") + e.what());
+        } catch (...) {
+            xeondb::log(LogLevel::ERROR, "Compaction job failed");
+        }
+    }
+}
+
+std::optional<CompactionPlan> pickSizeTieredCompaction(const std::vector<SsTableFile>& files, usize minThreshold, usize maxThreshold) {
+    if (minThreshold < 2)
+        minThreshold = 2;
+    if (maxThreshold < minThreshold)
+        maxThreshold = minThreshold;
+
+    std::optional<std::pair<usize, usize>> best;
+    double bestAvg = 0.0;
+    for (usize begin = 0; begin < files.size(); begin++) {
+        double total = static_cast<double>(files[begin].fileBytes);
+        usize end = begin + 1;
+        while (end < files.size() && end - begin < maxThreshold) {
+            double avg = total / static_cast<double>(end - begin);
+            double size = static_cast<double>(files[end].fileBytes);
+            if (size < avg * 0.5 || size > avg * 1.5)
+                break;
+            total += size;
+            end++;
+        }
+        if (end - begin < minThreshold)
+            continue;
+        double avg = total / static_cast<double>(end - begin);
+        // Prefer the bucket of smallest files: cheapest to merge and the one
+        // that removes the most files per byte written.
+        if (!best.has_value() || avg < bestAvg) {
+            best = std::make_pair(begin, end);
+            bestAvg = avg;
+        }
+    }
+    if (!best.has_value())
+        return std::nullopt;
+
+    CompactionPlan plan;
+    for (usize i = best->first; i < best->second; i++)
+        plan.inputs.push_back(i);
+    // Only a run that reaches the oldest file can drop tombstones: nothing
+    // older is left for them to shadow.
+    plan.dropTombstones = best->first == 0;
+    return plan;
+}
+
+static bool keyLess(const byteVec& a, const byteVec& b) {
+    return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end());
+}
+
+static bool hasKeyRange(const SsTableFile& f) {
+    return !f.minKey.empty() || !f.maxKey.empty();
+}
+
+static bool rangesOverlap(const SsTableFile& f, const byteVec& minKey, const byteVec& maxKey) {
+    if (!hasKeyRange(f))
+        return true;
+    return !keyLess(f.maxKey, minKey) && !keyLess(maxKey, f.minKey);
+}
+
+std::optional<CompactionPlan> pickLeveledCompaction(const std::vector<SsTableFile>& files, const LeveledCompactionOptions& options,
+        const std::vector<byteVec>& cursors) {
+    std::vector<std::vector<usize>> levels(leveledMaxLevel + 1);
+    for (usize i = 0; i < files.size(); i++)
+        levels[std::min(files[i].level, leveledMaxLevel)].push_back(i);
+
+    usize l0Trigger = options.l0Trigger < 2 ? 2 : options.l0Trigger;
+    usize maxL0Inputs = std::max(options.maxL0Inputs, l0Trigger);
+    u64 sstableBytes = options.sstableBytes == 0 ? 1 : options.sstableBytes;
+    u64 sizeRatio = options.sizeRatio < 2 ? 2 : options.sizeRatio;
+
+    CompactionPlan plan;
+    u32 sourceLevel = 0;
+    if (levels[0].size() >= l0Trigger) {
+        // L0 files overlap each other; take the oldest ones so the younger
+        // L0 files left behind still shadow the L1 output.
+        usize take = std::min(levels[0].size(), maxL0Inputs);
+        plan.inputs.assign(levels[0].begin(), levels[0].begin() + static_cast<std::ptrdiff_t>(take));
+        plan.outputLevel = 1;
+    } else {
+        double bestScore = 1.0;
+        u64 levelBudget = sstableBytes * sizeRatio;
+        for (u32 level = 1; level < leveledMaxLevel; level++, levelBudget *= sizeRatio) {
+            u64 bytes = 0;
+            for (usize idx : levels[level])
+                bytes += files[idx].fileBytes;
+            double score = static_cast<double>(bytes) / static_cast<double>(levelBudget);
+            if (score > bestScore) {
+                bestScore = score;
+                sourceLevel = level;
+            }
+        }
+        if (sourceLevel == 0)
+            return std::nullopt;
+
+        const auto& source = levels[sourceLevel];
+        usize pick = source.front();
+        if (sourceLevel < cursors.size() && !cursors[sourceLevel].empty()) {
+            for (usize idx : source) {
+                if (keyLess(cursors[sourceLevel], files[idx].minKey)) {
+                    pick = idx;
+                    break;
+                }
+            }
+        }
+        plan.inputs.push_back(pick);
+        plan.outputLevel = sourceLevel + 1;
+    }
+
+    byteVec minKey;
+    byteVec maxKey;
+    bool unbounded = false;
+    for (usize idx : plan.inputs) {
+        const auto& f = files[idx];
+        if (!hasKeyRange(f)) {
+            unbounded = true;
+            continue;
+        }
+        if (minKey.empty() || keyLess(f.minKey, minKey))
+            minKey = f.minKey;
+        if (maxKey.empty() || keyLess(maxKey, f.maxKey))
+            maxKey = f.maxKey;
+    }
+    auto overlaps = [&](const SsTableFile& f) {
+        return unbounded || rangesOverlap(f, minKey, maxKey);
+    };
+
+    for (usize idx : levels[plan.outputLevel]) {
+        if (overlaps(files[idx]))
+            plan.inputs.push_back(idx);
+    }
+    std::sort(plan.inputs.begin(), plan.inputs.end());
+
+    // Tombstones can go once no deeper level may still hold what they delete.
+    plan.dropTombstones = true;
+    for (u32 level = plan.outputLevel + 1; level <= leveledMaxLevel && plan.dropTombstones; level++) {
+        for (usize idx : levels[level]) {
+            if (overlaps(files[idx])) {
+                plan.dropTombstones = false;
+                break;
+            }
+        }
+    }
+    return plan;
+}
+
+bool mergeSsTables(const std::vector<SsTableFile>& inputs, const std::function<void(const SsEntry&)>& emit, bool dropTombstones,
+        CompactionThrottle* throttle, const std::function<bool()>& shouldStop) {
+    std::vector<std::unique_ptr<EntrySource>> sources;
+    sources.reserve(inputs.size());
+    for (const auto& input : inputs)
+        sources.push_back(std::make_unique<SsTableScanner>(input, false));
+    MergeIterator merged(std::move(sources));
+
+    u64 processed = 0;
+    SsEntry entry;
+    while (merged.next(entry)) {
+        if ((processed++ & 0xFF) == 0 && shouldStop && shouldStop())
+            return false;
+        if (dropTombstones && entry.value.empty())
+            continue;
+        emit(entry);
+        if (throttle != nullptr)
+            throttle->acquire(static_cast<u64>(entry.key.size() + entry.value.size() + 16));
+    }
+    return true;
+}
+
+}
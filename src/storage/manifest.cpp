@@ -11,7 +11,7 @@ using std::string;
 namespace xeondb {
 
 static constexpr const char* manifestMagic = "BZMF001";
-static constexpr u32 manifestVersion = 1;
+static constexpr u32 manifestVersion = 2;
 
 Manifest readManifest(const std::filesystem::path& path) {
     Manifest m;
@@ -35,14 +35,22 @@ Manifest readManifest(const std::filesystem::path& path) {
 
     try {
         u32 version = readU32(in);
-        if (version != manifestVersion) {
+        if (version != 1 && version != manifestVersion) {
             return m;
         }
         m.lastFlushedSeq = readU64(in);
         m.nextSstableGen = readU64(in);
         u64 count = readU64(in);
         for (u64 i = 0; i < count; i++) {
-            m.sstableFiles.push_back(readString(in));
+            ManifestSsTable f;
+            f.name = readString(in);
+            // Version 1 only listed names: everything is L0 with an unknown range.
+            if (version >= 2) {
+                f.level = readU32(in);
+                f.minKey = readBytes(in);
+                f.maxKey = readBytes(in);
+            }
+            m.sstableFiles.push_back(std::move(f));
         }
         return m;
     } catch (...) {
@@ -66,7 +74,10 @@ void writeManifestAtomic(const std::filesystem::path& path, const Manifest& mani
     writeU64(out, manifest.nextSstableGen);
     writeU64(out, static_cast<u64>(manifest.sstableFiles.size()));
     for (const auto& f : manifest.sstableFiles) {
-        writeString(out, f);
+        writeString(out, f.name);
+        writeU32(out, f.level);
+        writeBytes(out, f.minKey);
+        writeBytes(out, f.maxKey);
     }
     out.flush();
     out.close();
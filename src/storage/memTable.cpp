@@ -1,53 +1,164 @@
 #include "storage/memTable.h"
 
+#include <cstring>
+#include <limits>
+#include <new>
+
 namespace xeondb {
 
+// One arena allocation per version: the node, the rest of its tower, then the
+// key and value bytes.
+struct MemTable::Node {
+    u64 seq;
+    u32 keySize;
+    u32 valueSize;
+    int height;
+    // Extends past the struct to height entries.
+    std::atomic<Node*> nextAt[1];
+
+    const char* data() const {
+        return reinterpret_cast<const char*>(&nextAt[height]);
+    }
+    std::string_view key() const {
+        return std::string_view(data(), keySize);
+    }
+    const u8* value() const {
+        return reinterpret_cast<const u8*>(data() + keySize);
+    }
+
+    Node* next(int level) const {
+        return nextAt[level].load(std::memory_order_acquire);
+    }
+    void setNext(int level, Node* node) {
+        nextAt[level].store(node, std::memory_order_release);
+    }
+};
+
+// (a.key, a.seq) sorts before (key, seq): keys ascending, seq descending.
+static bool nodeBefore(std::string_view aKey, u64 aSeq, std::string_view key, u64 seq) {
+    int cmp = aKey.compare(key);
+    if (cmp != 0)
+        return cmp < 0;
+    return aSeq > seq;
+}
+
 MemTable::MemTable()
-    : bytes_(0) {
+    : head_(nullptr)
+    , height_(1)
+    , size_(0)
+    , rng_(0x2545F4914F6CDD1Dull) {
+    head_ = newNode(std::string_view(), 0, byteVec(), maxHeight);
+}
+
+// Nodes and their atomics are trivially destructible, so dropping the arena
+// is all the cleanup a memtable needs.
+MemTable::Node* MemTable::newNode(std::string_view key, u64 seq, const byteVec& value, int height) {
+    usize towerBytes = sizeof(std::atomic<Node*>) * static_cast<usize>(height - 1);
+    u8* mem = arena_.allocate(sizeof(Node) + towerBytes + key.size() + value.size());
+    Node* node = new (mem) Node{seq, static_cast<u32>(key.size()), static_cast<u32>(value.size()), height, {}};
+    for (int i = 1; i < height; i++)
+        new (&node->nextAt[i]) std::atomic<Node*>(nullptr);
+    char* data = const_cast<char*>(node->data());
+    if (!key.empty())
+        std::memcpy(data, key.data(), key.size());
+    if (!value.empty())
+        std::memcpy(data + key.size(), value.data(), value.size());
+    return node;
+}
+
+int MemTable::randomHeight() {
+    // xorshift64; each level is kept with probability 1/4.
+    int height = 1;
+    while (height < maxHeight) {
+        rng_ ^= rng_ << 13;
+        rng_ ^= rng_ >> 7;
+        rng_ ^= rng_ << 17;
+        if ((rng_ & 3) != 0)
+            break;
+        height++;
+    }
+    return height;
+}
+
+MemTable::Node* MemTable::findGreaterOrEqual(std::string_view key, u64 seq, Node** prev) const {
+    Node* node = head_;
+    int level = height_.load(std::memory_order_relaxed) - 1;
+    while (true) {
+        Node* next = node->next(level);
+        if (next != nullptr && nodeBefore(next->key(), next->seq, key, seq)) {
+            node = next;
+            continue;
+        }
+        if (prev != nullptr)
+            prev[level] = node;
+        if (level == 0)
+            return next;
+        level--;
+    }
 }
 
-void MemTable::put(const std::string& key, u64 seq, const byteVec& value) {
-    auto data = map.find(key);
-    if (data != map.end()) {
-        bytes_ -= data->first.size();
-        bytes_ -= data->second.value.size();
-        data->second.seq = seq;
-        data->second.value = value;
-    } else {
-        map.insert({key, MemValue{seq, value}});
+void MemTable::put(const string& key, u64 seq, const byteVec& value) {
+    Node* prev[maxHeight];
+    findGreaterOrEqual(key, seq, prev);
+
+    int height = randomHeight();
+    int current = height_.load(std::memory_order_relaxed);
+    if (height > current) {
+        for (int i = current; i < height; i++)
+            prev[i] = head_;
+        // Readers that see the new height early just find null links from head.
+        height_.store(height, std::memory_order_relaxed);
+    }
+
+    Node* node = newNode(key, seq, value, height);
+    for (int i = 0; i < height; i++) {
+        node->nextAt[i].store(prev[i]->next(i), std::memory_order_relaxed);
+        prev[i]->setNext(i, node);
     }
-    bytes_ += key.size();
-    bytes_ += value.size();
+    size_.fetch_add(1, std::memory_order_relaxed);
 }
 
 std::optional<MemValue> MemTable::get(const std::string& key) const {
-    auto data = map.find(key);
-    if (data == map.end()) {
+    Node* node = findGreaterOrEqual(key, std::numeric_limits<u64>::max(), nullptr);
+    if (node == nullptr || node->key() != key)
         return std::nullopt;
-    }
-    return data->second;
+    return MemValue{node->seq, byteVec(node->value(), node->value() + node->valueSize)};
 }
 
 usize MemTable::bytes() const {
-    return bytes_;
+    return arena_.usedBytes();
 }
 
 usize MemTable::size() const {
-    return map.size();
+    return size_.load(std::memory_order_relaxed);
 }
 
-void MemTable::clear() {
-    map.clear();
-    bytes_ = 0;
+MemTable::Iterator::Iterator(const MemTable& table)
+    : node_(table.head_->next(0)) {
 }
 
-std::vector<std::pair<string, MemValue>> MemTable::snapshot() const {
-    std::vector<std::pair<string, MemValue>> entries;
-    entries.reserve(map.size());
-    for (const auto& kv : map) {
-        entries.push_back(kv);
-    }
-    return entries;
+bool MemTable::Iterator::valid() const {
+    return node_ != nullptr;
+}
+
+void MemTable::Iterator::next() {
+    node_ = node_->next(0);
+}
+
+std::string_view MemTable::Iterator::key() const {
+    return node_->key();
+}
+
+u64 MemTable::Iterator::seq() const {
+    return node_->seq;
+}
+
+const u8* MemTable::Iterator::valueData() const {
+    return node_->value();
+}
+
+usize MemTable::Iterator::valueSize() const {
+    return node_->valueSize;
 }
 
 }
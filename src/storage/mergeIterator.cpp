@@ -0,0 +1,69 @@
+#include "storage/mergeIterator.h"
+
+#include <algorithm>
+
+namespace xeondb {
+
+MemTableEntrySource::MemTableEntrySource(std::shared_ptr<const MemTable> memTable, u64 maxSeq)
+    : memTable_(std::move(memTable))
+    , it_(*memTable_)
+    , maxSeq_(maxSeq) {
+}
+
+bool MemTableEntrySource::next(SsEntry& out) {
+    // Versions of a key are adjacent, newest first.
+    while (it_.valid() && it_.seq() > maxSeq_)
+        it_.next();
+    if (!it_.valid())
+        return false;
+    out.key.assign(it_.key().begin(), it_.key().end());
+    out.seq = it_.seq();
+    out.value.assign(it_.valueData(), it_.valueData() + it_.valueSize());
+    std::string_view key = it_.key();
+    do {
+        it_.next();
+    } while (it_.valid() && it_.key() == key);
+    return true;
+}
+
+bool MergeIterator::HeadAfter::operator()(const Head& a, const Head& b) const {
+    if (a.entry.key != b.entry.key)
+        return std::lexicographical_compare(b.entry.key.begin(), b.entry.key.end(), a.entry.key.begin(), a.entry.key.end());
+    return a.entry.seq < b.entry.seq;
+}
+
+MergeIterator::MergeIterator(std::vector<std::unique_ptr<EntrySource>> sources)
+    : sources_(std::move(sources)) {
+    heap_.reserve(sources_.size());
+    for (usize i = 0; i < sources_.size(); i++)
+        refill(i);
+}
+
+void MergeIterator::refill(usize source) {
+    Head h{SsEntry{}, source};
+    if (!sources_[source]->next(h.entry))
+        return;
+    heap_.push_back(std::move(h));
+    std::push_heap(heap_.begin(), heap_.end(), HeadAfter{});
+}
+
+bool MergeIterator::next(SsEntry& out) {
+    if (heap_.empty())
+        return false;
+    std::pop_heap(heap_.begin(), heap_.end(), HeadAfter{});
+    Head top = std::move(heap_.back());
+    heap_.pop_back();
+    refill(top.source);
+
+    // Older versions of the same key sort right behind the newest one.
+    while (!heap_.empty() && heap_.front().entry.key == top.entry.key) {
+        std::pop_heap(heap_.begin(), heap_.end(), HeadAfter{});
+        usize shadowed = heap_.back().source;
+        heap_.pop_back();
+        refill(shadowed);
+    }
+    out = std::move(top.entry);
+    return true;
+}
+
+}
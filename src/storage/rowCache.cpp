@@ -0,0 +1,74 @@
+#include "storage/rowCache.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace xeondb {
+
+static constexpr usize rowCacheMaxShards = 8;
+
+RowCache::RowCache(usize capacityRows)
+    : shardCapacity_(0) {
+    usize shardCount = capacityRows < rowCacheMaxShards ? 1 : rowCacheMaxShards;
+    shardCapacity_ = capacityRows / shardCount;
+    if (shardCapacity_ == 0)
+        shardCapacity_ = 1;
+    shards_.reserve(shardCount);
+    for (usize i = 0; i < shardCount; i++)
+        shards_.push_back(std::make_unique<Shard>());
+}
+
+RowCache::Shard& RowCache::shardFor(const std::string& dkey) {
+    // Decorated keys start with the partition token, which is already a hash.
+    u64 token = 0;
+    std::memcpy(&token, dkey.data(), std::min(dkey.size(), sizeof(token)));
+    return *shards_[static_cast<usize>(token % shards_.size())];
+}
+
+bool RowCache::lookup(const std::string& dkey, byteVec& row) {
+    Shard& shard = shardFor(dkey);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.map.find(dkey);
+    if (it == shard.map.end())
+        return false;
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    row = it->second->row;
+    return true;
+}
+
+void RowCache::insertIfCurrent(const std::string& dkey, const byteVec& row, const std::atomic<u64>& writeGen, u64 seenGen) {
+    Shard& shard = shardFor(dkey);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (writeGen.load(std::memory_order_acquire) != seenGen)
+        return;
+    auto it = shard.map.find(dkey);
+    if (it != shard.map.end()) {
+        it->second->row = row;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return;
+    }
+    shard.lru.push_front(Entry{dkey, row});
+    shard.map.emplace(dkey, shard.lru.begin());
+    while (shard.map.size() > shardCapacity_) {
+        shard.map.erase(shard.lru.back().dkey);
+        shard.lru.pop_back();
+    }
+}
+
+void RowCache::update(const std::string& dkey, const byteVec& row) {
+    Shard& shard = shardFor(dkey);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.map.find(dkey);
+    if (it != shard.map.end())
+        it->second->row = row;
+}
+
+void RowCache::clear() {
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->map.clear();
+        shard->lru.clear();
+    }
+}
+
+}
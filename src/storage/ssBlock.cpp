@@ -0,0 +1,157 @@
+#include "storage/ssBlock.h"
+
+#include "util/binIo.h"
+
+#include <algorithm>
+
+namespace xeondb {
+
+SsBlockBuilder::SsBlockBuilder(usize restartInterval)
+    : restartInterval_(restartInterval == 0 ? 16 : restartInterval)
+    , sinceRestart_(0) {
+}
+
+void SsBlockBuilder::add(const byteVec& key, u64 seq, const byteVec& value) {
+    usize shared = 0;
+    if (sinceRestart_ == restartInterval_ || restarts_.empty()) {
+        restarts_.push_back(static_cast<u32>(buf_.size()));
+        sinceRestart_ = 0;
+    } else {
+        usize limit = std::min(lastKey_.size(), key.size());
+        while (shared < limit && lastKey_[shared] == key[shared])
+            shared++;
+    }
+    appendVarU64(buf_, shared);
+    appendVarU64(buf_, key.size() - shared);
+    appendVarU64(buf_, value.size());
+    appendVarU64(buf_, seq);
+    buf_.insert(buf_.end(), key.begin() + static_cast<std::ptrdiff_t>(shared), key.end());
+    buf_.insert(buf_.end(), value.begin(), value.end());
+    lastKey_ = key;
+    sinceRestart_++;
+}
+
+const byteVec& SsBlockBuilder::finish() {
+    for (u32 r : restarts_)
+        appendBeU32(buf_, r);
+    appendBeU32(buf_, static_cast<u32>(restarts_.size()));
+    return buf_;
+}
+
+void SsBlockBuilder::reset() {
+    buf_.clear();
+    restarts_.clear();
+    sinceRestart_ = 0;
+    lastKey_.clear();
+}
+
+bool SsBlockBuilder::empty() const {
+    return restarts_.empty();
+}
+
+usize SsBlockBuilder::sizeEstimate() const {
+    return buf_.size() + (restarts_.size() + 1) * sizeof(u32);
+}
+
+SsBlockIter::SsBlockIter(const u8* data, usize size)
+    : data_(data)
+    , entriesEnd_(0)
+    , restartCount_(0)
+    , ok_(false)
+    , offset_(0)
+    , seq_(0)
+    , valueOffset_(0)
+    , valueSize_(0) {
+    if (size < sizeof(u32))
+        return;
+    u32 count = readBeU32(data + size - sizeof(u32));
+    usize trailer = (static_cast<usize>(count) + 1) * sizeof(u32);
+    if (count == 0 || trailer > size)
+        return;
+    restartCount_ = count;
+    entriesEnd_ = size - trailer;
+    ok_ = true;
+}
+
+bool SsBlockIter::ok() const {
+    return ok_;
+}
+
+u32 SsBlockIter::restartOffset(usize i) const {
+    return readBeU32(data_ + entriesEnd_ + i * sizeof(u32));
+}
+
+bool SsBlockIter::decodeAt(usize offset, byteVec& key, usize& nextOffset, u64& seq, usize& valueOffset, usize& valueSize) const {
+    const u8* p = data_ + offset;
+    const u8* end = data_ + entriesEnd_;
+    u64 shared = 0;
+    u64 unshared = 0;
+    u64 valueLen = 0;
+    if (!readVarU64(p, end, shared) || !readVarU64(p, end, unshared) || !readVarU64(p, end, valueLen) || !readVarU64(p, end, seq))
+        return false;
+    if (shared > key.size() || static_cast<u64>(end - p) < unshared || static_cast<u64>(end - p) - unshared < valueLen)
+        return false;
+    key.resize(static_cast<usize>(shared));
+    key.insert(key.end(), p, p + unshared);
+    p += unshared;
+    valueOffset = static_cast<usize>(p - data_);
+    valueSize = static_cast<usize>(valueLen);
+    nextOffset = valueOffset + valueSize;
+    return true;
+}
+
+bool SsBlockIter::next() {
+    if (!ok_ || offset_ >= entriesEnd_)
+        return false;
+    usize nextOffset = 0;
+    if (!decodeAt(offset_, key_, nextOffset, seq_, valueOffset_, valueSize_)) {
+        ok_ = false;
+        return false;
+    }
+    offset_ = nextOffset;
+    return true;
+}
+
+void SsBlockIter::seekFloor(const byteVec& key) {
+    if (!ok_)
+        return;
+    // Restart entries have shared == 0, so they decode without context.
+    usize lo = 0;
+    usize hi = restartCount_;
+    while (hi - lo > 1) {
+        usize mid = lo + (hi - lo) / 2;
+        byteVec midKey;
+        usize nextOffset = 0;
+        u64 seq = 0;
+        usize valueOffset = 0;
+        usize valueSize = 0;
+        if (restartOffset(mid) >= entriesEnd_ || !decodeAt(restartOffset(mid), midKey, nextOffset, seq, valueOffset, valueSize)) {
+            ok_ = false;
+            return;
+        }
+        if (std::lexicographical_compare(key.begin(), key.end(), midKey.begin(), midKey.end()))
+            hi = mid;
+        else
+            lo = mid;
+    }
+    offset_ = restartOffset(lo);
+    key_.clear();
+}
+
+const byteVec& SsBlockIter::key() const {
+    return key_;
+}
+
+u64 SsBlockIter::seq() const {
+    return seq_;
+}
+
+const u8* SsBlockIter::value() const {
+    return data_ + valueOffset_;
+}
+
+usize SsBlockIter::valueSize() const {
+    return valueSize_;
+}
+
+}
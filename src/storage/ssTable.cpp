@@ -1,123 +1,449 @@
 #include "storage/ssTable.h"
 
 #include "util/binIo.h"
+#include "util/crc32.h"
+#include "util/lz.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace xeondb {
 
 static constexpr const char* ssMagic = "BZST001";
 static constexpr const char* ixMagic = "BZIX001";
+static constexpr const char* bloomMagic = "BZBF001";
 static constexpr const char* endMagic = "BZEND001";
-static constexpr u32 ssVersion = 1;
+// v1: flat key/seq/value records. v2: checksummed, optionally compressed blocks.
+static constexpr u32 ssVersion = 2;
+static constexpr usize minBlockBytes = 4 * 1024;
+static constexpr usize maxBlockBytes = 64 * 1024;
 
 static bool bytesLess(const byteVec& a, const byteVec& b) {
     return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end());
 }
 
-void writeSsTable(const path& path, const std::vector<SsEntry>& entries, usize indexStride) {
-    std::ofstream out(path, std::ios::binary | std::ios::trunc);
-    if (!out.is_open())
+SsTableWriter::SsTableWriter(const path& path, const SsTableWriteOptions& options)
+    : out_(path, std::ios::binary | std::ios::trunc)
+    , options_(options)
+    , count_(0)
+    , block_(options.restartInterval) {
+    if (!out_.is_open())
         throw runtimeError("cannot write sstable");
+    options_.blockBytes = std::clamp(options_.blockBytes, minBlockBytes, maxBlockBytes);
 
-    out.write(ssMagic, 7);
+    out_.write(ssMagic, 7);
     char pad = 0;
-    out.write(&pad, 1);
-    writeU32(out, ssVersion);
-    writeU64(out, static_cast<u64>(entries.size()));
+    out_.write(&pad, 1);
+    writeU32(out_, ssVersion);
+    countPos_ = out_.tellp();
+    writeU64(out_, 0);
+}
+
+void SsTableWriter::add(const SsEntry& entry) {
+    if (block_.empty())
+        blockFirstKey_ = entry.key;
+    if (count_ == 0)
+        minKey_ = entry.key;
+    maxKey_ = entry.key;
+    if (options_.bloomBitsPerKey > 0) {
+        u64 second = 0;
+        u64 first = BloomFilter::keyHash(entry.key, second);
+        keyHashes_.push_back({first, second});
+    }
+    block_.add(entry.key, entry.seq, entry.value);
+    count_++;
+    if (block_.sizeEstimate() >= options_.blockBytes)
+        flushBlock();
+}
+
+// On disk a block is [u8 compression][payload][u32 crc32 of the previous
+// bytes]; an Lz payload is [u32 raw size][lz data]. Both u32s are big-endian.
+void SsTableWriter::flushBlock() {
+    if (block_.empty())
+        return;
+    const byteVec& raw = block_.finish();
+    u8 type = static_cast<u8>(SsCompression::None);
+    const u8* payload = raw.data();
+    usize payloadSize = raw.size();
+    if (options_.compression == SsCompression::Lz) {
+        byteVec packed = lzCompress(raw.data(), raw.size());
+        // Only keep the compressed form when it saves at least 1/8.
+        if (packed.size() + sizeof(u32) < raw.size() - raw.size() / 8) {
+            compressed_.clear();
+            appendBeU32(compressed_, static_cast<u32>(raw.size()));
+            compressed_.insert(compressed_.end(), packed.begin(), packed.end());
+            type = static_cast<u8>(SsCompression::Lz);
+            payload = compressed_.data();
+            payloadSize = compressed_.size();
+        }
+    }
 
-    if (indexStride == 0)
-        indexStride = 16;
+    byteVec framed;
+    framed.reserve(payloadSize + 1 + sizeof(u32));
+    framed.push_back(type);
+    framed.insert(framed.end(), payload, payload + payloadSize);
+    appendBeU32(framed, crc32(framed.data(), framed.size()));
 
-    std::vector<SsIndexEntry> indexEntry;
-    indexEntry.reserve((entries.size() / indexStride) + 2);
+    u64 offset = static_cast<u64>(out_.tellp());
+    out_.write(reinterpret_cast<const char*>(framed.data()), static_cast<std::streamsize>(framed.size()));
+    if (!out_)
+        throw runtimeError("cannot write sstable");
+    index_.push_back(SsIndexEntry{std::move(blockFirstKey_), offset, static_cast<u32>(framed.size())});
+    blockFirstKey_.clear();
+    block_.reset();
+}
+
+void SsTableWriter::finish() {
+    flushBlock();
 
-    for (usize i = 0; i < entries.size(); i++) {
-        u64 offset = static_cast<u64>(out.tellp());
-        const auto& e = entries[i];
-        if (i % indexStride == 0)
-            indexEntry.push_back(SsIndexEntry{e.key, offset});
-        writeBytes(out, e.key);
-        writeU64(out, e.seq);
-        writeBytes(out, e.value);
+    char pad = 0;
+    u64 indexStart = static_cast<u64>(out_.tellp());
+    out_.write(ixMagic, 7);
+    out_.write(&pad, 1);
+    writeU64(out_, static_cast<u64>(index_.size()));
+    for (const auto& it : index_) {
+        writeBytes(out_, it.key);
+        writeU64(out_, it.offset);
+        writeU32(out_, it.blockBytes);
     }
 
-    u64 indexStart = static_cast<u64>(out.tellp());
-    out.write(ixMagic, 7);
-    out.write(&pad, 1);
-    writeU64(out, static_cast<u64>(indexEntry.size()));
-    for (const auto& it : indexEntry) {
-        writeBytes(out, it.key);
-        writeU64(out, it.offset);
+    // Optional block between the index and the footer; readers that predate
+    // it only ever look at the index.
+    if (!keyHashes_.empty()) {
+        out_.write(bloomMagic, 7);
+        out_.write(&pad, 1);
+        BloomFilter::build(keyHashes_, options_.bloomBitsPerKey).write(out_);
+        keyHashes_.clear();
+        keyHashes_.shrink_to_fit();
     }
 
-    out.write(endMagic, 7);
-    out.write(&pad, 1);
-    writeU64(out, indexStart);
-    out.flush();
-    out.close();
+    out_.write(endMagic, 7);
+    out_.write(&pad, 1);
+    writeU64(out_, indexStart);
+
+    out_.seekp(countPos_);
+    writeU64(out_, count_);
+    out_.flush();
+    if (!out_)
+        throw runtimeError("cannot write sstable");
+    out_.close();
+}
+
+u64 SsTableWriter::entryCount() const {
+    return count_;
+}
+
+u64 SsTableWriter::bytesWritten() {
+    return static_cast<u64>(out_.tellp()) + block_.sizeEstimate();
+}
+
+const byteVec& SsTableWriter::minKey() const {
+    return minKey_;
+}
+
+const byteVec& SsTableWriter::maxKey() const {
+    return maxKey_;
+}
+
+bool ssTableMayContain(const SsTableFile& file, const byteVec& key) {
+    if (!file.minKey.empty() || !file.maxKey.empty()) {
+        if (bytesLess(key, file.minKey) || bytesLess(file.maxKey, key))
+            return false;
+    }
+    return file.bloom == nullptr || file.bloom->mayContain(key);
 }
 
-SsTableFile loadSsTableIndex(const path& path) {
-    std::ifstream in(path, std::ios::binary);
-    if (!in.is_open())
+void writeSsTable(const path& path, const std::vector<SsEntry>& entries, const SsTableWriteOptions& options) {
+    SsTableWriter writer(path, options);
+    for (const auto& e : entries)
+        writer.add(e);
+    writer.finish();
+}
+
+static std::atomic<u64> nextReaderId{1};
+
+SsTableReader::SsTableReader(const path& path)
+    : data_(nullptr)
+    , size_(0)
+    , id_(nextReaderId.fetch_add(1, std::memory_order_relaxed)) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
         throw runtimeError("cannot open sstable");
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw runtimeError("cannot stat sstable");
+    }
+    size_ = static_cast<u64>(st.st_size);
+    if (size_ > 0) {
+        void* mapped = ::mmap(nullptr, static_cast<usize>(size_), PROT_READ, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            throw runtimeError("cannot map sstable");
+        }
+        data_ = static_cast<const u8*>(mapped);
+    }
+    ::close(fd);
+}
+
+SsTableReader::~SsTableReader() {
+    if (data_ != nullptr)
+        ::munmap(const_cast<u8*>(data_), static_cast<usize>(size_));
+}
+
+const u8* SsTableReader::data() const {
+    return data_;
+}
+
+u64 SsTableReader::size() const {
+    return size_;
+}
+
+u64 SsTableReader::id() const {
+    return id_;
+}
+
+namespace {
+
+// Bounds-checked decoding over mapped bytes; an overrun clears ok and every
+// later read fails too.
+struct MappedCursor {
+    const u8* base;
+    u64 offset;
+    u64 end;
+    bool ok = true;
+
+    bool has(u64 n) {
+        if (!ok || end - offset < n)
+            ok = false;
+        return ok;
+    }
+
+    template <typename T>
+    T fixed() {
+        T v{};
+        if (has(sizeof(T))) {
+            std::memcpy(&v, base + offset, sizeof(T));
+            offset += sizeof(T);
+        }
+        return v;
+    }
+
+    bool magic(const char* expected) {
+        if (!has(8) || std::memcmp(base + offset, expected, 7) != 0)
+            return ok = false;
+        offset += 8;
+        return true;
+    }
 
-    in.seekg(0, std::ios::end);
-    auto size = static_cast<u64>(in.tellg());
-    if (size < 16)
+    // Length-prefixed bytes, returned in place.
+    const u8* bytes(u32& len) {
+        len = fixed<u32>();
+        if (!has(len))
+            return nullptr;
+        const u8* p = base + offset;
+        offset += len;
+        return p;
+    }
+};
+
+}
+
+static constexpr u64 ssHeaderBytes = 8 + sizeof(u32) + sizeof(u64);
+
+// Returns the format version, or 0 for anything unreadable.
+static u32 headerVersion(const SsTableReader& reader) {
+    MappedCursor in{reader.data(), 0, reader.size()};
+    if (!in.magic(ssMagic))
+        return 0;
+    u32 version = in.fixed<u32>();
+    if (!in.ok || version == 0 || version > ssVersion)
+        return 0;
+    return version;
+}
+
+SsTableFile loadSsTableIndex(const path& path, std::shared_ptr<BlockCache> blockCache) {
+    auto reader = std::make_shared<const SsTableReader>(path);
+    u64 size = reader->size();
+    if (size < ssHeaderBytes + 16)
         throw runtimeError("sstable too small");
-    in.seekg(static_cast<i64>(size - 16));
-    char end[8]{};
-    in.read(end, 8);
-    if (std::string(end, 7) != std::string(endMagic, 7))
+    u32 version = headerVersion(*reader);
+    if (version == 0)
+        throw runtimeError("bad sstable header");
+
+    MappedCursor footer{reader->data(), size - 16, size};
+    if (!footer.magic(endMagic))
         throw runtimeError("bad sstable footer");
-    u64 indexStart = readU64(in);
+    u64 indexStart = footer.fixed<u64>();
+    if (indexStart > size - 16)
+        throw runtimeError("bad index");
 
-    in.seekg(static_cast<i64>(indexStart));
-    char ix[8]{};
-    in.read(ix, 8);
-    if (std::string(ix, 7) != std::string(ixMagic, 7))
+    MappedCursor in{reader->data(), indexStart, size - 16};
+    if (!in.magic(ixMagic))
         throw runtimeError("bad index");
-    u64 count = readU64(in);
+    u64 count = in.fixed<u64>();
 
     SsTableFile tableFile;
     tableFile.filePath = path;
-    tableFile.index.reserve(static_cast<usize>(count));
+    tableFile.fileBytes = size;
+    tableFile.version = version;
+    tableFile.dataEnd = indexStart;
+    tableFile.index.reserve(static_cast<usize>(std::min<u64>(count, size / 12)));
     for (u64 i = 0; i < count; i++) {
-        byteVec k = readBytes(in);
-        u64 off = readU64(in);
-        tableFile.index.push_back(SsIndexEntry{std::move(k), off});
+        u32 keyLen = 0;
+        const u8* key = in.bytes(keyLen);
+        u64 off = in.fixed<u64>();
+        u32 blockBytes = version >= 2 ? in.fixed<u32>() : 0;
+        if (!in.ok || (version >= 2 && (off > indexStart || indexStart - off < blockBytes)))
+            throw runtimeError("bad index");
+        tableFile.index.push_back(SsIndexEntry{byteVec(key, key + keyLen), off, blockBytes});
     }
+
+    if (in.magic(bloomMagic)) {
+        auto bloom = BloomFilter::decode(reader->data() + in.offset, static_cast<usize>(in.end - in.offset));
+        if (bloom.has_value())
+            tableFile.bloom = std::make_shared<const BloomFilter>(std::move(*bloom));
+    }
+    tableFile.reader = std::move(reader);
+    tableFile.blockCache = std::move(blockCache);
     return tableFile;
 }
 
-std::vector<SsEntry> ssTableScanAll(const SsTableFile& file) {
-    std::ifstream in(file.filePath, std::ios::binary);
-    if (!in.is_open())
-        throw runtimeError("cannot open sstable");
+// Checks a v2 block's CRC and yields its body: in place when stored raw,
+// inflated into scratch when compressed.
+static bool decodeBlock(const SsTableFile& file, const SsIndexEntry& handle, byteVec& scratch, const u8*& body, usize& bodySize) {
+    if (handle.blockBytes < 1 + sizeof(u32))
+        return false;
+    const u8* framed = file.reader->data() + handle.offset;
+    usize payloadSize = handle.blockBytes - 1 - sizeof(u32);
+    if (crc32(framed, 1 + payloadSize) != readBeU32(framed + 1 + payloadSize))
+        return false;
 
-    char header[8]{};
-    in.read(header, 8);
-    if (!in || std::string(header, 7) != std::string(ssMagic, 7))
+    const u8* payload = framed + 1;
+    if (framed[0] == static_cast<u8>(SsCompression::None)) {
+        body = payload;
+        bodySize = payloadSize;
+        return true;
+    }
+    if (framed[0] != static_cast<u8>(SsCompression::Lz) || payloadSize < sizeof(u32))
+        return false;
+    u32 rawSize = readBeU32(payload);
+    if (rawSize > maxBlockBytes * 2)
+        return false;
+    scratch.resize(rawSize);
+    if (!lzDecompress(payload + sizeof(u32), payloadSize - sizeof(u32), scratch.data(), scratch.size()))
+        return false;
+    body = scratch.data();
+    bodySize = scratch.size();
+    return true;
+}
+
+// Yields a block body, from the file's block cache when it is there. pinned
+// keeps a cached or freshly inflated body alive while body points into it.
+static bool readBlock(const SsTableFile& file, const SsIndexEntry& handle, bool fillCache, std::shared_ptr<const byteVec>& pinned, const u8*& body,
+        usize& bodySize) {
+    BlockCache* cache = file.blockCache.get();
+    if (cache != nullptr) {
+        pinned = cache->lookup(file.reader->id(), handle.offset);
+        if (pinned != nullptr) {
+            body = pinned->data();
+            bodySize = pinned->size();
+            return true;
+        }
+    }
+
+    byteVec scratch;
+    if (!decodeBlock(file, handle, scratch, body, bodySize))
+        return false;
+    bool inflated = body == scratch.data();
+    if (cache == nullptr || !fillCache) {
+        pinned = inflated ? std::make_shared<const byteVec>(std::move(scratch)) : nullptr;
+    } else {
+        pinned = inflated ? std::make_shared<const byteVec>(std::move(scratch)) : std::make_shared<const byteVec>(body, body + bodySize);
+        cache->insert(file.reader->id(), handle.offset, pinned);
+    }
+    if (pinned != nullptr) {
+        body = pinned->data();
+        bodySize = pinned->size();
+    }
+    return true;
+}
+
+SsTableScanner::SsTableScanner(const SsTableFile& file, bool fillCache)
+    : file_(file)
+    , offset_(ssHeaderBytes)
+    , end_(file.dataEnd)
+    , remaining_(0)
+    , blockIndex_(0)
+    , fillCache_(fillCache) {
+    if (file_.reader == nullptr)
+        throw runtimeError("cannot open sstable");
+    MappedCursor in{file_.reader->data(), ssHeaderBytes - sizeof(u64), end_};
+    remaining_ = in.fixed<u64>();
+    if (!in.ok)
         throw runtimeError("bad sstable header");
+}
 
-    u32 ver = readU32(in);
-    if (ver != ssVersion)
-        throw runtimeError("bad sstable version");
+bool SsTableScanner::nextBlock() {
+    if (blockIndex_ >= file_.index.size())
+        return false;
+    const u8* body = nullptr;
+    usize bodySize = 0;
+    if (!readBlock(file_, file_.index[blockIndex_], fillCache_, block_, body, bodySize))
+        throw runtimeError("corrupt sstable block");
+    blockIndex_++;
+    blockIter_.emplace(body, bodySize);
+    if (!blockIter_->ok())
+        throw runtimeError("corrupt sstable block");
+    return true;
+}
 
-    u64 count = readU64(in);
-    std::vector<SsEntry> out;
-    out.reserve(static_cast<usize>(count));
+bool SsTableScanner::next(SsEntry& out) {
+    if (remaining_ == 0)
+        return false;
 
-    for (u64 i = 0; i < count; i++) {
-        SsEntry e;
-        e.key = readBytes(in);
-        e.seq = readU64(in);
-        e.value = readBytes(in);
-        out.push_back(std::move(e));
+    if (file_.version >= 2) {
+        while (!blockIter_.has_value() || !blockIter_->next()) {
+            if (blockIter_.has_value() && !blockIter_->ok())
+                throw runtimeError("corrupt sstable block");
+            if (!nextBlock())
+                throw runtimeError("corrupt sstable");
+        }
+        out.key = blockIter_->key();
+        out.seq = blockIter_->seq();
+        out.value.assign(blockIter_->value(), blockIter_->value() + blockIter_->valueSize());
+        remaining_--;
+        return true;
     }
+
+    MappedCursor in{file_.reader->data(), offset_, end_};
+    u32 keyLen = 0;
+    const u8* key = in.bytes(keyLen);
+    u64 seq = in.fixed<u64>();
+    u32 valLen = 0;
+    const u8* value = in.bytes(valLen);
+    if (!in.ok)
+        throw runtimeError("corrupt sstable");
+    out.key.assign(key, key + keyLen);
+    out.seq = seq;
+    out.value.assign(value, value + valLen);
+    offset_ = in.offset;
+    remaining_--;
+    return true;
+}
+
+std::vector<SsEntry> ssTableScanAll(const SsTableFile& file) {
+    SsTableScanner scanner(file);
+    std::vector<SsEntry> out;
+    SsEntry e;
+    while (scanner.next(e))
+        out.push_back(std::move(e));
     return out;
 }
 
@@ -133,40 +459,51 @@ static std::optional<usize> findIndexFloor(const std::vector<SsIndexEntry>& inde
     return static_cast<usize>((upper - index.begin()) - 1);
 }
 
+static std::optional<byteVec> blockGet(const SsTableFile& file, const SsIndexEntry& handle, const byteVec& key) {
+    std::shared_ptr<const byteVec> pinned;
+    const u8* body = nullptr;
+    usize bodySize = 0;
+    if (!readBlock(file, handle, true, pinned, body, bodySize))
+        throw runtimeError("corrupt sstable block");
+    SsBlockIter it(body, bodySize);
+    it.seekFloor(key);
+    while (it.next()) {
+        if (it.key() == key)
+            return byteVec(it.value(), it.value() + it.valueSize());
+        if (bytesLess(key, it.key()))
+            return std::nullopt;
+    }
+    if (!it.ok())
+        throw runtimeError("corrupt sstable block");
+    return std::nullopt;
+}
+
 std::optional<byteVec> ssTableGet(const SsTableFile& file, const byteVec& key) {
-    std::ifstream fileStream(file.filePath, std::ios::binary);
-    if (!fileStream.is_open())
+    if (file.reader == nullptr)
         return std::nullopt;
 
     auto floor = findIndexFloor(file.index, key);
-    if (floor.has_value())
-        fileStream.seekg(static_cast<i64>(file.index[*floor].offset));
-    else
-        fileStream.seekg(0);
-
-    if (fileStream.tellg() == 0) {
-        char header[8]{};
-        fileStream.read(header, 8);
-        if (std::string(header, 7) != std::string(ssMagic, 7))
-            return std::nullopt;
-        u32 ver = readU32(fileStream);
-        if (ver != ssVersion)
+    if (file.version >= 2) {
+        if (!floor.has_value())
             return std::nullopt;
-        (void)readU64(fileStream);
+        return blockGet(file, file.index[*floor], key);
     }
 
-    while (fileStream) {
-        byteVec entryKey = readBytes(fileStream);
-        if (!fileStream)
-            break;
-        u64 seq = readU64(fileStream);
-        (void)seq;
-        byteVec value = readBytes(fileStream);
-        if (!fileStream)
+    u64 start = floor.has_value() ? std::max(file.index[*floor].offset, ssHeaderBytes) : ssHeaderBytes;
+
+    // Keys are compared in place; only the matching value is copied out.
+    MappedCursor in{file.reader->data(), start, file.dataEnd};
+    while (in.offset < in.end) {
+        u32 keyLen = 0;
+        const u8* entryKey = in.bytes(keyLen);
+        (void)in.fixed<u64>();
+        u32 valLen = 0;
+        const u8* value = in.bytes(valLen);
+        if (!in.ok)
             break;
-        if (entryKey == key)
-            return value;
-        if (bytesLess(key, entryKey))
+        if (keyLen == key.size() && std::memcmp(entryKey, key.data(), keyLen) == 0)
+            return byteVec(value, value + valLen);
+        if (std::lexicographical_compare(key.begin(), key.end(), entryKey, entryKey + keyLen))
             return std::nullopt;
     }
     return std::nullopt;
@@ -1,6 +1,7 @@
 #include "storage/table.h"
 
-#include "util/crc32.h"
+
+#include "util/log.h"
 
 #include <algorithm>
 #include <chrono>
@@ -8,6 +9,7 @@
 #include <cstring>
 #include <cstdio>
 #include <fstream>
+#include <limits>
 #include <unordered_map>
 
 using std::ifstream;
@@ -17,7 +19,7 @@ using std::string;
 namespace xeondb {
 
 static constexpr const char* metaMagic = "BZMD002";
-static constexpr u32 metaVersion = 2;
+static constexpr u32 metaVersion = 4;
 
 static void metaWriteU32(ofstream& out, u32 v) {
     out.write(reinterpret_cast<const char*>(&v), sizeof(v));
@@ -60,10 +62,6 @@ static path manifestPath(const path& dir) {
     return dir / "manifest.bin";
 }
 
-static path commitLogPath(const path& dir) {
-    return dir / "commitlog.bin";
-}
-
 static byteVec decoratedKeyBytes(const byteVec& pkBytes) {
     i64 token = murmur3Token(pkBytes);
     u64 flipped = static_cast<u64>(token) ^ 0x8000000000000000ULL;
@@ -81,11 +79,12 @@ static byteVec decoratedKeyBytes(const byteVec& pkBytes) {
     return out;
 }
 
-static byteVec pkBytesFromDecoratedKeyString(const string& decorated) {
-    if (decorated.size() < 8)
-        return {};
-    const u8* p = reinterpret_cast<const u8*>(decorated.data());
-    return byteVec(p + 8, p + decorated.size());
+static void pkBytesFromDecoratedKey(const byteVec& decorated, byteVec& out) {
+    if (decorated.size() < 8) {
+        out.clear();
+        return;
+    }
+    out.assign(decorated.begin() + 8, decorated.end());
 }
 
 static int comparePkBytes(ColumnType type, const byteVec& a, const byteVec& b) {
@@ -190,7 +189,9 @@ static string decoratedKeyString(const byteVec& pkBytes) {
     return string(reinterpret_cast<const char*>(bytes.data()), reinterpret_cast<const char*>(bytes.data() + bytes.size()));
 }
 
-TableSchema readSchemaFromMetadata(const path& tableDirPath) {
+// Version 2 files predate table options and version 3 the row cache; missing
+// options read back with the defaults.
+static void readMetadata(const path& tableDirPath, TableSchema& schema, TableOptions& options) {
     ifstream stream(metadataPath(tableDirPath), std::ios::binary);
     if (!stream.is_open())
         throw runtimeError("Missing metadata");
@@ -201,7 +202,7 @@ TableSchema readSchemaFromMetadata(const path& tableDirPath) {
     char pad = 0;
     stream.read(&pad, 1);
     auto version = metaReadU32(stream);
-    if (version != metaVersion)
+    if (version < 2 || version > metaVersion)
         throw runtimeError("Bad metadata");
     (void)metaReadString(stream);
     (void)metaReadString(stream);
@@ -209,7 +210,7 @@ TableSchema readSchemaFromMetadata(const path& tableDirPath) {
     (void)metaReadU64(stream);
     auto pkIndex = metaReadU32(stream);
     auto colCount = metaReadU32(stream);
-    TableSchema schema;
+    schema = TableSchema{};
     schema.columns.reserve(colCount);
     for (u32 i = 0; i < colCount; i++) {
         auto name = metaReadString(stream);
@@ -218,38 +219,161 @@ TableSchema readSchemaFromMetadata(const path& tableDirPath) {
         schema.columns.push_back(ColumnDef{name, static_cast<ColumnType>(typeId)});
     }
     schema.primaryKeyIndex = pkIndex;
+
+    options = TableOptions{};
+    if (version >= 3) {
+        u8 strategyId = 0;
+        stream.read(reinterpret_cast<char*>(&strategyId), 1);
+        if (!stream)
+            throw runtimeError("Bad metadata");
+        if (strategyId == static_cast<u8>(CompactionStrategy::Leveled))
+            options.compaction = CompactionStrategy::Leveled;
+    }
+    if (version >= 4) {
+        options.rowCacheRows = metaReadU64(stream);
+        if (!stream)
+            throw runtimeError("Bad metadata");
+    }
+}
+
+static bool ssTableOrderLess(const SsTableFile& a, const SsTableFile& b) {
+    if (a.level != b.level)
+        return a.level > b.level;
+    if (a.level == 0)
+        return false;
+    return std::lexicographical_compare(a.minKey.begin(), a.minKey.end(), b.minKey.begin(), b.minKey.end());
+}
+
+// Restores the manifest order: deepest level first, each level >= 1 sorted by
+// minKey, L0 last in flush order. Iterating backwards is then newest-first.
+static void sortSsTables(std::vector<SsTableFile>& files) {
+    std::stable_sort(files.begin(), files.end(), ssTableOrderLess);
+}
+
+static std::vector<ManifestSsTable> manifestFilesFor(const std::vector<SsTableFile>& files) {
+    std::vector<ManifestSsTable> out;
+    out.reserve(files.size());
+    for (const auto& f : files)
+        out.push_back(ManifestSsTable{f.filePath.filename().string(), f.level, f.minKey, f.maxKey});
+    return out;
+}
+
+TableSchema readSchemaFromMetadata(const path& tableDirPath) {
+    TableSchema schema;
+    TableOptions options;
+    readMetadata(tableDirPath, schema, options);
     return schema;
 }
 
-Table::Table(path tableDirPath, string keyspace, string table, string uuid, TableSchema schema, TableSettings settings)
+TableOptions readOptionsFromMetadata(const path& tableDirPath) {
+    TableSchema schema;
+    TableOptions options;
+    readMetadata(tableDirPath, schema, options);
+    return options;
+}
+
+u64 readLastFlushedSeq(const path& tableDirPath) {
+    return readManifest(manifestPath(tableDirPath)).lastFlushedSeq;
+}
+
+static bool isTableLogFile(const string& name) {
+    return name.rfind("commitlog", 0) == 0 || name.rfind("wal-", 0) == 0;
+}
+
+static bool hasTableLog(const path& dir) {
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        if (entry.is_regular_file() && isTableLogFile(entry.path().filename().string()))
+            return true;
+    }
+    return false;
+}
+
+static void removeTableLog(const path& dir) {
+    std::error_code ec;
+    std::vector<path> files;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        if (entry.is_regular_file() && isTableLogFile(entry.path().filename().string()))
+            files.push_back(entry.path());
+    }
+    for (const auto& file : files)
+        std::filesystem::remove(file, ec);
+}
+
+Table::Table(path tableDirPath, string keyspace, string table, string uuid, TableSchema schema, TableOptions options, TableSettings settings,
+        std::shared_ptr<CompactionExecutor> compaction, std::shared_ptr<BlockCache> blockCache, std::shared_ptr<CommitLog> sharedLog)
     : tableDirPath_(std::move(tableDirPath))
     , keyspace_(std::move(keyspace))
     , table_(std::move(table))
     , uuid_(std::move(uuid))
     , schema_(std::move(schema))
+    , options_(options)
     , settings_(settings)
     , nextSeq_(1)
-    , walStop_(false) {
+    , writeGen_(0)
+    , commitLog_(sharedLog != nullptr ? std::move(sharedLog) : std::make_shared<CommitLog>(false, walIoBackendFromName(settings_.walIoBackend)))
+    , ownsCommitLog_(!commitLog_->shared())
+    , memTable_(std::make_shared<MemTable>())
+    , sealedCount_(0)
+    , flushedCount_(0)
+    , flushStop_(false)
+    , flushRunning_(false)
+    , compaction_(std::move(compaction))
+    , blockCache_(std::move(blockCache))
+    , compactionStop_(false)
+    , compactionScheduled_(false) {
+    if (options_.rowCacheRows > 0)
+        rowCache_ = std::make_unique<RowCache>(static_cast<usize>(options_.rowCacheRows));
     manifest_.lastFlushedSeq = 0;
     manifest_.nextSstableGen = 1;
+    publishSsTablesLocked();
 }
 
 Table::~Table() {
+    pauseCompaction();
+    stopFlushThread();
     stopWalThread();
 }
 
+CommitLogStats Table::walStats() const {
+    return commitLog_->stats();
+}
+
 void Table::shutdown() {
+    pauseCompaction();
+    stopFlushThread();
     stopWalThread();
+    if (!ownsCommitLog_)
+        return;
     std::lock_guard<std::mutex> lock(mutex_);
-    commitLog_.close();
+    commitLog_->close();
 }
 
 void Table::truncate() {
-    stopWalThread();
+    pauseCompaction();
+    stopFlushThread();
 
+    // Seqs keep counting up: records already in the log fall at or below the
+    // new lastFlushedSeq, so they never replay and their segments retire as usual.
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        commitLog_.close();
+        writeGen_.fetch_add(1, std::memory_order_release);
+        memTable_ = std::make_shared<MemTable>();
+        immutables_.clear();
+        sealedCount_ = 0;
+        flushedCount_ = 0;
+        flushError_.clear();
+        ssTables_.clear();
+        leveledCursors_.assign(leveledMaxLevel + 1, byteVec{});
+        publishSsTablesLocked();
+        if (rowCache_ != nullptr)
+            rowCache_->clear();
+        writeGen_.fetch_add(1, std::memory_order_release);
+        manifest_.lastFlushedSeq = nextSeq_ - 1;
+        manifest_.nextSstableGen = 1;
+        manifest_.sstableFiles.clear();
+        writeManifestAtomic(manifestPath(tableDirPath_), manifest_);
+        commitLog_->releaseThrough(logStream(), manifest_.lastFlushedSeq);
     }
 
     std::error_code ec;
@@ -264,10 +388,6 @@ void Table::truncate() {
                 std::filesystem::remove(entry.path(), ec);
                 ec.clear();
             }
-            if (name == "manifest.bin" || name == "commitlog.bin") {
-                std::filesystem::remove(entry.path(), ec);
-                ec.clear();
-            }
         }
 
         auto tmpDir = tableDirPath_ / "tmp";
@@ -277,19 +397,8 @@ void Table::truncate() {
         ec.clear();
     }
 
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        memTable_.clear();
-        ssTables_.clear();
-        manifest_.lastFlushedSeq = 0;
-        manifest_.nextSstableGen = 1;
-        manifest_.sstableFiles.clear();
-        nextSeq_ = 1;
-        writeManifestAtomic(manifestPath(tableDirPath_), manifest_);
-        commitLog_.openOrCreate(commitLogPath(tableDirPath_), true);
-    }
-
-    startWalThread();
+    startFlushThread();
+    resumeCompaction();
 }
 
 const std::filesystem::path& Table::dir() const {
@@ -312,6 +421,10 @@ const TableSchema& Table::schema() const {
     return schema_;
 }
 
+const TableOptions& Table::options() const {
+    return options_;
+}
+
 void Table::writeMetadata() {
     ofstream stream(metadataPath(tableDirPath_), std::ios::binary | std::ios::trunc);
     if (!stream.is_open())
@@ -332,13 +445,15 @@ void Table::writeMetadata() {
         u8 typeId = static_cast<u8>(cols.type);
         stream.write(reinterpret_cast<const char*>(&typeId), 1);
     }
+    u8 strategyId = static_cast<u8>(options_.compaction);
+    stream.write(reinterpret_cast<const char*>(&strategyId), 1);
+    metaWriteU64(stream, options_.rowCacheRows);
     stream.flush();
     stream.close();
 }
 
 void Table::loadMetadata() {
-    auto schema = readSchemaFromMetadata(tableDirPath_);
-    schema_ = schema;
+    readMetadata(tableDirPath_, schema_, options_);
 }
 
 void Table::openOrCreateFiles(bool createNew) {
@@ -349,122 +464,249 @@ void Table::openOrCreateFiles(bool createNew) {
         manifest_.nextSstableGen = 1;
         manifest_.sstableFiles.clear();
         writeManifestAtomic(manifestPath(tableDirPath_), manifest_);
-        commitLog_.openOrCreate(commitLogPath(tableDirPath_), true);
     } else {
         loadMetadata();
         manifest_ = readManifest(manifestPath(tableDirPath_));
-        commitLog_.openOrCreate(commitLogPath(tableDirPath_), false);
     }
 }
 
-static bool readExact(ifstream& in, void* p, usize n) {
-    in.read(reinterpret_cast<char*>(p), static_cast<std::streamsize>(n));
-    return static_cast<usize>(in.gcount()) == n;
-}
+void Table::recover(std::vector<CommitLogRecord> carried) {
+    const auto started = std::chrono::steady_clock::now();
+    u64 replayedRecords = 0;
+    u64 replayedBytes = 0;
+    usize ssTableCount = 0;
+    auto replay = [&](u64 seq, string& key, byteVec& value) {
+        if (replayLocked(seq, key, value)) {
+            replayedRecords++;
+            replayedBytes += key.size() + value.size();
+        }
+    };
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ssTables_.clear();
+        for (const auto& tableFile : manifest_.sstableFiles) {
+            auto loaded = loadSsTableIndex(tableDirPath_ / tableFile.name, blockCache_);
+            loaded.level = tableFile.level;
+            loaded.minKey = tableFile.minKey;
+            loaded.maxKey = tableFile.maxKey;
+            ssTables_.push_back(std::move(loaded));
+        }
+        leveledCursors_.assign(leveledMaxLevel + 1, byteVec{});
+
+        nextSeq_ = manifest_.lastFlushedSeq + 1;
+        immutables_.clear();
+        memTable_ = std::make_shared<MemTable>();
+
+        // Records from a log this table no longer writes to; they are copied
+        // into its current log before that log is dropped.
+        std::vector<CommitLogRecord> foreign;
+        std::vector<CommitLogRecord> native;
+        auto collect = [](std::vector<CommitLogRecord>& into) {
+            return [&into](stringView, u64 seq, string& key, byteVec& value) {
+                into.push_back(CommitLogRecord{seq, std::move(key), std::move(value)});
+            };
+        };
+        bool hadTableLog = false;
+        if (ownsCommitLog_) {
+            foreign = std::move(carried);
+            if (foreign.empty()) {
+                commitLog_->open(tableDirPath_, settings_.walSegmentBytes, [&](stringView, u64 seq, string& key, byteVec& value) {
+                    replay(seq, key, value);
+                });
+            } else {
+                commitLog_->open(tableDirPath_, settings_.walSegmentBytes, collect(native));
+            }
+        } else {
+            native = std::move(carried);
+            // Segments of this table's own log, from before walShared was set.
+            hadTableLog = hasTableLog(tableDirPath_);
+            if (hadTableLog) {
+                CommitLog tableLog;
+                tableLog.open(tableDirPath_, settings_.walSegmentBytes, collect(foreign));
+            }
+        }
 
-void Table::recover() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    ssTables_.clear();
-    for (const auto& tableFiles : manifest_.sstableFiles) {
-        ssTables_.push_back(loadSsTableIndex(tableDirPath_ / tableFiles));
-    }
-
-    nextSeq_ = manifest_.lastFlushedSeq + 1;
-
-    ifstream stream(commitLogPath(tableDirPath_), std::ios::binary);
-    if (stream.is_open()) {
-        char magic[8]{};
-        if (readExact(stream, magic, 8)) {
-            u32 ver = 0;
-            if (readExact(stream, &ver, sizeof(ver))) {
-                if (string(magic, commitLogMagicLen) == string(commitLogMagic, commitLogMagicLen) && ver == commitLogVersion) {
-                    while (stream) {
-                        u64 seq = 0;
-                        u32 keyLen = 0;
-                        u32 valLen = 0;
-                        if (!readExact(stream, &seq, sizeof(seq)))
-                            break;
-                        if (!readExact(stream, &keyLen, sizeof(keyLen)))
-                            break;
-                        if (!readExact(stream, &valLen, sizeof(valLen)))
-                            break;
-                        string key;
-                        key.resize(keyLen);
-                        if (keyLen > 0) {
-                            if (!readExact(stream, key.data(), keyLen))
-                                break;
-                        }
-                        byteVec val;
-                        val.resize(valLen);
-                        if (valLen > 0) {
-                            if (!readExact(stream, val.data(), valLen))
-                                break;
-                        }
-                        u32 c = 0;
-                        if (!readExact(stream, &c, sizeof(c)))
-                            break;
-
-                        byteVec buf;
-                        buf.reserve(sizeof(seq) + sizeof(keyLen) + sizeof(valLen) + keyLen + valLen);
-                        auto add = [&](const void* p, usize n) {
-                            const u8* bytePtr = static_cast<const u8*>(p);
-                            buf.insert(buf.end(), bytePtr, bytePtr + n);
-                        };
-                        add(&seq, sizeof(seq));
-                        add(&keyLen, sizeof(keyLen));
-                        add(&valLen, sizeof(valLen));
-                        if (keyLen > 0)
-                            add(key.data(), key.size());
-                        if (valLen > 0)
-                            add(val.data(), val.size());
-                        if (crc32(buf.data(), buf.size()) != c)
-                            break;
-
-                        memTable_.put(key, seq, val);
-                        if (seq >= nextSeq_)
-                            nextSeq_ = seq + 1;
-                    }
-                }
+        if (!foreign.empty()) {
+            for (const auto& r : foreign) {
+                if (r.seq > manifest_.lastFlushedSeq)
+                    commitLog_->append(logStream(), r.seq, r.key, r.value);
+            }
+            commitLog_->fsyncNow();
+        }
+        if (!foreign.empty() || !native.empty()) {
+            // Both sources are in seq order on their own; a crash midway through
+            // an earlier copy can leave a record in both.
+            native.insert(native.end(), std::make_move_iterator(foreign.begin()), std::make_move_iterator(foreign.end()));
+            std::stable_sort(native.begin(), native.end(), [](const CommitLogRecord& a, const CommitLogRecord& b) {
+                return a.seq < b.seq;
+            });
+            u64 last = 0;
+            for (auto& r : native) {
+                if (r.seq == last)
+                    continue;
+                last = r.seq;
+                replay(r.seq, r.key, r.value);
             }
         }
+        if (hadTableLog)
+            removeTableLog(tableDirPath_);
+        commitLog_->releaseThrough(logStream(), manifest_.lastFlushedSeq);
+        maybeScheduleCompactionLocked();
+        publishSsTablesLocked();
+        ssTableCount = ssTables_.size();
     }
 
     startWalThread();
+    startFlushThread();
+
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+    xeondb::log(replayedRecords > 0 ? LogLevel::INFO : LogLevel::DEBUG,
+        string("Recovered table=") + keyspace_ + "." + table_ + " sstables=" + std::to_string(ssTableCount) +
+            " records=" + std::to_string(replayedRecords) + " bytes=" + std::to_string(replayedBytes) + " micros=" + std::to_string(micros));
+}
+
+// Unflushed records come back in log order, sealed at the usual size so the
+// flusher picks them up again and each memtable covers a seq range.
+bool Table::replayLocked(u64 seq, string& key, byteVec& value) {
+    if (seq >= nextSeq_)
+        nextSeq_ = seq + 1;
+    if (seq <= manifest_.lastFlushedSeq)
+        return false;
+    memTable_->put(key, seq, value);
+    if (settings_.memtableMaxBytes > 0 && memTable_->bytes() >= settings_.memtableMaxBytes) {
+        immutables_.push_back(SealedMemTable{std::move(memTable_)});
+        memTable_ = std::make_shared<MemTable>();
+        sealedCount_++;
+    }
+    return true;
+}
+
+stringView Table::logStream() const {
+    return ownsCommitLog_ ? stringView() : stringView(uuid_);
+}
+
+u64 Table::appendLogLocked(u64 seq, const string& dkey, const byteVec& value) {
+    std::string_view key(dkey.data(), dkey.size());
+    if (settings_.walFsync == "group")
+        return commitLog_->appendGrouped(logStream(), seq, key, value);
+    if (settings_.walFsync == "always") {
+        // Buffered, so the sync writes and fsyncs it in one go.
+        commitLog_->appendGrouped(logStream(), seq, key, value);
+        commitLog_->fsyncNow();
+        return 0;
+    }
+    commitLog_->append(logStream(), seq, key, value);
+    return 0;
 }
 
 void Table::putRow(const byteVec& pkBytes, const byteVec& rowBytes) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    u64 seq = nextSeq_++;
-    string dkey = decoratedKeyString(pkBytes);
-    commitLog_.append(seq, std::string_view(dkey.data(), dkey.size()), rowBytes);
-    if (settings_.walFsync == "always")
-        commitLog_.fsyncNow();
-    memTable_.put(dkey, seq, rowBytes);
+    u64 ticket = 0;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        waitForImmutableRoomLocked(lock);
+        u64 seq = nextSeq_++;
+        string dkey = decoratedKeyString(pkBytes);
+        ticket = appendLogLocked(seq, dkey, rowBytes);
+        writeGen_.fetch_add(1, std::memory_order_release);
+        memTable_->put(dkey, seq, rowBytes);
+        if (rowCache_ != nullptr)
+            rowCache_->update(dkey, rowBytes);
+        writeGen_.fetch_add(1, std::memory_order_release);
+        if (settings_.memtableMaxBytes > 0 && memTable_->bytes() >= settings_.memtableMaxBytes)
+            sealActiveLocked();
+    }
+    // Group commit: the write is visible already, but not acknowledged until its batch is on disk.
+    if (ticket != 0)
+        commitLog_->waitDurable(ticket);
+}
+
+void Table::putBatch(const std::vector<std::pair<byteVec, byteVec>>& rows) {
+    if (rows.size() <= 1) {
+        for (const auto& r : rows)
+            putRow(r.first, r.second);
+        return;
+    }
+    std::vector<CommitLog::BatchEntry> entries;
+    entries.reserve(rows.size());
+    for (const auto& r : rows)
+        entries.push_back({decoratedKeyString(r.first), r.second});
+
+    u64 ticket = 0;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        waitForImmutableRoomLocked(lock);
+        u64 firstSeq = nextSeq_;
+        nextSeq_ += entries.size();
+        if (settings_.walFsync == "group") {
+            ticket = commitLog_->appendBatchGrouped(logStream(), firstSeq, entries);
+        } else if (settings_.walFsync == "always") {
+            commitLog_->appendBatchGrouped(logStream(), firstSeq, entries);
+            commitLog_->fsyncNow();
+        } else {
+            commitLog_->appendBatch(logStream(), firstSeq, entries);
+        }
+        writeGen_.fetch_add(1, std::memory_order_release);
+        u64 seq = firstSeq;
+        for (const auto& [dkey, rowBytes] : entries) {
+            memTable_->put(dkey, seq++, rowBytes);
+            if (rowCache_ != nullptr)
+                rowCache_->update(dkey, rowBytes);
+        }
+        writeGen_.fetch_add(1, std::memory_order_release);
+        if (settings_.memtableMaxBytes > 0 && memTable_->bytes() >= settings_.memtableMaxBytes)
+            sealActiveLocked();
+    }
+    if (ticket != 0)
+        commitLog_->waitDurable(ticket);
 }
 
 void Table::deleteRow(const byteVec& pkBytes) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    u64 seq = nextSeq_++;
-    string dkey = decoratedKeyString(pkBytes);
-    byteVec tombstone;
-    commitLog_.append(seq, std::string_view(dkey.data(), dkey.size()), tombstone);
-    if (settings_.walFsync == "always")
-        commitLog_.fsyncNow();
-    memTable_.put(dkey, seq, tombstone);
+    u64 ticket = 0;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        waitForImmutableRoomLocked(lock);
+        u64 seq = nextSeq_++;
+        string dkey = decoratedKeyString(pkBytes);
+        byteVec tombstone;
+        ticket = appendLogLocked(seq, dkey, tombstone);
+        writeGen_.fetch_add(1, std::memory_order_release);
+        memTable_->put(dkey, seq, tombstone);
+        if (rowCache_ != nullptr)
+            rowCache_->update(dkey, tombstone);
+        writeGen_.fetch_add(1, std::memory_order_release);
+        if (settings_.memtableMaxBytes > 0 && memTable_->bytes() >= settings_.memtableMaxBytes)
+            sealActiveLocked();
+    }
+    if (ticket != 0)
+        commitLog_->waitDurable(ticket);
 }
 
-std::optional<byteVec> Table::getRow(const byteVec& pkBytes) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    string dkey = decoratedKeyString(pkBytes);
-    auto memory = memTable_.get(dkey);
-    if (memory.has_value()) {
-        if (memory->value.empty())
-            return std::nullopt;
-        return memory->value;
-    }
-    auto dkeyBytes = decoratedKeyBytes(pkBytes);
-    for (usize i = ssTables_.size(); i-- > 0;) {
-        auto table = ssTableGet(ssTables_[i], dkeyBytes);
+static std::optional<byteVec> getRowFromSsTables(const std::vector<SsTableFile>& ssTables, const string& dkey) {
+    byteVec dkeyBytes(dkey.begin(), dkey.end());
+    usize i = ssTables.size();
+    while (i > 0) {
+        const SsTableFile* candidate = &ssTables[i - 1];
+        if (candidate->level == 0) {
+            i--;
+        } else {
+            // Files of one level >= 1 never overlap and sit together sorted by
+            // minKey, so only the last one starting at or before the key can
+            // hold it.
+            usize levelEnd = i;
+            usize levelBegin = i - 1;
+            while (levelBegin > 0 && ssTables[levelBegin - 1].level == candidate->level)
+                levelBegin--;
+            auto first = ssTables.begin() + static_cast<std::ptrdiff_t>(levelBegin);
+            auto last = ssTables.begin() + static_cast<std::ptrdiff_t>(levelEnd);
+            auto after = std::upper_bound(first, last, dkeyBytes, [](const byteVec& key, const SsTableFile& f) {
+                return std::lexicographical_compare(key.begin(), key.end(), f.minKey.begin(), f.minKey.end());
+            });
+            candidate = after == first ? nullptr : &*(after - 1);
+            i = levelBegin;
+        }
+        if (candidate == nullptr || !ssTableMayContain(*candidate, dkeyBytes))
+            continue;
+        auto table = ssTableGet(*candidate, dkeyBytes);
         if (table.has_value()) {
             if (table->empty())
                 return std::nullopt;
@@ -474,52 +716,94 @@ std::optional<byteVec> Table::getRow(const byteVec& pkBytes) {
     return std::nullopt;
 }
 
-std::vector<Table::ScanRow> Table::scanAllRowsByPk(bool desc) {
-    TableSchema schemaSnap;
-    std::vector<std::pair<string, MemValue>> memSnap;
-    std::vector<SsTableFile> ssSnap;
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        schemaSnap = schema_;
-        memSnap = memTable_.snapshot();
-        ssSnap = ssTables_;
+std::optional<byteVec> Table::getRow(const byteVec& pkBytes) {
+    string dkey = decoratedKeyString(pkBytes);
+    if (rowCache_ != nullptr) {
+        byteVec cached;
+        if (rowCache_->lookup(dkey, cached)) {
+            if (cached.empty())
+                return std::nullopt;
+            return cached;
+        }
     }
 
-    std::unordered_map<string, std::pair<u64, byteVec>> latest;
-    latest.reserve(memSnap.size() + 32);
-
-    for (const auto& kv : memSnap) {
-        const auto& key = kv.first;
-        const auto& mv = kv.second;
-        auto it = latest.find(key);
-        if (it == latest.end() || mv.seq > it->second.first)
-            latest[key] = {mv.seq, mv.value};
+    // Nothing here takes mutex_: the view pins the memtables and SSTables it
+    // lists, and the skip list tolerates the concurrent writer.
+    const u64 gen = writeGen_.load(std::memory_order_acquire);
+    std::shared_ptr<const ReadView> view;
+    {
+        std::shared_lock<std::shared_mutex> lock(viewMutex_);
+        view = view_;
     }
 
-    for (const auto& ss : ssSnap) {
-        auto entries = ssTableScanAll(ss);
-        for (const auto& e : entries) {
-            string key(reinterpret_cast<const char*>(e.key.data()), reinterpret_cast<const char*>(e.key.data() + e.key.size()));
-            auto it = latest.find(key);
-            if (it == latest.end() || e.seq > it->second.first)
-                latest[key] = {e.seq, e.value};
+    std::optional<byteVec> row;
+    bool resolved = false;
+    for (const auto& memTable : view->memTables) {
+        auto memory = memTable->get(dkey);
+        if (memory.has_value()) {
+            if (!memory->value.empty())
+                row = std::move(memory->value);
+            resolved = true;
+            break;
         }
     }
+    if (resolved && rowCache_ == nullptr)
+        return row;
+
+    if (!resolved)
+        row = getRowFromSsTables(*view->ssTables, dkey);
+    // A write in progress (odd gen) or since gen may not be reflected in row;
+    // skip the fill rather than cache something stale.
+    if (rowCache_ != nullptr && (gen & 1) == 0)
+        rowCache_->insertIfCurrent(dkey, row.has_value() ? *row : byteVec{}, writeGen_, gen);
+    return row;
+}
 
-    std::vector<Table::ScanRow> out;
-    out.reserve(latest.size());
-    for (auto& kv : latest) {
-        const string& dkey = kv.first;
-        const byteVec& rowBytes = kv.second.second;
-        if (rowBytes.empty())
+Table::RowIterator::RowIterator(std::vector<std::unique_ptr<EntrySource>> sources)
+    : merged_(std::move(sources)) {
+}
+
+bool Table::RowIterator::next(ScanRow& out) {
+    while (merged_.next(entry_)) {
+        if (entry_.value.empty())
             continue;
+        pkBytesFromDecoratedKey(entry_.key, out.pkBytes);
+        out.rowBytes = std::move(entry_.value);
+        return true;
+    }
+    return false;
+}
 
-        Table::ScanRow r;
-        r.pkBytes = pkBytesFromDecoratedKeyString(dkey);
-        r.rowBytes = rowBytes;
-        out.push_back(std::move(r));
+Table::RowIterator Table::scanRows() {
+    std::vector<std::unique_ptr<EntrySource>> sources;
+    std::vector<SsTableFile> ssSnap;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Writes after this point carry a higher seq and stay invisible.
+        const u64 snapshotSeq = nextSeq_ - 1;
+        sources.push_back(std::make_unique<MemTableEntrySource>(memTable_, snapshotSeq));
+        for (const auto& sealed : immutables_)
+            sources.push_back(std::make_unique<MemTableEntrySource>(sealed.memTable, snapshotSeq));
+        ssSnap = ssTables_;
+    }
+    for (const auto& ss : ssSnap)
+        sources.push_back(std::make_unique<SsTableScanner>(ss));
+    return RowIterator(std::move(sources));
+}
+
+std::vector<Table::ScanRow> Table::scanAllRowsByPk(bool desc) {
+    TableSchema schemaSnap;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        schemaSnap = schema_;
     }
 
+    std::vector<Table::ScanRow> out;
+    auto rows = scanRows();
+    Table::ScanRow r;
+    while (rows.next(r))
+        out.push_back(std::move(r));
+
     ColumnType pkType = schemaSnap.columns[schemaSnap.primaryKeyIndex].type;
     std::sort(out.begin(), out.end(), [&](const Table::ScanRow& a, const Table::ScanRow& b) {
         int cmp = comparePkBytes(pkType, a.pkBytes, b.pkBytes);
@@ -538,97 +822,370 @@ std::vector<Table::ScanRow> Table::scanAllRowsByPk(bool desc) {
 }
 
 void Table::flush() {
-    std::vector<std::pair<string, MemValue>> snap;
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (memTable_.size() == 0)
-            return;
-        snap = memTable_.snapshot();
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (memTable_->size() > 0)
+        sealActiveLocked();
+    const u64 target = sealedCount_;
+    flushDoneCv_.wait(lock, [&]() {
+        return flushedCount_ >= target || !flushError_.empty() || flushStop_;
+    });
+    if (flushedCount_ < target) {
+        if (!flushError_.empty())
+            throw runtimeError(flushError_);
+        throw runtimeError("flush aborted");
     }
+}
 
-    std::vector<SsEntry> entries;
-    entries.reserve(snap.size());
-    u64 maxSeq = 0;
-    for (auto& kv : snap) {
-        byteVec key;
-        key.insert(key.end(), reinterpret_cast<const u8*>(kv.first.data()), reinterpret_cast<const u8*>(kv.first.data() + kv.first.size()));
-        entries.push_back(SsEntry{std::move(key), kv.second.seq, kv.second.value});
-        if (kv.second.seq > maxSeq)
-            maxSeq = kv.second.seq;
-    }
-
-    std::sort(entries.begin(), entries.end(), [](const SsEntry& lhs, const SsEntry& rhs) {
-        usize minSize = std::min(lhs.key.size(), rhs.key.size());
-        for (usize i = 0; i < minSize; i++) {
-            if (lhs.key[i] < rhs.key[i])
-                return true;
-            if (lhs.key[i] > rhs.key[i])
-                return false;
-        }
-        return lhs.key.size() < rhs.key.size();
+void Table::requestFlush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // A queued flush releases the log as it lands; another roll asks again.
+    if (immutables_.empty())
+        sealActiveLocked();
+}
+
+void Table::sealActiveLocked() {
+    if (memTable_->size() == 0)
+        return;
+
+    // The log is not touched: its segments are retired once the flush passes them.
+    immutables_.push_back(SealedMemTable{std::move(memTable_)});
+    memTable_ = std::make_shared<MemTable>();
+    sealedCount_++;
+    publishViewLocked();
+    flushCv_.notify_one();
+}
+
+void Table::publishViewLocked() {
+    auto view = std::make_shared<ReadView>();
+    view->memTables.reserve(immutables_.size() + 1);
+    view->memTables.push_back(memTable_);
+    for (auto it = immutables_.rbegin(); it != immutables_.rend(); ++it)
+        view->memTables.push_back(it->memTable);
+    view->ssTables = ssTablesView_;
+    std::unique_lock<std::shared_mutex> lock(viewMutex_);
+    view_ = std::move(view);
+}
+
+void Table::publishSsTablesLocked() {
+    // Copied only when the file set changes: on flush, compaction and truncate.
+    ssTablesView_ = std::make_shared<const std::vector<SsTableFile>>(ssTables_);
+    publishViewLocked();
+}
+
+void Table::waitForImmutableRoomLocked(std::unique_lock<std::mutex>& lock) {
+    const usize maxImmutable = settings_.memtableMaxImmutable == 0 ? 1 : settings_.memtableMaxImmutable;
+    flushDoneCv_.wait(lock, [&]() {
+        return immutables_.size() < maxImmutable || flushStop_ || !flushError_.empty() || !flushRunning_;
     });
+    if (immutables_.size() >= maxImmutable && !flushError_.empty())
+        throw runtimeError("memtable flush failing: " + flushError_);
+}
 
+SsTableWriteOptions Table::ssTableWriteOptions() const {
+    SsTableWriteOptions options;
+    options.blockBytes = settings_.sstableBlockBytes;
+    options.restartInterval = settings_.sstableIndexStride;
+    options.bloomBitsPerKey = settings_.sstableBloomBitsPerKey;
+    options.compression = settings_.sstableCompression == "none" ? SsCompression::None : SsCompression::Lz;
+    return options;
+}
+
+void Table::flushSealed(const SealedMemTable& sealed) {
     string fileName;
     {
         std::lock_guard<std::mutex> lock(mutex_);
         char buf[64];
         std::snprintf(buf, sizeof(buf), "sstable-%06llu.bin", static_cast<unsigned long long>(manifest_.nextSstableGen));
         fileName = buf;
+        manifest_.nextSstableGen += 1;
     }
 
+    // The sealed memtable is already in key order; only its newest version of
+    // each key is written.
     auto tmpPath = tableDirPath_ / "tmp" / (fileName + ".tmp");
     auto finalPath = tableDirPath_ / fileName;
-    writeSsTable(tmpPath, entries, settings_.sstableIndexStride);
+    u64 maxSeq = 0;
+    SsTableWriter writer(tmpPath, ssTableWriteOptions());
+    MemTableEntrySource source(sealed.memTable, std::numeric_limits<u64>::max());
+    SsEntry entry;
+    while (source.next(entry)) {
+        maxSeq = std::max(maxSeq, entry.seq);
+        writer.add(entry);
+    }
+    writer.finish();
     std::filesystem::rename(tmpPath, finalPath);
+    auto loaded = loadSsTableIndex(finalPath, blockCache_);
+    if (writer.entryCount() > 0) {
+        loaded.minKey = writer.minKey();
+        loaded.maxKey = writer.maxKey();
+    }
 
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        manifest_.sstableFiles.push_back(fileName);
-        manifest_.nextSstableGen += 1;
-        manifest_.lastFlushedSeq = maxSeq;
+        ssTables_.push_back(std::move(loaded));
+        manifest_.sstableFiles = manifestFilesFor(ssTables_);
+        if (maxSeq > manifest_.lastFlushedSeq)
+            manifest_.lastFlushedSeq = maxSeq;
         writeManifestAtomic(manifestPath(tableDirPath_), manifest_);
-        ssTables_.push_back(loadSsTableIndex(finalPath));
-        memTable_.clear();
-        commitLog_.openOrCreate(commitLogPath(tableDirPath_), true);
+        immutables_.pop_front();
+        // The rows move from the memtable to the SSTable in one step for readers.
+        publishSsTablesLocked();
+        flushedCount_++;
+        commitLog_->releaseThrough(logStream(), manifest_.lastFlushedSeq);
+        maybeScheduleCompactionLocked();
     }
 }
 
-void Table::startWalThread() {
-    if (settings_.walFsync != "periodic")
+void Table::startFlushThread() {
+    if (flushThread_.joinable())
         return;
-    if (walThread_.joinable())
-        return;
-    walStop_ = false;
-    walThread_ = std::thread([this]() {
-        walThreadMain();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        flushStop_ = false;
+        flushError_.clear();
+        flushRunning_ = true;
+    }
+    flushThread_ = std::thread([this]() {
+        flushThreadMain();
     });
 }
 
-void Table::stopWalThread() {
-    walStop_ = true;
-    if (walThread_.joinable())
-        walThread_.join();
+void Table::stopFlushThread() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        flushStop_ = true;
+    }
+    flushCv_.notify_all();
+    flushDoneCv_.notify_all();
+    if (flushThread_.joinable())
+        flushThread_.join();
+    std::lock_guard<std::mutex> lock(mutex_);
+    flushRunning_ = false;
 }
 
-void Table::walThreadMain() {
+void Table::flushThreadMain() {
     using namespace std::chrono;
-    auto interval = milliseconds(settings_.walFsyncIntervalMs == 0 ? 50 : settings_.walFsyncIntervalMs);
-    while (!walStop_.load()) {
-        std::this_thread::sleep_for(interval);
-        bool doFsync = false;
+    for (;;) {
+        SealedMemTable next;
         {
+            std::unique_lock<std::mutex> lock(mutex_);
+            flushCv_.wait(lock, [&]() {
+                return flushStop_ || !immutables_.empty();
+            });
+            if (flushStop_)
+                return;
+            next = immutables_.front();
+        }
+
+        try {
+            flushSealed(next);
             std::lock_guard<std::mutex> lock(mutex_);
-            if (commitLog_.isDirty())
-                doFsync = true;
+            flushError_.clear();
+        } catch (const std::exception& e) {
+            xeondb::log(LogLevel::ERROR, string("Flush failed table=") + keyspace_ + "." + table_ + " err=" + e.what());
+            std::unique_lock<std::mutex> lock(mutex_);
+            flushError_ = e.what();
+            flushDoneCv_.notify_all();
+            flushCv_.wait_for(lock, seconds(1), [&]() {
+                return flushStop_;
+            });
+            continue;
         }
-        if (doFsync) {
-            try {
-                std::lock_guard<std::mutex> lock(mutex_);
-                commitLog_.fsyncNow();
-            } catch (...) {
+        flushDoneCv_.notify_all();
+    }
+}
+
+std::optional<CompactionPlan> Table::pickCompactionLocked() const {
+    if (options_.compaction == CompactionStrategy::Leveled) {
+        LeveledCompactionOptions leveled{settings_.compactionMinThreshold, settings_.compactionMaxThreshold, settings_.leveledSstableBytes,
+                settings_.leveledSizeRatio};
+        return pickLeveledCompaction(ssTables_, leveled, leveledCursors_);
+    }
+    return pickSizeTieredCompaction(ssTables_, settings_.compactionMinThreshold, settings_.compactionMaxThreshold);
+}
+
+void Table::maybeScheduleCompactionLocked() {
+    if (compaction_ == nullptr || compactionScheduled_ || compactionStop_.load())
+        return;
+    if (!pickCompactionLocked().has_value())
+        return;
+    std::weak_ptr<Table> weak = weak_from_this();
+    if (weak.expired())
+        return;
+    compactionScheduled_ = true;
+    compaction_->submit([weak]() {
+        if (auto table = weak.lock())
+            table->runCompaction();
+    });
+}
+
+void Table::runCompaction() {
+    std::lock_guard<std::mutex> running(compactionMutex_);
+    auto abandon = [this]() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        compactionScheduled_ = false;
+    };
+    if (compactionStop_.load()) {
+        abandon();
+        return;
+    }
+
+    std::vector<SsTableFile> inputs;
+    std::optional<CompactionPlan> plan;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        plan = pickCompactionLocked();
+        if (!plan.has_value()) {
+            compactionScheduled_ = false;
+            return;
+        }
+        for (usize idx : plan->inputs)
+            inputs.push_back(ssTables_[idx]);
+    }
+
+    // Size-tiered output replaces its run as a single file; leveled output is
+    // cut into leveledSstableBytes pieces so later merges stay small.
+    struct Output {
+        string fileName;
+        path tmpPath;
+        std::unique_ptr<SsTableWriter> writer;
+    };
+    std::vector<Output> outputs;
+    const bool splitOutputs = plan->outputLevel > 0 && settings_.leveledSstableBytes > 0;
+    auto openOutput = [&]() {
+        Output out;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            char buf[64];
+            std::snprintf(buf, sizeof(buf), "sstable-%06llu.bin", static_cast<unsigned long long>(manifest_.nextSstableGen));
+            out.fileName = buf;
+            manifest_.nextSstableGen += 1;
+        }
+        out.tmpPath = tableDirPath_ / "tmp" / (out.fileName + ".tmp");
+        out.writer = std::make_unique<SsTableWriter>(out.tmpPath, ssTableWriteOptions());
+        outputs.push_back(std::move(out));
+    };
+    auto removeTmpOutputs = [&]() {
+        for (const auto& out : outputs) {
+            std::error_code ec;
+            std::filesystem::remove(out.tmpPath, ec);
+        }
+    };
+
+    bool completed = false;
+    try {
+        openOutput();
+        completed = mergeSsTables(
+                inputs,
+                [&](const SsEntry& entry) {
+                    if (splitOutputs && outputs.back().writer->entryCount() > 0 && outputs.back().writer->bytesWritten() >= settings_.leveledSstableBytes) {
+                        outputs.back().writer->finish();
+                        openOutput();
+                    }
+                    outputs.back().writer->add(entry);
+                },
+                plan->dropTombstones, &compaction_->throttle(), [this]() {
+                    return compactionStop_.load();
+                });
+        if (completed)
+            outputs.back().writer->finish();
+    } catch (...) {
+        removeTmpOutputs();
+        abandon();
+        throw;
+    }
+    if (!completed) {
+        removeTmpOutputs();
+        abandon();
+        return;
+    }
+
+    std::vector<SsTableFile> merged;
+    u64 outputEntries = 0;
+    for (auto& out : outputs) {
+        outputEntries += out.writer->entryCount();
+        if (out.writer->entryCount() == 0) {
+            std::error_code ec;
+            std::filesystem::remove(out.tmpPath, ec);
+            continue;
+        }
+        auto finalPath = tableDirPath_ / out.fileName;
+        std::filesystem::rename(out.tmpPath, finalPath);
+        auto loaded = loadSsTableIndex(finalPath, blockCache_);
+        loaded.level = plan->outputLevel;
+        loaded.minKey = out.writer->minKey();
+        loaded.maxKey = out.writer->maxKey();
+        merged.push_back(std::move(loaded));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Flushes may have appended new L0 files meanwhile, so find the inputs
+        // by name. The output takes the slot of the oldest input, which keeps a
+        // size-tiered run in place; sorting then files leveled output by level.
+        usize at = ssTables_.size();
+        for (usize i = 0; i < ssTables_.size();) {
+            bool isInput = std::any_of(inputs.begin(), inputs.end(), [&](const SsTableFile& in) {
+                return in.filePath == ssTables_[i].filePath;
+            });
+            if (!isInput) {
+                i++;
+                continue;
             }
+            at = std::min(at, i);
+            ssTables_.erase(ssTables_.begin() + static_cast<std::ptrdiff_t>(i));
         }
+        ssTables_.insert(ssTables_.begin() + static_cast<std::ptrdiff_t>(at), merged.begin(), merged.end());
+        sortSsTables(ssTables_);
+        manifest_.sstableFiles = manifestFilesFor(ssTables_);
+        writeManifestAtomic(manifestPath(tableDirPath_), manifest_);
+        publishSsTablesLocked();
+        if (plan->outputLevel >= 2) {
+            for (const auto& in : inputs) {
+                if (in.level == plan->outputLevel - 1 && in.level < leveledCursors_.size())
+                    leveledCursors_[in.level] = in.maxKey;
+            }
+        }
+    }
+
+    // Readers still holding a snapshot keep their own mapping of the inputs.
+    for (const auto& input : inputs) {
+        std::error_code ec;
+        std::filesystem::remove(input.filePath, ec);
     }
+
+    xeondb::log(LogLevel::DEBUG, string("Compacted table=") + keyspace_ + "." + table_ + " inputs=" + std::to_string(inputs.size()) +
+                                         " outputs=" + std::to_string(merged.size()) + " level=" + std::to_string(plan->outputLevel) +
+                                         " entries=" + std::to_string(outputEntries));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    compactionScheduled_ = false;
+    maybeScheduleCompactionLocked();
+}
+
+void Table::pauseCompaction() {
+    compactionStop_ = true;
+    std::lock_guard<std::mutex> running(compactionMutex_);
+}
+
+void Table::resumeCompaction() {
+    compactionStop_ = false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    compactionScheduled_ = false;
+    maybeScheduleCompactionLocked();
+}
+
+void Table::startWalThread() {
+    // The shared log's syncer belongs to Db.
+    if (!ownsCommitLog_)
+        return;
+    auto interval = std::chrono::milliseconds(settings_.walFsyncIntervalMs == 0 ? 50 : settings_.walFsyncIntervalMs);
+    commitLog_->startSyncer(walSyncModeFromName(settings_.walFsync), interval, settings_.walFsyncBytes);
+}
+
+void Table::stopWalThread() {
+    if (ownsCommitLog_)
+        commitLog_->stopSyncer();
 }
 
 }
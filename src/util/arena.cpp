@@ -0,0 +1,45 @@
+#include "util/arena.h"
+
+namespace xeondb {
+
+static constexpr usize arenaAlign = alignof(void*);
+
+Arena::Arena(usize blockBytes)
+    : blockBytes_(blockBytes < 4096 ? 4096 : blockBytes)
+    , ptr_(nullptr)
+    , remaining_(0)
+    , used_(0) {
+}
+
+u8* Arena::allocateBlock(usize bytes) {
+    // Left uninitialised on purpose; callers overwrite what they take.
+    blocks_.push_back(std::unique_ptr<u8[]>(new u8[bytes]));
+    return blocks_.back().get();
+}
+
+u8* Arena::allocate(usize bytes) {
+    usize padded = (bytes + arenaAlign - 1) & ~(arenaAlign - 1);
+    u8* out = nullptr;
+    if (padded <= remaining_) {
+        out = ptr_;
+        ptr_ += padded;
+        remaining_ -= padded;
+    } else if (padded > blockBytes_ / 4) {
+        // Big requests get their own block so the current one keeps its tail.
+        out = allocateBlock(padded);
+    } else {
+        ptr_ = allocateBlock(blockBytes_);
+        remaining_ = blockBytes_;
+        out = ptr_;
+        ptr_ += padded;
+        remaining_ -= padded;
+    }
+    used_.fetch_add(padded, std::memory_order_relaxed);
+    return out;
+}
+
+usize Arena::usedBytes() const {
+    return used_.load(std::memory_order_relaxed);
+}
+
+}
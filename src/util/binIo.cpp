@@ -98,6 +98,10 @@ u32 readBeU32(const byteVec& data, usize& o) {
     return val;
 }
 
+u32 readBeU32(const u8* p) {
+    return (static_cast<u32>(p[0]) << 24) | (static_cast<u32>(p[1]) << 16) | (static_cast<u32>(p[2]) << 8) | static_cast<u32>(p[3]);
+}
+
 void appendBe32(byteVec& data, i32 v) {
     appendBeU32(data, static_cast<u32>(v));
 }
@@ -128,4 +132,25 @@ i64 readBe64(const byteVec& data, usize& o) {
     return static_cast<i64>(val);
 }
 
+void appendVarU64(byteVec& data, u64 v) {
+    while (v >= 0x80) {
+        data.push_back(static_cast<u8>(v | 0x80));
+        v >>= 7;
+    }
+    data.push_back(static_cast<u8>(v));
+}
+
+bool readVarU64(const u8*& p, const u8* end, u64& out) {
+    u64 val = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        u8 byte = *p++;
+        val |= static_cast<u64>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            out = val;
+            return true;
+        }
+    }
+    return false;
+}
+
 }
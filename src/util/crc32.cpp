@@ -1,29 +1,140 @@
 #include "util/crc32.h"
 
 #include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__linux__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_acle.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
 
 namespace xeondb {
 
-static std::array<u32, 256> makeTable() {
-    std::array<u32, 256> t{};
+using SliceTables = std::array<std::array<u32, 256>, 8>;
+
+// tables[k][b]: the CRC of byte b followed by k zero bytes, so eight input
+// bytes fold in with eight independent lookups.
+static SliceTables makeTables(u32 poly) {
+    SliceTables t{};
     for (u32 i = 0; i < 256; i++) {
         u32 c = i;
         for (int k = 0; k < 8; k++) {
-            c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            c = (c & 1) ? (poly ^ (c >> 1)) : (c >> 1);
         }
-        t[i] = c;
+        t[0][i] = c;
+    }
+    for (usize k = 1; k < t.size(); k++) {
+        for (u32 i = 0; i < 256; i++)
+            t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
     }
     return t;
 }
 
+// The reflected CRC consumes bytes low to high, so words are assembled
+// little-endian whatever the host order.
+static inline u32 loadLe32(const u8* p) {
+    return static_cast<u32>(p[0]) | (static_cast<u32>(p[1]) << 8) | (static_cast<u32>(p[2]) << 16) | (static_cast<u32>(p[3]) << 24);
+}
+
+// Slice-by-8.
+static u32 crcSliced(const SliceTables& t, const u8* data, usize size) {
+    u32 c = 0xFFFFFFFFu;
+    while (size >= 8) {
+        u32 lo = loadLe32(data) ^ c;
+        u32 hi = loadLe32(data + 4);
+        c = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^
+            t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        data += 8;
+        size -= 8;
+    }
+    while (size-- > 0) {
+        c = t[0][(c ^ *data++) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
 // Cyclic Redundancy Check (CRC32) - Detect data corruption
 u32 crc32(const u8* data, usize size) {
-    static const auto table = makeTable();
-    u32 initial = 0xFFFFFFFFu;
-    for (usize i = 0; i < size; i++) {
-        initial = table[(initial ^ data[i]) & 0xFF] ^ (initial >> 8);
+    static const auto tables = makeTables(0xEDB88320u);
+    return crcSliced(tables, data, size);
+}
+
+u32 crc32cPortable(const u8* data, usize size) {
+    static const auto tables = makeTables(0x82F63B78u);
+    return crcSliced(tables, data, size);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2"))) static u32 crc32cHardware(const u8* data, usize size) {
+    u64 c = 0xFFFFFFFFu;
+    while (size >= 8) {
+        u64 v = 0;
+        std::memcpy(&v, data, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+        data += 8;
+        size -= 8;
+    }
+    u32 c32 = static_cast<u32>(c);
+    while (size-- > 0)
+        c32 = _mm_crc32_u8(c32, *data++);
+    return c32 ^ 0xFFFFFFFFu;
+}
+
+static bool cpuHasCrc32c() {
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#elif defined(__aarch64__) && defined(__linux__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+
+// Big-endian cores take the portable path: the 8-byte loads below match the
+// byte stream only in little-endian order.
+#if defined(__clang__)
+__attribute__((target("crc")))
+#else
+__attribute__((target("+crc")))
+#endif
+static u32 crc32cHardware(const u8* data, usize size) {
+    u32 c = 0xFFFFFFFFu;
+    while (size >= 8) {
+        u64 v = 0;
+        std::memcpy(&v, data, sizeof(v));
+        c = __crc32cd(c, v);
+        data += 8;
+        size -= 8;
     }
-    return initial ^ 0xFFFFFFFFu;
+    while (size-- > 0)
+        c = __crc32cb(c, *data++);
+    return c ^ 0xFFFFFFFFu;
+}
+
+static bool cpuHasCrc32c() {
+    return (::getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+#else
+
+static u32 crc32cHardware(const u8* data, usize size) {
+    return crc32cPortable(data, size);
+}
+
+static bool cpuHasCrc32c() {
+    return false;
+}
+
+#endif
+
+bool crc32cAccelerated() {
+    static const bool has = cpuHasCrc32c();
+    return has;
+}
+
+u32 crc32c(const u8* data, usize size) {
+    static const auto impl = crc32cAccelerated() ? &crc32cHardware : &crc32cPortable;
+    return impl(data, size);
 }
 
 }
@@ -0,0 +1,172 @@
+#include "util/ioUring.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace xeondb {
+
+static u32 loadAcquire(u32* p) {
+    return std::atomic_ref<u32>(*p).load(std::memory_order_acquire);
+}
+
+static void storeRelease(u32* p, u32 v) {
+    std::atomic_ref<u32>(*p).store(v, std::memory_order_release);
+}
+
+static int ringEnter(int fd, u32 toSubmit, u32 minComplete) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, IORING_ENTER_GETEVENTS, nullptr, 0));
+}
+
+IoUring::~IoUring() {
+    if (sqes_ != nullptr)
+        ::munmap(sqes_, sqesBytes_);
+    if (cqRing_ != nullptr && cqRing_ != sqRing_)
+        ::munmap(cqRing_, cqRingBytes_);
+    if (sqRing_ != nullptr)
+        ::munmap(sqRing_, sqRingBytes_);
+    if (ringFd_ >= 0)
+        ::close(ringFd_);
+}
+
+bool IoUring::init(u32 entries) {
+    io_uring_params p{};
+    int fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+    if (fd < 0)
+        return false;
+    ringFd_ = fd;
+    entries_ = p.sq_entries;
+
+    sqRingBytes_ = p.sq_off.array + p.sq_entries * sizeof(u32);
+    cqRingBytes_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single)
+        sqRingBytes_ = cqRingBytes_ = std::max(sqRingBytes_, cqRingBytes_);
+
+    void* sq = ::mmap(nullptr, sqRingBytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+        return false;
+    sqRing_ = sq;
+    if (single) {
+        cqRing_ = sqRing_;
+    } else {
+        void* cq = ::mmap(nullptr, cqRingBytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED)
+            return false;
+        cqRing_ = cq;
+    }
+    sqesBytes_ = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = ::mmap(nullptr, sqesBytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        return false;
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    u8* sqBase = static_cast<u8*>(sqRing_);
+    sqTail_ = reinterpret_cast<u32*>(sqBase + p.sq_off.tail);
+    sqMask_ = reinterpret_cast<u32*>(sqBase + p.sq_off.ring_mask);
+    sqArray_ = reinterpret_cast<u32*>(sqBase + p.sq_off.array);
+    u8* cqBase = static_cast<u8*>(cqRing_);
+    cqHead_ = reinterpret_cast<u32*>(cqBase + p.cq_off.head);
+    cqTail_ = reinterpret_cast<u32*>(cqBase + p.cq_off.tail);
+    cqMask_ = reinterpret_cast<u32*>(cqBase + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cqBase + p.cq_off.cqes);
+    expected_.reserve(entries_);
+    return true;
+}
+
+u32 IoUring::capacity() const {
+    return entries_;
+}
+
+bool IoUring::registerBuffers(const std::vector<iovec>& buffers) {
+    if (hasBuffers_) {
+        ::syscall(__NR_io_uring_register, ringFd_, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+        hasBuffers_ = false;
+    }
+    if (buffers.empty())
+        return true;
+    // May fail under a low RLIMIT_MEMLOCK on older kernels; writes then go unregistered.
+    if (::syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_BUFFERS, buffers.data(), static_cast<unsigned>(buffers.size())) != 0)
+        return false;
+    hasBuffers_ = true;
+    return true;
+}
+
+void IoUring::queue(u8 opcode, int fd, const void* data, u32 size, u64 offset, int bufIndex) {
+    // Nothing is consumed before submitAndWait, so the tail is ours alone.
+    u32 tail = *sqTail_;
+    u32 index = tail & *sqMask_;
+    io_uring_sqe& sqe = sqes_[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.flags = IOSQE_IO_LINK;
+    sqe.fd = fd;
+    sqe.off = offset;
+    sqe.addr = reinterpret_cast<u64>(data);
+    sqe.len = size;
+    if (opcode == IORING_OP_FSYNC)
+        sqe.fsync_flags = IORING_FSYNC_DATASYNC;
+    if (bufIndex >= 0)
+        sqe.buf_index = static_cast<u16>(bufIndex);
+    sqe.user_data = expected_.size();
+    sqArray_[index] = index;
+    expected_.push_back(opcode == IORING_OP_FSYNC ? 0 : size);
+    storeRelease(sqTail_, tail + 1);
+}
+
+void IoUring::queueWrite(int fd, const void* data, u32 size, u64 offset, int bufIndex) {
+    queue(bufIndex >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, fd, data, size, offset, bufIndex);
+}
+
+void IoUring::queueFdatasync(int fd) {
+    queue(IORING_OP_FSYNC, fd, nullptr, 0, 0, -1);
+}
+
+bool IoUring::submitAndWait() {
+    const u32 n = static_cast<u32>(expected_.size());
+    if (n == 0)
+        return true;
+    // The last op ends the chain.
+    sqes_[(*sqTail_ - 1) & *sqMask_].flags &= static_cast<u8>(~IOSQE_IO_LINK);
+
+    u32 submitted = 0;
+    bool ok = true;
+    while (submitted < n) {
+        int r = ringEnter(ringFd_, n - submitted, n - submitted);
+        if (r < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+            expected_.clear();
+            return false;
+        }
+        submitted += static_cast<u32>(r);
+    }
+
+    u32 seen = 0;
+    while (seen < n) {
+        u32 head = *cqHead_;
+        u32 tail = loadAcquire(cqTail_);
+        if (head == tail) {
+            if (ringEnter(ringFd_, 0, n - seen) < 0 && errno != EINTR) {
+                expected_.clear();
+                return false;
+            }
+            continue;
+        }
+        for (; head != tail && seen < n; head++, seen++) {
+            const io_uring_cqe& cqe = cqes_[head & *cqMask_];
+            if (cqe.res < 0 || static_cast<u32>(cqe.res) < expected_[cqe.user_data])
+                ok = false;
+        }
+        storeRelease(cqHead_, head);
+    }
+    expected_.clear();
+    return ok;
+}
+
+}
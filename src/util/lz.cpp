@@ -0,0 +1,123 @@
+#include "util/lz.h"
+
+#include <cstring>
+#include <vector>
+
+namespace xeondb {
+
+static constexpr usize lzMinMatch = 4;
+static constexpr usize lzLastLiterals = 5;
+static constexpr usize lzMaxOffset = 65535;
+static constexpr int lzHashBits = 12;
+
+static u32 read32(const u8* p) {
+    u32 v = 0;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static u32 hashSequence(u32 v) {
+    return (v * 2654435761u) >> (32 - lzHashBits);
+}
+
+static void appendLength(byteVec& out, usize len) {
+    while (len >= 255) {
+        out.push_back(255);
+        len -= 255;
+    }
+    out.push_back(static_cast<u8>(len));
+}
+
+// token: high nibble literal count, low nibble match length - 4; a nibble of
+// 15 continues in 255-terminated extra bytes. The last sequence has no match.
+static void appendSequence(byteVec& out, const u8* literals, usize literalLen, usize offset, usize matchLen) {
+    usize matchCode = matchLen == 0 ? 0 : matchLen - lzMinMatch;
+    u8 token = static_cast<u8>((literalLen >= 15 ? 15 : literalLen) << 4);
+    token |= static_cast<u8>(matchCode >= 15 ? 15 : matchCode);
+    out.push_back(token);
+    if (literalLen >= 15)
+        appendLength(out, literalLen - 15);
+    out.insert(out.end(), literals, literals + literalLen);
+    if (matchLen == 0)
+        return;
+    out.push_back(static_cast<u8>(offset & 0xFF));
+    out.push_back(static_cast<u8>((offset >> 8) & 0xFF));
+    if (matchCode >= 15)
+        appendLength(out, matchCode - 15);
+}
+
+byteVec lzCompress(const u8* data, usize size) {
+    byteVec out;
+    out.reserve(size / 2 + 16);
+    usize anchor = 0;
+    if (size > lzMinMatch + lzLastLiterals) {
+        std::vector<u32> table(static_cast<usize>(1) << lzHashBits, UINT32_MAX);
+        const usize limit = size - lzLastLiterals;
+        usize i = 0;
+        while (i + lzMinMatch <= limit) {
+            u32 seq = read32(data + i);
+            u32 h = hashSequence(seq);
+            u32 candidate = table[h];
+            table[h] = static_cast<u32>(i);
+            if (candidate == UINT32_MAX || i - candidate > lzMaxOffset || read32(data + candidate) != seq) {
+                i++;
+                continue;
+            }
+            usize len = lzMinMatch;
+            while (i + len < limit && data[candidate + len] == data[i + len])
+                len++;
+            appendSequence(out, data + anchor, i - anchor, i - candidate, len);
+            i += len;
+            anchor = i;
+        }
+    }
+    appendSequence(out, data + anchor, size - anchor, 0, 0);
+    return out;
+}
+
+static bool readLength(const u8*& ip, const u8* end, usize& len) {
+    for (;;) {
+        if (ip >= end)
+            return false;
+        u8 b = *ip++;
+        len += b;
+        if (b != 255)
+            return true;
+    }
+}
+
+bool lzDecompress(const u8* data, usize size, u8* out, usize outSize) {
+    const u8* ip = data;
+    const u8* end = data + size;
+    usize op = 0;
+    while (ip < end) {
+        u8 token = *ip++;
+        usize literalLen = token >> 4;
+        if (literalLen == 15 && !readLength(ip, end, literalLen))
+            return false;
+        if (static_cast<usize>(end - ip) < literalLen || outSize - op < literalLen)
+            return false;
+        std::memcpy(out + op, ip, literalLen);
+        ip += literalLen;
+        op += literalLen;
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return false;
+        usize offset = static_cast<usize>(ip[0]) | (static_cast<usize>(ip[1]) << 8);
+        ip += 2;
+        usize matchLen = token & 0x0F;
+        if (matchLen == 15 && !readLength(ip, end, matchLen))
+            return false;
+        matchLen += lzMinMatch;
+        if (offset == 0 || offset > op || outSize - op < matchLen)
+            return false;
+        // Byte-wise on purpose: matches may overlap their own output.
+        for (usize k = 0; k < matchLen; k++, op++)
+            out[op] = out[op - offset];
+    }
+    return op == outSize;
+}
+
+}
@@ -29,9 +29,7 @@ static u64 readBlock64(const u8* p) {
     return val;
 }
 
-i64 murmur3Token(const byteVec& bytes) {
-    const u8* data = bytes.data();
-    usize len = bytes.size();
+void murmur3Hash128(const u8* data, usize len, u64& out1, u64& out2) {
     const usize nblocks = len / 16;
 
     u64 h1 = 0;
@@ -136,7 +134,16 @@ i64 murmur3Token(const byteVec& bytes) {
     h2 = finalMix64(h2);
 
     h1 += h2;
+    h2 += h1;
+
+    out1 = h1;
+    out2 = h2;
+}
 
+i64 murmur3Token(const byteVec& bytes) {
+    u64 h1 = 0;
+    u64 h2 = 0;
+    murmur3Hash128(bytes.data(), bytes.size(), h1, h2);
     return static_cast<i64>(h1);
 }
 
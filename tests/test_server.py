@@ -2,7 +2,9 @@ import base64
 import json
 import os
 import socket
+import struct
 import subprocess
+import threading
 import time
 
 
@@ -14,7 +16,7 @@ def pickFreePort():
     return port
 
 
-def writeConfig(path, port, dataDir, username=None, password=None):
+def writeConfig(path, port, dataDir, username=None, password=None, extra=None):
     with open(path, "w", encoding="utf-8") as f:
         f.write("host: 127.0.0.1\n")
         f.write(f"port: {port}\n")
@@ -26,6 +28,8 @@ def writeConfig(path, port, dataDir, username=None, password=None):
         f.write("walFsyncBytes: 1048576\n")
         f.write("memtableMaxBytes: 33554432\n")
         f.write("sstableIndexStride: 16\n")
+        for key, value in (extra or {}).items():
+            f.write(f"{key}: {value}\n")
         if username is not None and password is not None:
             f.write("auth:\n")
             f.write(f"  username: {username}\n")
@@ -273,6 +277,998 @@ def testFlushRestartPersists(tmp_path):
         stopServer(proc2)
 
 
+def testMemtableThresholdFlushesInBackground(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    writeConfig(str(cfg), port, str(dataDir), extra={"memtableMaxBytes": 2048})
+
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE KEYSPACE IF NOT EXISTS flushTest;"))
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE TABLE IF NOT EXISTS flushTest.kv (id int64, val varchar, PRIMARY KEY (id));"))
+        for i in range(200):
+            mustOk(tcpQuery("127.0.0.1", port, f'INSERT INTO flushTest.kv (id,val) VALUES ({i},"{"x" * 64}");'))
+
+        deadline = time.time() + 3.0
+        sstables = []
+        while time.time() < deadline:
+            sstables = list(dataDir.glob("flushTest/kv-*/sstable-*.bin"))
+            if sstables:
+                break
+            time.sleep(0.05)
+        assert sstables
+
+        r = mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM flushTest.kv;"))
+        assert sorted(row["id"] for row in r["rows"]) == list(range(200))
+    finally:
+        stopServer(proc)
+
+    port2 = pickFreePort()
+    cfg2 = tmp_path / "settings2.yml"
+    writeConfig(str(cfg2), port2, str(dataDir), extra={"memtableMaxBytes": 2048})
+
+    proc2 = startServer(repoRoot, str(cfg2))
+    try:
+        r = mustOk(tcpQuery("127.0.0.1", port2, "SELECT * FROM flushTest.kv;"))
+        assert sorted(row["id"] for row in r["rows"]) == list(range(200))
+    finally:
+        stopServer(proc2)
+
+
+def testGroupCommitSurvivesKill(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    writeConfig(str(cfg), port, str(dataDir), extra={"walFsync": "group", "memtableMaxBytes": 4096})
+
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE KEYSPACE IF NOT EXISTS groupTest;"))
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE TABLE IF NOT EXISTS groupTest.kv (id int64, val varchar, PRIMARY KEY (id));"))
+        errors = []
+
+        def writer(base):
+            try:
+                for i in range(base, base + 40):
+                    mustOk(tcpQuery("127.0.0.1", port, f'INSERT INTO groupTest.kv (id,val) VALUES ({i},"v{i}");'))
+                for i in range(base, base + 40, 5):
+                    mustOk(tcpQuery("127.0.0.1", port, f"DELETE FROM groupTest.kv WHERE id={i};"))
+            except Exception as e:
+                errors.append(e)
+
+        threads = [threading.Thread(target=writer, args=(t * 100,)) for t in range(8)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        assert not errors
+    finally:
+        # Every acknowledged write must already be in the log.
+        proc.kill()
+        proc.wait(timeout=2)
+
+    expected = sorted(t * 100 + i for t in range(8) for i in range(40) if i % 5 != 0)
+    port2 = pickFreePort()
+    cfg2 = tmp_path / "settings2.yml"
+    writeConfig(str(cfg2), port2, str(dataDir), extra={"walFsync": "group"})
+
+    proc2 = startServer(repoRoot, str(cfg2))
+    try:
+        r = mustOk(tcpQuery("127.0.0.1", port2, "SELECT * FROM groupTest.kv;"))
+        assert sorted(row["id"] for row in r["rows"]) == expected
+        assert all(row["val"] == f"v{row['id']}" for row in r["rows"])
+    finally:
+        stopServer(proc2)
+
+
+def testWalFsyncBytesTriggersEarlySync(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    # The interval alone would not fire during the test.
+    writeConfig(str(cfg), port, str(dataDir), extra={"walFsyncIntervalMs": 600000, "walFsyncBytes": 4096})
+
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE KEYSPACE IF NOT EXISTS walTest;"))
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE TABLE IF NOT EXISTS walTest.kv (id int64, val varchar, PRIMARY KEY (id));"))
+        r = mustOk(tcpQuery("127.0.0.1", port, "SHOW METRICS IN walTest;"))
+        assert r["wal_fsyncs"] == 0
+        for i in range(40):
+            mustOk(tcpQuery("127.0.0.1", port, f'INSERT INTO walTest.kv (id,val) VALUES ({i},"{"x" * 200}");'))
+
+        deadline = time.time() + 3.0
+        while time.time() < deadline:
+            r = mustOk(tcpQuery("127.0.0.1", port, "SHOW METRICS IN walTest;"))
+            if r["wal_fsyncs"] > 0:
+                break
+            time.sleep(0.05)
+        assert r["wal_fsyncs"] > 0
+        assert r["wal_fsync_avg_bytes"] >= 4096
+        assert r["wal_fsync_max_micros"] >= r["wal_fsync_avg_micros"]
+    finally:
+        stopServer(proc)
+
+
+def testWalSegmentsRecycleAndReplay(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    extra = {"walSegmentBytes": 65536, "memtableMaxBytes": 32768}
+    writeConfig(str(cfg), port, str(dataDir), extra=extra)
+
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE KEYSPACE IF NOT EXISTS segTest;"))
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE TABLE IF NOT EXISTS segTest.kv (id int64, val varchar, PRIMARY KEY (id));"))
+        for i in range(1500):
+            mustOk(tcpQuery("127.0.0.1", port, f'INSERT INTO segTest.kv (id,val) VALUES ({i},"{str(i) * 40}");'))
+        mustOk(tcpQuery("127.0.0.1", port, "FLUSH segTest.kv;"))
+        # Roughly 0.4 MiB of log went through; flushed segments are reused or removed.
+        segments = list(dataDir.glob("segTest/kv-*/wal-*.log"))
+        assert 1 <= len(segments) <= 5
+        assert all(seg.stat().st_size == 65536 for seg in segments)
+        for i in range(1500, 1600):
+            mustOk(tcpQuery("127.0.0.1", port, f'INSERT INTO segTest.kv (id,val) VALUES ({i},"{str(i) * 40}");'))
+    finally:
+        proc.kill()
+        proc.wait(timeout=2)
+
+    port2 = pickFreePort()
+    cfg2 = tmp_path / "settings2.yml"
+    writeConfig(str(cfg2), port2, str(dataDir), extra=extra)
+
+    proc2 = startServer(repoRoot, str(cfg2))
+    try:
+        r = mustOk(tcpQuery("127.0.0.1", port2, "SELECT * FROM segTest.kv;"))
+        assert sorted(row["id"] for row in r["rows"]) == list(range(1600))
+        assert all(row["val"] == str(row["id"]) * 40 for row in r["rows"])
+    finally:
+        stopServer(proc2)
+
+
+def testWalIoUringBackendSurvivesKill(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    # Falls back to pwrite on kernels without io_uring; the outcome is the same.
+    extra = {"walFsync": "always", "walIoBackend": "io_uring", "walSegmentBytes": 65536}
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    writeConfig(str(cfg), port, str(dataDir), extra=extra)
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE KEYSPACE IF NOT EXISTS uringTest;"))
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE TABLE IF NOT EXISTS uringTest.kv (id int64, val varchar, PRIMARY KEY (id));"))
+        for i in range(300):
+            mustOk(tcpQuery("127.0.0.1", port, f'INSERT INTO uringTest.kv (id,val) VALUES ({i},"{str(i) * 100}");'))
+    finally:
+        proc.kill()
+        proc.wait(timeout=2)
+
+    port2 = pickFreePort()
+    cfg2 = tmp_path / "settings2.yml"
+    writeConfig(str(cfg2), port2, str(dataDir), extra=extra)
+    proc2 = startServer(repoRoot, str(cfg2))
+    try:
+        r = mustOk(tcpQuery("127.0.0.1", port2, "SELECT * FROM uringTest.kv;"))
+        assert sorted(row["id"] for row in r["rows"]) == list(range(300))
+        assert all(row["val"] == str(row["id"]) * 100 for row in r["rows"])
+    finally:
+        stopServer(proc2)
+
+
+def testMultiRowInsertReplaysAsOneBatch(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    writeConfig(str(cfg), port, str(dataDir))
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE KEYSPACE IF NOT EXISTS batchTest;"))
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE TABLE IF NOT EXISTS batchTest.kv (id int64, val varchar, PRIMARY KEY (id));"))
+        for start in (0, 50):
+            values = ",".join(f'({i},"v{i}")' for i in range(start, start + 50))
+            mustOk(tcpQuery("127.0.0.1", port, f"INSERT INTO batchTest.kv (id,val) VALUES {values};"))
+        r = mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM batchTest.kv;"))
+        assert len(r["rows"]) == 100
+    finally:
+        proc.kill()
+        proc.wait(timeout=2)
+
+    # Tear the tail of the second batch: none of its rows may come back.
+    segments = sorted((dataDir / "batchTest").rglob("wal-*.log"), key=lambda p: p.name)
+    torn = False
+    for seg in reversed(segments):
+        data = bytearray(seg.read_bytes())
+        end = len(data.rstrip(b"\0"))
+        if end > 32:
+            data[end - 4 : end] = b"\0\0\0\0"
+            seg.write_bytes(bytes(data))
+            torn = True
+            break
+    assert torn
+
+    port2 = pickFreePort()
+    cfg2 = tmp_path / "settings2.yml"
+    writeConfig(str(cfg2), port2, str(dataDir))
+    proc2 = startServer(repoRoot, str(cfg2))
+    try:
+        r = mustOk(tcpQuery("127.0.0.1", port2, "SELECT * FROM batchTest.kv;"))
+        assert sorted(row["id"] for row in r["rows"]) == list(range(50))
+    finally:
+        stopServer(proc2)
+
+
+def testParallelRecoveryAcrossTables(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    extra = {"walRecoveryThreads": 4, "walSegmentBytes": 65536}
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    writeConfig(str(cfg), port, str(dataDir), extra=extra)
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE KEYSPACE IF NOT EXISTS recTest;"))
+        for t in range(8):
+            mustOk(tcpQuery("127.0.0.1", port, f"CREATE TABLE IF NOT EXISTS recTest.t{t} (id int64, val varchar, PRIMARY KEY (id));"))
+            values = ",".join(f'({i},"{t}-{i}")' for i in range(40))
+            mustOk(tcpQuery("127.0.0.1", port, f"INSERT INTO recTest.t{t} (id,val) VALUES {values};"))
+        mustOk(tcpQuery("127.0.0.1", port, "FLUSH recTest.t0;"))
+        mustOk(tcpQuery("127.0.0.1", port, 'INSERT INTO recTest.t0 (id,val) VALUES (40,"0-40");'))
+    finally:
+        proc.kill()
+        proc.wait(timeout=2)
+
+    port2 = pickFreePort()
+    cfg2 = tmp_path / "settings2.yml"
+    writeConfig(str(cfg2), port2, str(dataDir), extra=extra)
+    proc2 = startServer(repoRoot, str(cfg2))
+    try:
+        for t in range(8):
+            r = mustOk(tcpQuery("127.0.0.1", port2, f"SELECT * FROM recTest.t{t};"))
+            expected = 41 if t == 0 else 40
+            assert sorted(row["id"] for row in r["rows"]) == list(range(expected))
+            assert all(row["val"] == f"{t}-{row['id']}" for row in r["rows"])
+    finally:
+        stopServer(proc2)
+
+
+def testPointReadsStayCurrentUnderConcurrentWrites(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    # Small memtables so flushes and compactions swap the read view mid-run.
+    extra = {"memtableMaxBytes": 16384, "compactionMinThreshold": 2}
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    writeConfig(str(cfg), port, str(dataDir), extra=extra)
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE KEYSPACE IF NOT EXISTS viewTest;"))
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE TABLE IF NOT EXISTS viewTest.kv (id int64, val varchar, PRIMARY KEY (id)) WITH row_cache = 16;"))
+        errors = []
+
+        def writer(w):
+            try:
+                for n in range(120):
+                    mustOk(tcpQuery("127.0.0.1", port, f'INSERT INTO viewTest.kv (id,val) VALUES ({w},"{n}-{"x" * 200}");'))
+            except Exception as e:
+                errors.append(e)
+
+        def reader():
+            try:
+                for n in range(200):
+                    mustOk(tcpQuery("127.0.0.1", port, f"SELECT * FROM viewTest.kv WHERE id={n % 4};"))
+            except Exception as e:
+                errors.append(e)
+
+        threads = [threading.Thread(target=writer, args=(w,)) for w in range(4)]
+        threads += [threading.Thread(target=reader) for _ in range(4)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        assert not errors
+
+        # A cache fill that raced a write would leave an older row behind.
+        for w in range(4):
+            r = mustOk(tcpQuery("127.0.0.1", port, f"SELECT * FROM viewTest.kv WHERE id={w};"))
+            assert r["found"] is True
+            assert r["row"]["val"].startswith("119-")
+    finally:
+        stopServer(proc)
+
+
+def testIdleConnectionsShareEventLoops(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    extra = {"maxConnections": 300, "eventLoopThreads": 2, "workerThreads": 2}
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    writeConfig(str(cfg), port, str(dataDir), extra=extra)
+    proc = startServer(repoRoot, str(cfg))
+    idle = []
+    try:
+        # In batches below the listen backlog, each answered once so the
+        # server has accepted it.
+        for _ in range(3):
+            batch = [socket.create_connection(("127.0.0.1", port), timeout=2) for _ in range(100)]
+            for conn in batch:
+                conn.sendall(b"PING;\n")
+            for conn in batch:
+                assert json.loads(conn.recv(4096).decode("utf-8"))["result"] == "PONG"
+            idle.extend(batch)
+
+        extraConn = socket.create_connection(("127.0.0.1", port), timeout=2)
+        r = json.loads(extraConn.recv(4096).decode("utf-8").strip())
+        extraConn.close()
+        assert r["ok"] is False and r["error"] == "too_many_connections"
+
+        # Two commands in one packet are answered in order.
+        conn = idle[0]
+        conn.sendall(b"PING;\nCREATE KEYSPACE IF NOT EXISTS loopTest;\n")
+        data = b""
+        while data.count(b"\n") < 2:
+            chunk = conn.recv(4096)
+            assert chunk
+            data += chunk
+        replies = [json.loads(line) for line in data.decode("utf-8").strip().split("\n")]
+        assert [r["ok"] for r in replies] == [True, True]
+
+        idle.pop().close()
+        deadline = time.time() + 3
+        while True:
+            try:
+                mustOk(tcpQuery("127.0.0.1", port, "PING;"))
+                break
+            except (AssertionError, RuntimeError, OSError, ValueError):
+                if time.time() > deadline:
+                    raise
+                time.sleep(0.05)
+    finally:
+        for s in idle:
+            s.close()
+        stopServer(proc)
+
+
+def testReusePortListenersReportAcceptQueues(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    extra = {"listenBacklog": 64, "eventLoopThreads": 3, "workerThreads": 2}
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    writeConfig(str(cfg), port, str(dataDir), extra=extra)
+    proc = startServer(repoRoot, str(cfg))
+    conns = []
+    try:
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE KEYSPACE IF NOT EXISTS listenTest;"))
+        for _ in range(60):
+            conns.append(socket.create_connection(("127.0.0.1", port), timeout=2))
+        for conn in conns:
+            conn.sendall(b"PING;\n")
+        for conn in conns:
+            assert json.loads(conn.recv(4096).decode("utf-8"))["result"] == "PONG"
+
+        r = mustOk(tcpQuery("127.0.0.1", port, "SHOW METRICS IN listenTest;"))
+        assert r["listen_sockets"] == 3
+        assert r["listen_backlog"] == 64
+        assert r["listen_queued"] == 0
+        assert r["listen_overflows"] >= 0 and r["listen_drops"] >= 0
+    finally:
+        for conn in conns:
+            conn.close()
+        stopServer(proc)
+
+
+def testPipelinedCommandsAnsweredInOrder(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    writeConfig(str(cfg), port, str(dataDir))
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE KEYSPACE IF NOT EXISTS pipeTest;"))
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE TABLE IF NOT EXISTS pipeTest.kv (id int64, val varchar, PRIMARY KEY (id));"))
+
+        # USE applies to the commands pipelined behind it; a bad line in the
+        # middle gets its own error without disturbing the rest.
+        lines = ["USE pipeTest;"]
+        lines += [f'INSERT INTO kv (id,val) VALUES ({i},"v{i}");' for i in range(250)]
+        lines.append("NOT A COMMAND;")
+        lines += [f'INSERT INTO kv (id,val) VALUES ({i},"v{i}");' for i in range(250, 500)]
+        lines.append("SELECT * FROM kv;")
+        s = socket.create_connection(("127.0.0.1", port), timeout=5)
+        s.sendall(("\r\n".join(lines) + "\r\n").encode("utf-8"))
+        data = b""
+        while data.count(b"\n") < len(lines):
+            chunk = s.recv(65536)
+            assert chunk
+            data += chunk
+        s.close()
+
+        replies = [json.loads(line) for line in data.decode("utf-8").strip().split("\n")]
+        assert len(replies) == len(lines)
+        assert all(r["ok"] is True for r in replies[:251])
+        assert replies[251]["ok"] is False
+        assert all(r["ok"] is True for r in replies[252:])
+        assert sorted(row["id"] for row in replies[-1]["rows"]) == list(range(500))
+    finally:
+        stopServer(proc)
+
+
+def recvExact(s, n):
+    data = b""
+    while len(data) < n:
+        chunk = s.recv(n - len(data))
+        if not chunk:
+            raise RuntimeError("server closed")
+        data += chunk
+    return data
+
+
+def binaryFrame(op, payload):
+    return struct.pack(">IB", len(payload) + 1, op) + payload
+
+
+def binaryReply(s):
+    (length,) = struct.unpack(">I", recvExact(s, 4))
+    body = recvExact(s, length)
+    return body[0], body[1:]
+
+
+def binaryRequest(s, op, payload):
+    s.sendall(binaryFrame(op, payload))
+    return binaryReply(s)
+
+
+def binaryValues(values):
+    out = b""
+    for v in values:
+        out += struct.pack(">I", 0xFFFFFFFF) if v is None else struct.pack(">I", len(v)) + v
+    return out
+
+
+def binaryRows(payload):
+    columns, count = struct.unpack(">HI", payload[:6])
+    pos = 6
+    rows = []
+    for _ in range(count):
+        row = []
+        for _ in range(columns):
+            (length,) = struct.unpack(">I", payload[pos:pos + 4])
+            pos += 4
+            if length == 0xFFFFFFFF:
+                row.append(None)
+            else:
+                row.append(payload[pos:pos + length])
+                pos += length
+        rows.append(row)
+    assert pos == len(payload)
+    return rows
+
+
+def testBinaryProtocolPreparedStatements(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    writeConfig(str(cfg), port, str(dataDir))
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        s = socket.create_connection(("127.0.0.1", port), timeout=2)
+        s.sendall(b"\0XDB\x01")
+        assert recvExact(s, 5) == b"\0XDB\x01"
+
+        for sql in ["CREATE KEYSPACE IF NOT EXISTS binTest;", "USE binTest;",
+                    "CREATE TABLE IF NOT EXISTS kv (id int64, val varchar, flag boolean, PRIMARY KEY (id));"]:
+            op, payload = binaryRequest(s, 0x01, sql.encode("utf-8"))
+            assert op == 0x81 and json.loads(payload)["ok"] is True
+
+        op, payload = binaryRequest(s, 0x02, b"INSERT INTO kv (id,val,flag) VALUES (?,?,?);")
+        assert op == 0x82
+        insertId, params = struct.unpack(">IH", payload[:6])
+        assert list(payload[6:6 + params]) == [5, 2, 6]
+        assert struct.unpack(">H", payload[6 + params:])[0] == 0
+        for i, val in [(1, b"one"), (2, b"two"), (3, None)]:
+            body = struct.pack(">IH", insertId, 3) + binaryValues([struct.pack(">q", i), val, b"\x01"])
+            op, payload = binaryRequest(s, 0x03, body)
+            assert op == 0x81 and json.loads(payload)["ok"] is True
+
+        op, payload = binaryRequest(s, 0x02, b"SELECT id, val AS v FROM kv WHERE id = ?;")
+        assert op == 0x82
+        selectId, params = struct.unpack(">IH", payload[:6])
+        assert params == 1 and payload[6] == 5
+        assert payload[7:] == struct.pack(">H", 2) + b"\x05" + struct.pack(">H", 2) + b"id" + b"\x02" + struct.pack(">H", 1) + b"v"
+
+        # Both executions go out in one write; the replies come back in order.
+        s.sendall(binaryFrame(0x03, struct.pack(">IH", selectId, 1) + binaryValues([struct.pack(">q", 2)]))
+                  + binaryFrame(0x03, struct.pack(">IH", selectId, 1) + binaryValues([struct.pack(">q", 99)])))
+        op, payload = binaryReply(s)
+        assert op == 0x83 and binaryRows(payload) == [[struct.pack(">q", 2), b"two"]]
+        op, payload = binaryReply(s)
+        assert op == 0x83 and binaryRows(payload) == []
+
+        op, payload = binaryRequest(s, 0x02, b"SELECT * FROM kv;")
+        scanId = struct.unpack(">I", payload[:4])[0]
+        op, payload = binaryRequest(s, 0x03, struct.pack(">IH", scanId, 0))
+        assert op == 0x83
+        rows = sorted(binaryRows(payload))
+        assert rows == [[struct.pack(">q", i), v, b"\x01"] for i, v in [(1, b"one"), (2, b"two"), (3, None)]]
+
+        op, payload = binaryRequest(s, 0x02, b"SELECT COUNT(*) AS n FROM kv;")
+        countId = struct.unpack(">I", payload[:4])[0]
+        op, payload = binaryRequest(s, 0x03, struct.pack(">IH", countId, 0))
+        assert op == 0x81 and json.loads(payload)["ok"] is True
+
+        op, payload = binaryRequest(s, 0x03, struct.pack(">IH", selectId, 0))
+        assert op == 0xFF and payload == b"expected 1 parameters"
+        op, payload = binaryRequest(s, 0x03, struct.pack(">IH", selectId, 1) + binaryValues([b"\x00\x01"]))
+        assert op == 0xFF
+        op, payload = binaryRequest(s, 0x04, struct.pack(">I", selectId))
+        assert op == 0x81
+        op, payload = binaryRequest(s, 0x03, struct.pack(">IH", selectId, 1) + binaryValues([struct.pack(">q", 2)]))
+        assert op == 0xFF and payload == b"unknown statement"
+        s.close()
+
+        r = mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM binTest.kv WHERE id = 1;"))
+        assert r["row"]["val"] == "one" and r["row"]["flag"] is True
+    finally:
+        stopServer(proc)
+
+
+def testPreparedStatementsReplanAfterTableRecreate(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    writeConfig(str(cfg), port, str(dataDir))
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        r = tcpSession("127.0.0.1", port, [
+            "CREATE KEYSPACE IF NOT EXISTS prepTest;",
+            "USE prepTest;",
+            "CREATE TABLE IF NOT EXISTS kv (id int64, val varchar, PRIMARY KEY (id));",
+            "PREPARE ins AS INSERT INTO kv (id,val) VALUES (?,?);",
+            'EXECUTE ins (1, "one");',
+            'EXECUTE ins (2, "two");',
+            "PREPARE get AS SELECT val AS v FROM kv WHERE id = ?;",
+            "EXECUTE get (1);",
+            "EXECUTE get (9);",
+            "EXECUTE get ();",
+            "PREPARE get AS SELECT * FROM kv;",
+            "PREPARE scan AS SELECT * FROM kv LIMIT 1;",
+            "EXECUTE scan;",
+            "PREPARE keyspaces AS SHOW KEYSPACES;",
+            "DROP TABLE kv;",
+            "EXECUTE get (1);",
+            # Recreated with the columns in another order: the plans are resolved again.
+            "CREATE TABLE kv (val varchar, id int64, PRIMARY KEY (id));",
+            'EXECUTE ins (3, "three");',
+            "EXECUTE get (3);",
+            "EXECUTE get (1);",
+            "DEALLOCATE get;",
+            "EXECUTE get (3);",
+        ])
+        for i in range(5):
+            mustOk(r[i])
+        assert r[5]["ok"] is True
+        assert r[6]["ok"] is True
+        assert r[7]["found"] is True and r[7]["row"] == {"v": "one"}
+        assert r[8]["ok"] is True and r[8]["found"] is False
+        assert r[9]["ok"] is False and r[9]["error"] == "expected 1 parameters"
+        assert r[10]["ok"] is False
+        assert r[11]["ok"] is True
+        assert r[12]["ok"] is True and len(r[12]["rows"]) == 1
+        assert r[13]["ok"] is False
+        mustOk(r[14])
+        assert r[15]["ok"] is False
+        mustOk(r[16])
+        mustOk(r[17])
+        assert r[18]["found"] is True and r[18]["row"] == {"v": "three"}
+        assert r[19]["ok"] is True and r[19]["found"] is False
+        mustOk(r[20])
+        assert r[21]["ok"] is False and r[21]["error"] == "unknown prepared statement"
+
+        r = mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM prepTest.kv WHERE id = 3;"))
+        assert r["row"] == {"val": "three", "id": 3}
+    finally:
+        stopServer(proc)
+
+
+def testSharedWalAcrossTables(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    extra = {"walSegmentBytes": 65536, "walShared": "true"}
+    writeConfig(str(cfg), port, str(dataDir), extra=extra)
+
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE KEYSPACE IF NOT EXISTS walTest;"))
+        for t in ("a", "b", "idle"):
+            mustOk(tcpQuery("127.0.0.1", port, f"CREATE TABLE IF NOT EXISTS walTest.{t} (id int64, val varchar, PRIMARY KEY (id));"))
+        mustOk(tcpQuery("127.0.0.1", port, 'INSERT INTO walTest.idle (id,val) VALUES (1,"pinned");'))
+        for i in range(1500):
+            t = "a" if i % 2 == 0 else "b"
+            mustOk(tcpQuery("127.0.0.1", port, f'INSERT INTO walTest.{t} (id,val) VALUES ({i},"{str(i) * 200}");'))
+        # Over 1 MiB of log, but the idle table is asked to flush once too many segments are live.
+        assert not list(dataDir.glob("walTest/*/wal-*.log"))
+        assert len(list(dataDir.glob(".wal/wal-*.log"))) <= 12
+    finally:
+        proc.kill()
+        proc.wait(timeout=2)
+
+    def checkRows(port):
+        r = mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM walTest.a;"))
+        assert sorted(row["id"] for row in r["rows"]) == list(range(0, 1500, 2))
+        assert all(row["val"] == str(row["id"]) * 200 for row in r["rows"])
+        r = mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM walTest.b;"))
+        assert sorted(row["id"] for row in r["rows"]) == list(range(1, 1500, 2))
+        r = mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM walTest.idle;"))
+        assert [row["val"] for row in r["rows"]] == ["pinned"]
+
+    port2 = pickFreePort()
+    cfg2 = tmp_path / "settings2.yml"
+    writeConfig(str(cfg2), port2, str(dataDir), extra=extra)
+    proc2 = startServer(repoRoot, str(cfg2))
+    try:
+        checkRows(port2)
+    finally:
+        proc2.kill()
+        proc2.wait(timeout=2)
+
+    # Back to per-table logs: unflushed records move over and the shared log goes away.
+    port3 = pickFreePort()
+    cfg3 = tmp_path / "settings3.yml"
+    writeConfig(str(cfg3), port3, str(dataDir), extra={"walSegmentBytes": 65536})
+    proc3 = startServer(repoRoot, str(cfg3))
+    try:
+        checkRows(port3)
+        assert not (dataDir / ".wal").exists()
+    finally:
+        stopServer(proc3)
+
+
+def testCompactionMergesFlushedSsTables(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    writeConfig(str(cfg), port, str(dataDir), extra={"compactionMinThreshold": 4, "compactionThroughputBytesPerSec": 0})
+
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE KEYSPACE IF NOT EXISTS compactTest;"))
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE TABLE IF NOT EXISTS compactTest.kv (id int64, val varchar, PRIMARY KEY (id));"))
+        for gen in range(8):
+            for i in range(10):
+                mustOk(tcpQuery("127.0.0.1", port, f'INSERT INTO compactTest.kv (id,val) VALUES ({i},"v{gen}");'))
+            if gen == 5:
+                mustOk(tcpQuery("127.0.0.1", port, "DELETE FROM compactTest.kv WHERE id=3;"))
+            mustOk(tcpQuery("127.0.0.1", port, "FLUSH compactTest.kv;"))
+
+        deadline = time.time() + 5.0
+        sstables = []
+        while time.time() < deadline:
+            sstables = list(dataDir.glob("compactTest/kv-*/sstable-*.bin"))
+            if len(sstables) < 4:
+                break
+            time.sleep(0.05)
+        assert len(sstables) < 4
+
+        r = mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM compactTest.kv;"))
+        assert sorted(row["id"] for row in r["rows"]) == list(range(10))
+        assert all(row["val"] == "v7" for row in r["rows"])
+    finally:
+        stopServer(proc)
+
+
+def testLeveledCompactionTable(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    extra = {"compactionMinThreshold": 2, "compactionThroughputBytesPerSec": 0, "leveledSstableBytes": 1024, "leveledSizeRatio": 2}
+    writeConfig(str(cfg), port, str(dataDir), extra=extra)
+
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE KEYSPACE IF NOT EXISTS levTest;"))
+        mustOk(tcpQuery("127.0.0.1", port, 'CREATE TABLE levTest.kv (id int64, val varchar, PRIMARY KEY (id)) WITH compaction = "leveled";'))
+        r = mustOk(tcpQuery("127.0.0.1", port, "DESCRIBE TABLE levTest.kv;"))
+        assert r["compaction"] == "leveled"
+
+        for gen in range(10):
+            for i in range(40):
+                mustOk(tcpQuery("127.0.0.1", port, f'INSERT INTO levTest.kv (id,val) VALUES ({i},"value-{gen}-{i}");'))
+            if gen == 4:
+                mustOk(tcpQuery("127.0.0.1", port, "DELETE FROM levTest.kv WHERE id=7;"))
+            mustOk(tcpQuery("127.0.0.1", port, "FLUSH levTest.kv;"))
+
+        deadline = time.time() + 5.0
+        sstables = []
+        while time.time() < deadline:
+            sstables = list(dataDir.glob("levTest/kv-*/sstable-*.bin"))
+            if len(sstables) < 10:
+                break
+            time.sleep(0.05)
+        assert len(sstables) < 10
+    finally:
+        stopServer(proc)
+
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        r = mustOk(tcpQuery("127.0.0.1", port, "SHOW CREATE TABLE levTest.kv;"))
+        assert 'WITH compaction = "leveled"' in r["create"]
+        for i in range(40):
+            r = mustOk(tcpQuery("127.0.0.1", port, f"SELECT * FROM levTest.kv WHERE id={i};"))
+            assert r["found"] is True
+            assert r["row"]["val"] == f"value-9-{i}"
+        r = mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM levTest.kv;"))
+        assert len(r["rows"]) == 40
+        r = tcpQuery("127.0.0.1", port, 'CREATE TABLE levTest.bad (id int64, PRIMARY KEY (id)) WITH compaction = "nope";')
+        assert r["ok"] is False
+    finally:
+        stopServer(proc)
+
+
+def testBloomFilteredPointReads(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    # Start without filters so files from both formats end up in one table.
+    writeConfig(str(cfg), port, str(dataDir), extra={"sstableBloomBitsPerKey": 0, "compactionMinThreshold": 100})
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE KEYSPACE IF NOT EXISTS bloomTest;"))
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE TABLE IF NOT EXISTS bloomTest.kv (id int64, val varchar, PRIMARY KEY (id));"))
+        for i in range(0, 50):
+            mustOk(tcpQuery("127.0.0.1", port, f'INSERT INTO bloomTest.kv (id,val) VALUES ({i},"a{i}");'))
+        mustOk(tcpQuery("127.0.0.1", port, "FLUSH bloomTest.kv;"))
+    finally:
+        stopServer(proc)
+
+    writeConfig(str(cfg), port, str(dataDir), extra={"sstableBloomBitsPerKey": 10, "compactionMinThreshold": 100})
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        for gen in range(3):
+            for i in range(50 + gen * 50, 100 + gen * 50):
+                mustOk(tcpQuery("127.0.0.1", port, f'INSERT INTO bloomTest.kv (id,val) VALUES ({i},"b{i}");'))
+            mustOk(tcpQuery("127.0.0.1", port, "FLUSH bloomTest.kv;"))
+        mustOk(tcpQuery("127.0.0.1", port, "DELETE FROM bloomTest.kv WHERE id=120;"))
+        mustOk(tcpQuery("127.0.0.1", port, "FLUSH bloomTest.kv;"))
+
+        for i in range(0, 200, 3):
+            r = mustOk(tcpQuery("127.0.0.1", port, f"SELECT * FROM bloomTest.kv WHERE id={i};"))
+            assert r["found"] is (i != 120)
+            if i != 120:
+                assert r["row"]["val"] == (f"a{i}" if i < 50 else f"b{i}")
+        for i in range(1000, 1050):
+            r = mustOk(tcpQuery("127.0.0.1", port, f"SELECT * FROM bloomTest.kv WHERE id={i};"))
+            assert r["found"] is False
+    finally:
+        stopServer(proc)
+
+
+def testBlockSsTableCompressionMixed(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    filler = "lorem ipsum dolor sit amet " * 8
+    for gen, compression in enumerate(["none", "lz"]):
+        writeConfig(
+            str(cfg),
+            port,
+            str(dataDir),
+            extra={"sstableCompression": compression, "sstableBlockBytes": 4096, "compactionMinThreshold": 100},
+        )
+        proc = startServer(repoRoot, str(cfg))
+        try:
+            mustOk(tcpQuery("127.0.0.1", port, "CREATE KEYSPACE IF NOT EXISTS blockTest;"))
+            mustOk(tcpQuery("127.0.0.1", port, "CREATE TABLE IF NOT EXISTS blockTest.docs (id int64, body text, PRIMARY KEY (id));"))
+            for i in range(gen * 200, gen * 200 + 200):
+                mustOk(tcpQuery("127.0.0.1", port, f'INSERT INTO blockTest.docs (id,body) VALUES ({i},"{filler}{i}");'))
+            mustOk(tcpQuery("127.0.0.1", port, "FLUSH blockTest.docs;"))
+        finally:
+            stopServer(proc)
+
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        for i in range(0, 400, 7):
+            r = mustOk(tcpQuery("127.0.0.1", port, f"SELECT * FROM blockTest.docs WHERE id={i};"))
+            assert r["found"] is True
+            assert r["row"]["body"] == f"{filler}{i}"
+        r = mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM blockTest.docs WHERE id=400;"))
+        assert r["found"] is False
+        r = mustOk(tcpQuery("127.0.0.1", port, "SELECT COUNT(*) AS n FROM blockTest.docs;"))
+        assert r["rows"][0]["n"] == 400
+    finally:
+        stopServer(proc)
+
+
+def testBlockCacheMetrics(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    # Room for three 4 KiB blocks, so a full scan has to evict.
+    writeConfig(str(cfg), port, str(dataDir), extra={"blockCacheBytes": 16384, "sstableBlockBytes": 4096, "sstableCompression": "none"})
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE KEYSPACE IF NOT EXISTS cacheTest;"))
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE TABLE IF NOT EXISTS cacheTest.kv (id int64, val varchar, PRIMARY KEY (id));"))
+        for i in range(0, 400):
+            mustOk(tcpQuery("127.0.0.1", port, f'INSERT INTO cacheTest.kv (id,val) VALUES ({i},"{"v" * 64}{i}");'))
+        mustOk(tcpQuery("127.0.0.1", port, "FLUSH cacheTest.kv;"))
+
+        before = mustOk(tcpQuery("127.0.0.1", port, "SHOW METRICS IN cacheTest;"))
+        assert before["block_cache_capacity_bytes"] == 16384
+        for _ in range(5):
+            r = mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM cacheTest.kv WHERE id=7;"))
+            assert r["row"]["val"] == "v" * 64 + "7"
+        after = mustOk(tcpQuery("127.0.0.1", port, "SHOW METRICS IN cacheTest;"))
+        assert after["block_cache_misses"] - before["block_cache_misses"] == 1
+        assert after["block_cache_hits"] - before["block_cache_hits"] == 4
+
+        r = mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM cacheTest.kv;"))
+        assert len(r["rows"]) == 400
+        m = mustOk(tcpQuery("127.0.0.1", port, "SHOW METRICS IN cacheTest;"))
+        assert m["block_cache_evictions"] > 0
+        assert m["block_cache_used_bytes"] <= 16384
+    finally:
+        stopServer(proc)
+
+
+def testRowCacheTable(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    writeConfig(str(cfg), port, str(dataDir), extra={"compactionMinThreshold": 2})
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE KEYSPACE IF NOT EXISTS rowCacheTest;"))
+        r = tcpQuery("127.0.0.1", port, "CREATE TABLE rowCacheTest.bad (id int64, PRIMARY KEY (id)) WITH row_cache = \"lots\";")
+        assert r["ok"] is False
+        mustOk(
+            tcpQuery(
+                "127.0.0.1",
+                port,
+                'CREATE TABLE IF NOT EXISTS rowCacheTest.kv (id int64, val varchar, PRIMARY KEY (id)) WITH compaction = "leveled" AND row_cache = 8;',
+            )
+        )
+        for i in range(0, 20):
+            mustOk(tcpQuery("127.0.0.1", port, f'INSERT INTO rowCacheTest.kv (id,val) VALUES ({i},"a{i}");'))
+        mustOk(tcpQuery("127.0.0.1", port, "FLUSH rowCacheTest.kv;"))
+
+        # Cached hits, then writes that must replace both present and absent entries.
+        for _ in range(2):
+            for i in range(0, 25):
+                r = mustOk(tcpQuery("127.0.0.1", port, f"SELECT * FROM rowCacheTest.kv WHERE id={i};"))
+                assert r["found"] is (i < 20)
+        mustOk(tcpQuery("127.0.0.1", port, 'UPDATE rowCacheTest.kv SET val="b3" WHERE id=3;'))
+        mustOk(tcpQuery("127.0.0.1", port, "DELETE FROM rowCacheTest.kv WHERE id=4;"))
+        mustOk(tcpQuery("127.0.0.1", port, 'INSERT INTO rowCacheTest.kv (id,val) VALUES (22,"b22");'))
+        for gen in range(3):
+            mustOk(tcpQuery("127.0.0.1", port, f'INSERT INTO rowCacheTest.kv (id,val) VALUES (5,"c{gen}");'))
+            mustOk(tcpQuery("127.0.0.1", port, "FLUSH rowCacheTest.kv;"))
+        assert mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM rowCacheTest.kv WHERE id=3;"))["row"]["val"] == "b3"
+        assert mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM rowCacheTest.kv WHERE id=4;"))["found"] is False
+        assert mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM rowCacheTest.kv WHERE id=22;"))["row"]["val"] == "b22"
+        assert mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM rowCacheTest.kv WHERE id=5;"))["row"]["val"] == "c2"
+
+        mustOk(tcpQuery("127.0.0.1", port, "TRUNCATE TABLE rowCacheTest.kv;"))
+        assert mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM rowCacheTest.kv WHERE id=3;"))["found"] is False
+        mustOk(tcpQuery("127.0.0.1", port, 'INSERT INTO rowCacheTest.kv (id,val) VALUES (3,"d3");'))
+    finally:
+        stopServer(proc)
+
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        r = mustOk(tcpQuery("127.0.0.1", port, "DESCRIBE TABLE rowCacheTest.kv;"))
+        assert r["row_cache"] == 8
+        assert r["compaction"] == "leveled"
+        r = mustOk(tcpQuery("127.0.0.1", port, "SHOW CREATE TABLE rowCacheTest.kv;"))
+        assert r["create"].endswith(' WITH compaction = "leveled" AND row_cache = 8;')
+        assert mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM rowCacheTest.kv WHERE id=3;"))["row"]["val"] == "d3"
+    finally:
+        stopServer(proc)
+
+
+def testFullScanMergesVersions(tmp_path):
+    repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    dataDir = tmp_path / "data"
+    dataDir.mkdir(parents=True, exist_ok=True)
+
+    port = pickFreePort()
+    cfg = tmp_path / "settings.yml"
+    writeConfig(str(cfg), port, str(dataDir), extra={"compactionMinThreshold": 100})
+    proc = startServer(repoRoot, str(cfg))
+    try:
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE KEYSPACE IF NOT EXISTS scanTest;"))
+        mustOk(tcpQuery("127.0.0.1", port, "CREATE TABLE IF NOT EXISTS scanTest.kv (id int64, val varchar, PRIMARY KEY (id));"))
+        # Versions of the same keys spread over several SSTables and the memtable.
+        expected = {}
+        for gen in range(4):
+            for i in range(gen * 10, 60):
+                mustOk(tcpQuery("127.0.0.1", port, f'INSERT INTO scanTest.kv (id,val) VALUES ({i},"g{gen}");'))
+                expected[i] = f"g{gen}"
+            for i in range(gen, 60, 7):
+                mustOk(tcpQuery("127.0.0.1", port, f"DELETE FROM scanTest.kv WHERE id={i};"))
+                expected.pop(i, None)
+            if gen < 3:
+                mustOk(tcpQuery("127.0.0.1", port, "FLUSH scanTest.kv;"))
+
+        r = mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM scanTest.kv;"))
+        assert {row["id"]: row["val"] for row in r["rows"]} == expected
+        assert len(r["rows"]) == len(expected)
+
+        r = mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM scanTest.kv LIMIT 5;"))
+        assert len(r["rows"]) == 5
+        assert all(expected[row["id"]] == row["val"] for row in r["rows"])
+
+        # Equal sort keys come back in primary key order.
+        r = mustOk(tcpQuery("127.0.0.1", port, "SELECT * FROM scanTest.kv ORDER BY val DESC;"))
+        assert [row["id"] for row in r["rows"]] == sorted(expected, key=lambda k: (-int(expected[k][1:]), k))
+
+        r = mustOk(tcpQuery("127.0.0.1", port, "SELECT val, COUNT(*) AS n FROM scanTest.kv GROUP BY val ORDER BY val ASC;"))
+        counts = {}
+        for v in expected.values():
+            counts[v] = counts.get(v, 0) + 1
+        assert [(row["val"], row["n"]) for row in r["rows"]] == sorted(counts.items())
+    finally:
+        stopServer(proc)
+
+
 def testInsertMultiRow(tmp_path):
     repoRoot = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
     dataDir = tmp_path / "data"